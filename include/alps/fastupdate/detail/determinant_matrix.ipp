@@ -16,7 +16,10 @@ namespace alps {
         state_(waiting),
         inv_matrix_(0,0),
         permutation_row_col_(1),
-        p_gf_(p_gf)
+        p_gf_(p_gf),
+        max_delayed_rank_(0),
+        delayed_U_(0,0),
+        delayed_V_(0,0)
     {
     }
 
@@ -36,7 +39,10 @@ namespace alps {
         state_(waiting),
         inv_matrix_(0,0),
         permutation_row_col_(1),
-        p_gf_(p_gf)
+        p_gf_(p_gf),
+        max_delayed_rank_(0),
+        delayed_U_(0,0),
+        delayed_V_(0,0)
     {
       try_add(first, last);
       perform_add();
@@ -189,11 +195,14 @@ namespace alps {
 
       const itime_t t1 = operator_time(cdagg_ops_[col1]);
       const itime_t t2 = operator_time(cdagg_ops_[col2]);
-      cdagg_op_pos_[t1] = col2;
-      cdagg_op_pos_[t2] = col1;
+      cdagg_op_pos_.set(t1, col2);
+      cdagg_op_pos_.set(t2, col1);
 
       //Note we need to swap ROWS of the inverse matrix (not columns)
       inv_matrix_.swap_row(col1, col2);
+      if (delayed_rank() > 0) {
+        delayed_U_.swap_row(col1, col2);
+      }
       swap(cdagg_ops_[col1], cdagg_ops_[col2]);
       permutation_row_col_ *= -1;
     }
@@ -211,11 +220,14 @@ namespace alps {
 
       const itime_t t1 = operator_time(c_ops_[row1]);
       const itime_t t2 = operator_time(c_ops_[row2]);
-      cop_pos_[t1] = row2;
-      cop_pos_[t2] = row1;
+      cop_pos_.set(t1, row2);
+      cop_pos_.set(t2, row1);
 
       //Note we need to swap COLS of the inverse matrix (not rows)
       inv_matrix_.swap_col(row1, row2);
+      if (delayed_rank() > 0) {
+        delayed_V_.swap_col(row1, row2);
+      }
       swap(c_ops_[row1], c_ops_[row2]);
       permutation_row_col_ *= -1;
     }
@@ -234,7 +246,6 @@ namespace alps {
       Iterator first,
       Iterator last
     ) {
-      std::pair<typename std::map<itime_t,int>::iterator,bool> ret;
       itime_t time_new;
       int perm_diff = 0;
       for (Iterator it=first; it!=last; ++it) {
@@ -242,19 +253,15 @@ namespace alps {
 
         cdagg_ops_.push_back(it->first);
         time_new = operator_time(it->first);
-        perm_diff += std::distance(cdagg_op_pos_.lower_bound(time_new), cdagg_op_pos_.end());
-        ret = cdagg_op_pos_.insert(std::make_pair(operator_time(it->first), pos));
-        cdagg_ops_set_.insert(it->first);
-        if(ret.second==false) {
+        perm_diff += cdagg_op_pos_.count_not_less(time_new);
+        if(!cdagg_op_pos_.insert(time_new, pos)) {
           throw std::runtime_error("Something went wrong: cdagg already exists");
         }
 
         c_ops_.push_back(it->second);
         time_new = operator_time(it->second);
-        perm_diff += std::distance(cop_pos_.lower_bound(time_new), cop_pos_.end());
-        ret = cop_pos_.insert(std::make_pair(operator_time(it->second), pos));
-        c_ops_set_.insert(it->second);
-        if(ret.second==false) {
+        perm_diff += cop_pos_.count_not_less(time_new);
+        if(!cop_pos_.insert(time_new, pos)) {
           throw std::runtime_error("Something went wrong: c operator already exists");
         }
       }
@@ -281,14 +288,12 @@ namespace alps {
       int perm_diff = 0;
       for (int iop=0; iop<num_operators_remove; ++iop) {
         const itime_t t1 = operator_time(c_ops_.back());
-        perm_diff += std::distance(cop_pos_.lower_bound(t1), cop_pos_.end());
+        perm_diff += cop_pos_.count_not_less(t1);
         cop_pos_.erase(t1);
-        c_ops_set_.erase(c_ops_.back());
 
         const itime_t t2 = operator_time(cdagg_ops_.back());
-        perm_diff += std::distance(cdagg_op_pos_.lower_bound(t2), cdagg_op_pos_.end());
+        perm_diff += cdagg_op_pos_.count_not_less(t2);
         cdagg_op_pos_.erase(t2);
-        cdagg_ops_set_.erase(cdagg_ops_.back());
 
         c_ops_.pop_back();
         cdagg_ops_.pop_back();
@@ -308,12 +313,10 @@ namespace alps {
       const int nop_rem = cdagg_op_pos_.size() - inv_matrix_.size1(); //number of excess operators to be removed
       const int offset = inv_matrix_.size1();
 
-      //remove operators from std::map<operator_time,int>
+      //remove operators from the maps of positions
       for (int iop=0; iop<nop_rem; ++iop) {
         cop_pos_.erase(operator_time(c_ops_[iop+offset]));
-        c_ops_set_.erase(c_ops_[iop+offset]);
         cdagg_op_pos_.erase(operator_time(cdagg_ops_[iop+offset]));
-        cdagg_ops_set_.erase(cdagg_ops_[iop+offset]);
       }
 
       cdagg_ops_.resize(offset);
@@ -343,12 +346,12 @@ namespace alps {
       assert(cop_pos_.size()==num_ops);
       assert(cdagg_op_pos_.size()==num_ops);
 
-      for (typename std::map<itime_t,int>::const_iterator it=cop_pos_.begin(); it!=cop_pos_.end(); ++it) {
+      for (typename operator_map_t::const_iterator it=cop_pos_.begin(); it!=cop_pos_.end(); ++it) {
         assert(it->second<num_ops);
         assert(operator_time(c_ops_[it->second])==it->first);
       }
 
-      for (typename std::map<itime_t,int>::const_iterator it=cdagg_op_pos_.begin(); it!=cdagg_op_pos_.end(); ++it) {
+      for (typename operator_map_t::const_iterator it=cdagg_op_pos_.begin(); it!=cdagg_op_pos_.end(); ++it) {
         assert(it->second<num_ops);
         assert(operator_time(cdagg_ops_[it->second])==it->first);
       }
@@ -385,11 +388,13 @@ namespace alps {
       const int pert_order = cdagg_ops_.size();
       assert(size()==pert_order);
 
+      //pending delayed updates are discarded
+      delayed_U_.conservative_resize(pert_order, 0);
+      delayed_V_.conservative_resize(0, pert_order);
+
       inv_matrix_.destructive_resize(pert_order, pert_order);
       for (int j=0; j<pert_order; ++j) {
-        for (int i=0; i<pert_order; ++i) {
-          inv_matrix_(i,j) = p_gf_->operator()(c_ops_[i], cdagg_ops_[j]);
-        }
+        evaluate_gf_col(*p_gf_, &c_ops_[0], cdagg_ops_[j], inv_matrix_.block().col(j));
       }
       //std::cout << "matrix " << inv_matrix_ << std::endl;
       //std::cout << "det matrix " << inv_matrix_.safe_determinant() << std::endl;
@@ -414,13 +419,43 @@ namespace alps {
 
       eigen_matrix_t matrix(pert_order, pert_order);
       for (int j=0; j<pert_order; ++j) {
-        for (int i = 0; i < pert_order; ++i) {
-          matrix(i, j) = p_gf_->operator()(c_ops_[i], cdagg_ops_[j]);
-        }
+        evaluate_gf_col(*p_gf_, &c_ops_[0], cdagg_ops_[j], matrix.col(j));
       }
       return matrix;
     }
 
+    template<
+      typename Scalar,
+      typename GreensFunction,
+      typename CdaggerOp,
+      typename COp
+    >
+    void
+    DeterminantMatrix<Scalar,GreensFunction,CdaggerOp,COp>::set_max_delayed_rank(int max_rank) {
+      check_state(waiting);
+      if (max_rank < 0) {
+        throw std::invalid_argument("max_rank must not be negative!");
+      }
+      max_delayed_rank_ = max_rank;
+      if (delayed_rank() > 0 && delayed_rank() >= max_delayed_rank_) {
+        apply_delayed_updates(inv_matrix_, delayed_U_, delayed_V_);
+      }
+    }
+
+    template<
+      typename Scalar,
+      typename GreensFunction,
+      typename CdaggerOp,
+      typename COp
+    >
+    void
+    DeterminantMatrix<Scalar,GreensFunction,CdaggerOp,COp>::flush_delayed_updates() {
+      check_state(waiting);
+      if (delayed_rank() > 0) {
+        apply_delayed_updates(inv_matrix_, delayed_U_, delayed_V_);
+      }
+    }
+
     /*
     template<
       typename Scalar,
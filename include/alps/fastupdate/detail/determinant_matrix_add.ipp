@@ -30,26 +30,28 @@ namespace alps {
       perm_rat_ = add_new_operators(cdagg_c_add_first, cdagg_c_add_last);
 
       //compute the values of new elements
-      G_n_n_.resize(nop_add, nop_add);
-      G_n_j_.resize(nop_add, nop);
-      G_j_n_.resize(nop, nop_add);
-      for(int i=0;i<nop;++i) {
+      G_n_n_.destructive_resize(nop_add, nop_add);
+      G_n_j_.destructive_resize(nop_add, nop);
+      G_j_n_.destructive_resize(nop, nop_add);
+      if (nop > 0) {
         for (int iv=0; iv<nop_add; ++iv) {
-          G_n_j_(iv,i) = compute_g(nop+iv, i);
-        }
-      }
-      for(int i=0;i<nop; ++i){
-        for (int iv=0; iv<nop_add; ++iv) {
-          G_j_n_(i,iv) = compute_g(i, nop+iv);
+          evaluate_gf_row(*p_gf_, c_ops_[nop+iv], &cdagg_ops_[0], G_n_j_.block().row(iv));
+          evaluate_gf_col(*p_gf_, &c_ops_[0], cdagg_ops_[nop+iv], G_j_n_.block().col(iv));
         }
       }
       for (int iv2=0; iv2<nop_add; ++iv2) {
-        for (int iv = 0; iv < nop_add; ++iv) {
-          G_n_n_(iv, iv2) = compute_g(nop + iv, nop + iv2);
-        }
+        evaluate_gf_col(*p_gf_, &c_ops_[nop], cdagg_ops_[nop+iv2], G_n_n_.block().col(iv2));
       }
 
-      return static_cast<double>(perm_rat_)*compute_det_ratio_up(G_j_n_, G_n_j_, G_n_n_, inv_matrix_);
+      if (max_delayed_rank_ > 0 && nop > 0) {
+        return static_cast<double>(perm_rat_)*
+          compute_det_ratio_up_delayed(G_j_n_.block(), G_n_j_.block(), G_n_n_.block(), inv_matrix_, delayed_U_, delayed_V_, ws_);
+      }
+      if (nop_add == 1) {
+        return static_cast<double>(perm_rat_)*
+          compute_det_ratio_up_rank1(G_j_n_.block(), G_n_j_.block(), G_n_n_(0, 0), inv_matrix_, ws_);
+      }
+      return static_cast<double>(perm_rat_)*compute_det_ratio_up(G_j_n_.block(), G_n_j_.block(), G_n_n_.block(), inv_matrix_, ws_);
     }
 
     template<
@@ -62,7 +64,15 @@ namespace alps {
     DeterminantMatrix<Scalar,GreensFunction,CdaggerOp,COp>::perform_add() {
       check_state(try_add_called);
       state_ = waiting;
-      compute_inverse_matrix_up(G_j_n_, G_n_j_, G_n_n_, inv_matrix_);
+      insert_into_ops_sets(inv_matrix_.size1());
+      if (max_delayed_rank_ > 0 && inv_matrix_.size1() > 0) {
+        compute_inverse_matrix_up_delayed(G_j_n_.block(), G_n_n_.block(), inv_matrix_, delayed_U_, delayed_V_, ws_);
+        flush_delayed_updates_if_full();
+      } else if (G_n_n_.size1() == 1) {
+        compute_inverse_matrix_up_rank1(G_j_n_.block(), G_n_j_.block(), G_n_n_(0, 0), inv_matrix_, ws_);
+      } else {
+        compute_inverse_matrix_up(G_j_n_.block(), G_n_j_.block(), G_n_n_.block(), inv_matrix_, ws_);
+      }
       permutation_row_col_ *= perm_rat_;
     }
 
@@ -52,13 +52,14 @@ namespace alps {
             c_ops_[nop-1-iop]
           )
         );
-        cdagg_ops_set_.erase(cdagg_ops_[nop-1-iop]);
-        c_ops_set_.erase(c_ops_[nop-1-iop]);
       }
 
       //Remove the last operators and add new operators
       perm_rat_ = remove_last_operators(nop_rem);
 
+      if (max_delayed_rank_ > 0) {
+        return static_cast<double>(perm_rat_)*compute_det_ratio_down_delayed(nop_rem, inv_matrix_, delayed_U_, delayed_V_, ws_);
+      }
       return static_cast<double>(perm_rat_)*compute_det_ratio_down(nop_rem, inv_matrix_);
     }
 
@@ -74,8 +75,16 @@ namespace alps {
       state_ = waiting;
 
       const int nop_rem = removed_op_pairs_.size();
+      erase_removed_ops_from_ops_sets();
       permutation_row_col_ *= perm_rat_;
-      compute_inverse_matrix_down(nop_rem, inv_matrix_);
+      if (max_delayed_rank_ > 0) {
+        compute_inverse_matrix_down_delayed(nop_rem, inv_matrix_, delayed_U_, delayed_V_, ws_);
+        flush_delayed_updates_if_full();
+      } else if (nop_rem == 1) {
+        compute_inverse_matrix_down_rank1(inv_matrix_);
+      } else {
+        compute_inverse_matrix_down(nop_rem, inv_matrix_, ws_);
+      }
     }
 
     template<
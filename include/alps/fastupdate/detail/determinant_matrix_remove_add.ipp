@@ -18,6 +18,8 @@ namespace alps {
       CdaggCIterator2 cdagg_c_add_last
     ) {
       check_state(waiting);
+      //not implemented for delayed updates
+      flush_delayed_updates();
       state_ = try_rem_add_called;
 
       const int nop_rem = std::distance(cdagg_c_rem_first, cdagg_c_rem_last);
@@ -34,6 +36,7 @@ namespace alps {
       }
 
       //move all rows and cols to be removed to the last
+      removed_op_pairs_.resize(0);
       if (nop_rem>0) {
         rem_cols_.resize(nop_rem);
         rem_rows_.resize(nop_rem);
@@ -52,7 +55,6 @@ namespace alps {
         }
 
         //remember what operators are removed
-        removed_op_pairs_.resize(0);
         removed_op_pairs_.reserve(nop_rem);
         for (int iop=0; iop<nop_rem; ++iop) {
           removed_op_pairs_.push_back(
@@ -61,8 +63,6 @@ namespace alps {
               c_ops_[nop-1-iop]
             )
           );
-          cdagg_ops_set_.erase(cdagg_ops_[nop-1-iop]);
-          c_ops_set_.erase(c_ops_[nop-1-iop]);
         }
       }
 
@@ -71,30 +71,24 @@ namespace alps {
       perm_rat_ *= add_new_operators(cdagg_c_add_first, cdagg_c_add_last);
 
       //compute the values of new elements
-      G_n_n_.resize(nop_add, nop_add);
-      G_n_j_.resize(nop_add, nop_unchanged);
-      G_j_n_.resize(nop_unchanged, nop_add);
-      for(int i=0;i<nop_unchanged;++i) {
+      G_n_n_.destructive_resize(nop_add, nop_add);
+      G_n_j_.destructive_resize(nop_add, nop_unchanged);
+      G_j_n_.destructive_resize(nop_unchanged, nop_add);
+      if (nop_unchanged > 0) {
         for (int iv=0; iv<nop_add; ++iv) {
-          G_n_j_(iv,i) = compute_g(nop_unchanged+iv, i);
-        }
-      }
-      for(int i=0;i<nop_unchanged;++i){
-        for (int iv=0; iv<nop_add; ++iv) {
-          G_j_n_(i,iv) = compute_g(i, nop_unchanged+iv);
+          evaluate_gf_row(*p_gf_, c_ops_[nop_unchanged+iv], &cdagg_ops_[0], G_n_j_.block().row(iv));
+          evaluate_gf_col(*p_gf_, &c_ops_[0], cdagg_ops_[nop_unchanged+iv], G_j_n_.block().col(iv));
         }
       }
       for (int iv2=0; iv2<nop_add; ++iv2) {
-        for (int iv = 0; iv < nop_add; ++iv) {
-          G_n_n_(iv, iv2) = compute_g(nop_unchanged + iv, nop_unchanged + iv2);
-        }
+        evaluate_gf_col(*p_gf_, &c_ops_[nop_unchanged], cdagg_ops_[nop_unchanged+iv2], G_n_n_.block().col(iv2));
       }
 
       nop_added_ = std::distance(cdagg_c_add_first, cdagg_c_add_last);
 
-      replace_helper_
-        = ReplaceHelper<Scalar,eigen_matrix_t,eigen_matrix_t,eigen_matrix_t>(inv_matrix_, G_j_n_, G_n_j_, G_n_n_);
-      return static_cast<double>(perm_rat_)*replace_helper_.compute_det_ratio(inv_matrix_, G_j_n_, G_n_j_, G_n_n_);
+      replace_helper_.init(inv_matrix_, G_j_n_.block(), G_n_j_.block(), G_n_n_.block());
+      return static_cast<double>(perm_rat_)*
+        replace_helper_.compute_det_ratio(inv_matrix_, G_j_n_.block(), G_n_j_.block(), G_n_n_.block());
     }
 
     template<
@@ -105,12 +99,14 @@ namespace alps {
     >
     void
     DeterminantMatrix<Scalar,GreensFunction,CdaggerOp,COp>::perform_remove_add() {
-      replace_helper_.compute_inverse_matrix(inv_matrix_, G_j_n_, G_n_j_, G_n_n_);
+      replace_helper_.compute_inverse_matrix(inv_matrix_, G_j_n_.block(), G_n_j_.block(), G_n_n_.block());
       check_state(try_rem_add_called);
       state_ = waiting;
 
       if (update_impossible_) return;
 
+      erase_removed_ops_from_ops_sets();
+      insert_into_ops_sets(cdagg_ops_.size()-nop_added_);
       permutation_row_col_ *= perm_rat_;
       sanity_check();
     }
@@ -27,16 +27,14 @@ namespace alps {
       }
 
       //compute the values of new elements
-      G_j_n_.resize(nop, 1);
-      for(int i=0; i<nop; ++i) {
-        G_j_n_(i, 0) = p_gf_->operator()(c_ops_[i], new_cdagg);
-      }
+      G_j_n_.destructive_resize(nop, 1);
+      evaluate_gf_col(*p_gf_, &c_ops_[0], new_cdagg, G_j_n_.block().col(0));
 
       //permutation sign
       const int diff =
         std::abs(
-          std::distance(cdagg_op_pos_.lower_bound(operator_time(old_cdagg_)), cdagg_op_pos_.end())-
-          std::distance(cdagg_op_pos_.lower_bound(operator_time(new_cdagg_)), cdagg_op_pos_.end())
+          cdagg_op_pos_.count_not_less(operator_time(old_cdagg_))-
+          cdagg_op_pos_.count_not_less(operator_time(new_cdagg_))
         );
       perm_rat_ = (diff%2==0 ? 1 : -1);
       if (operator_time(new_cdagg_) > operator_time(old_cdagg_)) {
@@ -46,7 +44,9 @@ namespace alps {
       //std::cout << "computing " << det_rat_ << std::endl;
       //std::cout << "inv_matrix " << inv_matrix_ << std::endl;
       //std::cout << "G_j_n " << G_j_n_ << std::endl;
-      det_rat_ = compute_det_ratio_relace_last_col(inv_matrix_, G_j_n_);
+      det_rat_ = max_delayed_rank_ > 0 ?
+                 compute_det_ratio_relace_last_col_delayed(inv_matrix_, delayed_U_, delayed_V_, G_j_n_.block(), ws_) :
+                 compute_det_ratio_relace_last_col(inv_matrix_, G_j_n_.block());
       return (1.*perm_rat_)*det_rat_;
     }
 
@@ -63,11 +63,16 @@ namespace alps {
 
       const int nop = inv_matrix_.size1();
 
-      compute_inverse_matrix_replace_last_col(inv_matrix_, G_j_n_, det_rat_);
+      if (max_delayed_rank_ > 0) {
+        compute_inverse_matrix_replace_last_col_delayed(inv_matrix_, delayed_U_, delayed_V_, G_j_n_.block(), det_rat_, ws_);
+        flush_delayed_updates_if_full();
+      } else {
+        compute_inverse_matrix_replace_last_col(inv_matrix_, G_j_n_.block(), det_rat_, ws_);
+      }
       permutation_row_col_ *= perm_rat_;
       cdagg_ops_[nop-1] = new_cdagg_;
       cdagg_op_pos_.erase(operator_time(old_cdagg_));
-      cdagg_op_pos_.insert(std::make_pair(operator_time(new_cdagg_), nop-1));
+      cdagg_op_pos_.insert(operator_time(new_cdagg_), nop-1);
 
       cdagg_ops_set_.erase(old_cdagg_);
       cdagg_ops_set_.insert(new_cdagg_);
@@ -110,23 +115,23 @@ namespace alps {
       }
 
       //compute the values of new elements
-      G_n_j_.resize(1, nop);
-      for(int i=0; i<nop; ++i) {
-        G_n_j_(0, i) = p_gf_->operator()(new_c, cdagg_ops_[i]);
-      }
+      G_n_j_.destructive_resize(1, nop);
+      evaluate_gf_row(*p_gf_, new_c, &cdagg_ops_[0], G_n_j_.block().row(0));
 
       //permutation sign
       const int diff =
         std::abs(
-          std::distance(cop_pos_.lower_bound(operator_time(old_c_)), cop_pos_.end())-
-          std::distance(cop_pos_.lower_bound(operator_time(new_c_)), cop_pos_.end())
+          cop_pos_.count_not_less(operator_time(old_c_))-
+          cop_pos_.count_not_less(operator_time(new_c_))
         );
       perm_rat_ = (diff%2==0 ? 1 : -1);
       if (operator_time(new_c_) > operator_time(old_c_)) {
         perm_rat_ *= -1;
       }
 
-      det_rat_ = compute_det_ratio_relace_last_row(inv_matrix_, G_n_j_);
+      det_rat_ = max_delayed_rank_ > 0 ?
+                 compute_det_ratio_relace_last_row_delayed(inv_matrix_, delayed_U_, delayed_V_, G_n_j_.block(), ws_) :
+                 compute_det_ratio_relace_last_row(inv_matrix_, G_n_j_.block());
       return (1.*perm_rat_)*det_rat_;
     }
 
@@ -143,11 +148,16 @@ namespace alps {
 
       const int nop = inv_matrix_.size1();
 
-      compute_inverse_matrix_replace_last_row(inv_matrix_, G_n_j_, det_rat_);
+      if (max_delayed_rank_ > 0) {
+        compute_inverse_matrix_replace_last_row_delayed(inv_matrix_, delayed_U_, delayed_V_, G_n_j_.block(), det_rat_, ws_);
+        flush_delayed_updates_if_full();
+      } else {
+        compute_inverse_matrix_replace_last_row(inv_matrix_, G_n_j_.block(), det_rat_, ws_);
+      }
       permutation_row_col_ *= perm_rat_;
       c_ops_[nop-1] = new_c_;
       cop_pos_.erase(operator_time(old_c_));
-      cop_pos_.insert(std::make_pair(operator_time(new_c_), nop-1));
+      cop_pos_.insert(operator_time(new_c_), nop-1);
 
       c_ops_set_.erase(old_c_);
       c_ops_set_.insert(new_c_);
@@ -36,6 +36,18 @@ namespace alps {
       const Eigen::MatrixBase<Derived> &C,
       const Eigen::MatrixBase<Derived> &D,
       const ResizableMatrix <Scalar> &invA) {
+      FastUpdateWorkspace<Scalar> ws;
+      return compute_det_ratio_up(B, C, D, invA, ws);
+    }
+
+    template<typename Scalar, typename Derived>
+    Scalar
+    compute_det_ratio_up(
+      const Eigen::MatrixBase<Derived> &B,
+      const Eigen::MatrixBase<Derived> &C,
+      const Eigen::MatrixBase<Derived> &D,
+      const ResizableMatrix <Scalar> &invA,
+      FastUpdateWorkspace<Scalar> &ws) {
       const size_t N = invA.size1();
       const size_t M = D.rows();
 
@@ -49,8 +61,13 @@ namespace alps {
       if (N == 0) {
         return detail::safe_determinant(D);
       } else {
-        //compute H
-        return detail::safe_determinant(D - C * invA.block() * B);
+        //compute H^{-1} = D - C * invA * B
+        ws.C_invA.destructive_resize(M, N);
+        ws.C_invA.block().noalias() = C * invA.block();
+        ws.S.destructive_resize(M, M);
+        ws.S.block() = D;
+        ws.S.block().noalias() -= ws.C_invA.block() * B;
+        return detail::safe_determinant(ws.S.block());
       }
     }
 
@@ -61,9 +78,18 @@ namespace alps {
       const Eigen::MatrixBase<Derived> &C,
       const Eigen::MatrixBase<Derived> &D,
       ResizableMatrix <Scalar> &invA) {
-      typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> eigen_matrix_t;
-      typedef Eigen::Block<eigen_matrix_t> block_t;
+      FastUpdateWorkspace<Scalar> ws;
+      return compute_inverse_matrix_up(B, C, D, invA, ws);
+    }
 
+    template<typename Scalar, typename Derived>
+    Scalar
+    compute_inverse_matrix_up(
+      const Eigen::MatrixBase<Derived> &B,
+      const Eigen::MatrixBase<Derived> &C,
+      const Eigen::MatrixBase<Derived> &D,
+      ResizableMatrix <Scalar> &invA,
+      FastUpdateWorkspace<Scalar> &ws) {
       const int N = num_rows(invA);
       const int M = num_rows(D);
 
@@ -74,33 +100,35 @@ namespace alps {
       assert(num_rows(D) == M && num_cols(D) == M);
 
       if (N == 0) {
-        invA = detail::safe_inverse(D);
+        invA.destructive_resize(M, M);
+        detail::safe_inverse(D, invA.block());
         return detail::safe_determinant(D);
       } else {
-        //I don't know how expensive to allocate temporary objects C_invA, H, invA_B, F.
-        //We could keep them as static objects or members of a class.
-
         //compute H
-        const eigen_matrix_t C_invA = C * invA.block();
-        const eigen_matrix_t H = detail::safe_inverse(D - C_invA * B);
+        ws.C_invA.destructive_resize(M, N);
+        ws.C_invA.block().noalias() = C * invA.block();
+        ws.S.destructive_resize(M, M);
+        ws.S.block() = D;
+        ws.S.block().noalias() -= ws.C_invA.block() * B;
+        ws.invS.destructive_resize(M, M);
+        detail::safe_inverse(ws.S.block(), ws.invS.block());
 
-        //compute F
-        const eigen_matrix_t invA_B = invA.block() * B;
-        const eigen_matrix_t F = -invA_B * H;
+        ws.invA_B.destructive_resize(N, M);
+        ws.invA_B.block().noalias() = invA.block() * B;
 
         invA.conservative_resize(N + M, N + M);//this keeps the contents in the left corner of invA
 
         //compute G
-        invA.block(N, 0, M, N).noalias() = -H * C_invA;
+        invA.block(N, 0, M, N).noalias() = -ws.invS.block() * ws.C_invA.block();
 
         //compute E
-        eigen_matrix_t tmp_mat = invA_B * invA.block(N, 0, M, N);
-        invA.block(0, 0, N, N).noalias() -= tmp_mat;
+        invA.block(0, 0, N, N).noalias() -= ws.invA_B.block() * invA.block(N, 0, M, N);
 
-        invA.block(0, N, N, M) = F;
-        invA.block(N, N, M, M) = H;
+        //compute F
+        invA.block(0, N, N, M).noalias() = -ws.invA_B.block() * ws.invS.block();
+        invA.block(N, N, M, M) = ws.invS.block();
 
-        return 1. / detail::safe_determinant(H);
+        return 1. / detail::safe_determinant(ws.invS.block());
       }
     }
   }
@@ -155,14 +183,7 @@ namespace alps {
       assert(num_cols(invG) == NpM);
       assert(M > 0);
 
-      eigen_matrix_t H(M, M);
-      for (int j = 0; j < M; ++j) {
-        for (int i = 0; i < M; ++i) {
-          H(i, j) = invG(N+i, N+j);
-        }
-      }
-
-      return detail::safe_determinant(H);
+      return detail::safe_determinant(invG.block(N, N, M, M));
     }
 
     template<class Scalar>
@@ -225,8 +246,17 @@ namespace alps {
       const int num_rows_cols_removed,
       ResizableMatrix <Scalar> &invG
     ) {
-      typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> eigen_matrix_t;
+      FastUpdateWorkspace<Scalar> ws;
+      compute_inverse_matrix_down(num_rows_cols_removed, invG, ws);
+    }
 
+    template<class Scalar>
+    void
+    compute_inverse_matrix_down(
+      const int num_rows_cols_removed,
+      ResizableMatrix <Scalar> &invG,
+      FastUpdateWorkspace<Scalar> &ws
+    ) {
       const int NpM = num_rows(invG);
       const int M = num_rows_cols_removed;
       const int N = NpM - M;
@@ -246,10 +276,94 @@ namespace alps {
       if (N > 0) {
         //E -= F*H^{-1}*G
         //(N,M)x(M,M)x(M,N)
-        invG.block(0, 0, N, N).noalias() -=
-          invG.block(0, N, N, M) *
-          detail::safe_inverse(invG.block(N, N, M, M)) *
-          invG.block(N, 0, M, N);
+        ws.invS.destructive_resize(M, M);
+        detail::safe_inverse(invG.block(N, N, M, M), ws.invS.block());
+        ws.tmp.destructive_resize(N, M);
+        ws.tmp.block().noalias() = invG.block(0, N, N, M) * ws.invS.block();
+        invG.block(0, 0, N, N).noalias() -= ws.tmp.block() * invG.block(N, 0, M, N);
+      }
+      invG.conservative_resize(N, N);
+    }
+  }
+}
+
+/**
+ * Definition of Sherman-Morrison formula for adding and removing a single row and col
+ */
+namespace alps {
+  namespace fastupdate {
+    template<typename Scalar, typename Derived>
+    Scalar
+    compute_det_ratio_up_rank1(
+      const Eigen::MatrixBase<Derived> &B,
+      const Eigen::MatrixBase<Derived> &C,
+      Scalar D,
+      const ResizableMatrix<Scalar> &invA,
+      FastUpdateWorkspace<Scalar> &ws) {
+      const int N = invA.size1();
+
+      assert(num_rows(B) == N && num_cols(B) == 1);
+      assert(num_rows(C) == 1 && num_cols(C) == N);
+
+      if (N == 0) {
+        return D;
+      }
+
+      //D - C * invA * B
+      ws.C_invA.destructive_resize(1, N);
+      ws.C_invA.block().noalias() = C * invA.block();
+      return D - ws.C_invA.block().row(0).transpose().cwiseProduct(B.col(0)).sum();
+    }
+
+    template<typename Scalar, typename Derived>
+    Scalar
+    compute_inverse_matrix_up_rank1(
+      const Eigen::MatrixBase<Derived> &B,
+      const Eigen::MatrixBase<Derived> &C,
+      Scalar D,
+      ResizableMatrix<Scalar> &invA,
+      FastUpdateWorkspace<Scalar> &ws) {
+      const int N = invA.size1();
+
+      assert(num_rows(B) == N && num_cols(B) == 1);
+      assert(num_rows(C) == 1 && num_cols(C) == N);
+
+      if (N == 0) {
+        invA.destructive_resize(1, 1);
+        invA(0, 0) = 1.0/D;
+        return D;
+      }
+
+      assert(ws.C_invA.size1() == 1 && ws.C_invA.size2() == N);
+      const Scalar S = D - ws.C_invA.block().row(0).transpose().cwiseProduct(B.col(0)).sum();
+      const Scalar invS = 1.0/S;
+
+      ws.invA_B.destructive_resize(N, 1);
+      ws.invA_B.block().noalias() = invA.block() * B;
+      ws.invA_B.block() *= invS;
+
+      invA.conservative_resize(N + 1, N + 1);//this keeps the contents in the left corner of invA
+
+      //E = invA + invA_B * C_invA / S
+      invA.block(0, 0, N, N).noalias() += ws.invA_B.block() * ws.C_invA.block();
+      //F = -invA_B / S, G = -C_invA / S, H = 1/S
+      invA.block(0, N, N, 1) = -ws.invA_B.block();
+      invA.block(N, 0, 1, N) = -invS * ws.C_invA.block();
+      invA(N, N) = invS;
+
+      return S;
+    }
+
+    template<class Scalar>
+    void
+    compute_inverse_matrix_down_rank1(ResizableMatrix<Scalar> &invG) {
+      const int N = num_rows(invG) - 1;
+      assert(N >= 0);
+
+      //E -= F*G/H
+      if (N > 0) {
+        invG.block(0, N, N, 1) *= 1.0/invG(N, N);
+        invG.block(0, 0, N, N).noalias() -= invG.block(0, N, N, 1) * invG.block(N, 0, 1, N);
       }
       invG.conservative_resize(N, N);
     }
@@ -262,19 +376,31 @@ namespace alps {
 namespace alps {
   namespace fastupdate {
 
+    template<typename Scalar, typename M0, typename M1, typename M2>
+    ReplaceHelper<Scalar,M0,M1,M2>::ReplaceHelper() :
+      N_(0), M_(0), M_old_(0),
+      Mmat_(0,0), inv_tSp_(0,0), inv_tS_(0,0), inv_tS_tR_(0,0), Mmat_Q_(0,0), tSp_R_(0,0)
+    {
+    }
+
     template<typename Scalar, typename M0, typename M1, typename M2>
     ReplaceHelper<Scalar,M0,M1,M2>::ReplaceHelper(ResizableMatrix<Scalar>& invG,
                                                   const M0& Q,
                                                   const M1& R,
                                                   const M2& S) :
-      //invG_(invG),
-      //Q_(Q),
-      //R_(R),
-      //S_(S),
-      N_(num_cols(R)),
-      M_(num_rows(R)),
-      M_old_(num_cols(invG)-N_)
+      Mmat_(0,0), inv_tSp_(0,0), inv_tS_(0,0), inv_tS_tR_(0,0), Mmat_Q_(0,0), tSp_R_(0,0)
     {
+      init(invG, Q, R, S);
+    }
+
+    template<typename Scalar, typename M0, typename M1, typename M2>
+    void ReplaceHelper<Scalar,M0,M1,M2>::init(ResizableMatrix<Scalar>& invG,
+                                              const M0& Q,
+                                              const M1& R,
+                                              const M2& S) {
+      N_ = num_cols(R);
+      M_ = num_rows(R);
+      M_old_ = num_cols(invG)-N_;
       assert(num_cols(invG)==num_rows(invG));
       assert(num_rows(R)==M_ && num_cols(R)==N_);
       assert(num_rows(Q)==N_ && num_cols(Q)==M_);
@@ -296,22 +422,31 @@ namespace alps {
       block_t tS_view (invG.block(N_, N_, M_old_, M_old_ ));
 
       //FIX ME: use an alternative formula for the case the intermediate state is singular
-      if (detail::safe_determinant(tS_view) == 0.0) {
+      const Scalar det_tS = detail::safe_determinant(tS_view);
+      if (det_tS == 0.0) {
         std::cout << "Warning: intermediate state is singular " << std::endl;
         return 0.0;
       }
 
       //matrix M
-      Mmat_ = tP_view;
+      Mmat_.destructive_resize(N_, N_);
+      Mmat_.block() = tP_view;
       if (M_old_ > 0) {
-        Mmat_.noalias() -= tQ_view * detail::safe_inverse(tS_view) * tR_view; //(N, M_old) x (M_old, M_old) x (M_old, N)
+        inv_tS_.destructive_resize(M_old_, M_old_);
+        detail::safe_inverse(tS_view, inv_tS_.block());
+        inv_tS_tR_.destructive_resize(M_old_, N_);
+        inv_tS_tR_.block().noalias() = inv_tS_.block() * tR_view;
+        Mmat_.block().noalias() -= tQ_view * inv_tS_tR_.block(); //(N, M_old) x (M_old, M_old) x (M_old, N)
       }
 
       //(tS')^{-1}
-      inv_tSp_ = S;
-      inv_tSp_.noalias() -= R * (Mmat_ * Q).eval(); //(M,N)x(N,N)x(N,M)
+      Mmat_Q_.destructive_resize(N_, M_);
+      Mmat_Q_.block().noalias() = Mmat_.block() * Q;
+      inv_tSp_.destructive_resize(M_, M_);
+      inv_tSp_.block() = S;
+      inv_tSp_.block().noalias() -= R * Mmat_Q_.block(); //(M,N)x(N,N)x(N,M)
 
-      return detail::safe_determinant(tS_view)*detail::safe_determinant(inv_tSp_);
+      return det_tS*detail::safe_determinant(inv_tSp_.block());
     }
 
     template<typename Scalar, typename M0, typename M1, typename M2>
@@ -322,7 +457,7 @@ namespace alps {
       if (N_ == 0) {
         invG.destructive_resize(M_, M_);
         if(M_ > 0) {
-          invG.block().noalias() = detail::safe_inverse(S);
+          detail::safe_inverse(S, invG.block());
         }
         return;
       }
@@ -335,21 +470,23 @@ namespace alps {
 
       if (M_ > 0) {
         //tSp
-        tSp_view.noalias() = detail::safe_inverse(inv_tSp_);
+        detail::safe_inverse(inv_tSp_.block(), tSp_view);
 
         //tQp
         //(N,N)x(N,M)x(M,M) = (N,M)
-        tQp_view.noalias() = -Mmat_ * (Q * tSp_view).eval();
+        tQp_view.noalias() = -Mmat_Q_.block() * tSp_view;
 
         //tRp
         //(M,M)x(M,N)x(N,N)
-        tRp_view.noalias() = -(tSp_view * R).eval() * Mmat_;
+        tSp_R_.destructive_resize(M_, N_);
+        tSp_R_.block().noalias() = tSp_view * R;
+        tRp_view.noalias() = -tSp_R_.block() * Mmat_.block();
       }
 
       //tPp
-      tPp_view = Mmat_;
+      tPp_view = Mmat_.block();
       if (M_ > 0) {
-        tPp_view -= (Mmat_ * Q).eval() * tRp_view; //(N,N)x(N,M)x(M,N)
+        tPp_view.noalias() -= Mmat_Q_.block() * tRp_view; //(N,N)x(N,M)x(M,N)
       }
     }
 
@@ -360,9 +497,7 @@ namespace alps {
     Scalar compute_det_ratio_relace_last_row(const ResizableMatrix<Scalar> & invG,
                                              const Eigen::MatrixBase<Derived>& new_row_elements) {
       assert(new_row_elements.rows()==1);
-      Eigen::Matrix<Scalar,Eigen::Dynamic,Eigen::Dynamic> r(1,1);
-      r = new_row_elements*invG.block().col(invG.size2()-1);
-      return r(0,0);
+      return new_row_elements.row(0).transpose().cwiseProduct(invG.block().col(invG.size2()-1)).sum();
     }
 
     /**
@@ -371,22 +506,25 @@ namespace alps {
     template<typename Scalar, typename Derived>
     void compute_inverse_matrix_replace_last_row(ResizableMatrix<Scalar> & invG,
                                                  const Eigen::MatrixBase<Derived>& new_row_elements, Scalar det_rat) {
+      FastUpdateWorkspace<Scalar> ws;
+      compute_inverse_matrix_replace_last_row(invG, new_row_elements, det_rat, ws);
+    }
+
+    template<typename Scalar, typename Derived>
+    void compute_inverse_matrix_replace_last_row(ResizableMatrix<Scalar> & invG,
+                                                 const Eigen::MatrixBase<Derived>& new_row_elements, Scalar det_rat,
+                                                 FastUpdateWorkspace<Scalar> &ws) {
       assert(new_row_elements.rows()==1);
 
       const int N = invG.size1();
-      Eigen::Matrix<Scalar,Eigen::Dynamic,Eigen::Dynamic> R(1, N), last_col(N,1);
-      last_col = invG.block().col(N-1);
-
-      R(0, N-1) = 0.0;
-      R.block(0,0, 1,N-1) = new_row_elements*invG.block(0,0, N,N-1);
-      const Scalar inv_det_rat = 1.0/det_rat;
-      invG.block().col(N-1) = last_col*inv_det_rat;
-
-      for (int m = 0; m < N-1; m++) {
-        for (int n = 0; n < N; n++) {
-          invG(n, m) -= last_col(n,0)*R(0,m)*inv_det_rat;
-        }
-      }
+      ws.invA_B.destructive_resize(N, 1);
+      ws.C_invA.destructive_resize(1, N-1);
+      ws.invA_B.block() = invG.block().col(N-1);
+      ws.C_invA.block().noalias() = new_row_elements*invG.block(0,0, N,N-1);
+
+      ws.invA_B.block() *= 1.0/det_rat;
+      invG.block().col(N-1) = ws.invA_B.block();
+      invG.block(0,0, N,N-1).noalias() -= ws.invA_B.block()*ws.C_invA.block();
     }
 
     /**
@@ -396,9 +534,7 @@ namespace alps {
     Scalar compute_det_ratio_relace_last_col(const ResizableMatrix<Scalar> & invG,
                                              const Eigen::MatrixBase<Derived>& new_col_elements) {
       assert(new_col_elements.cols()==1);
-      Eigen::Matrix<Scalar,Eigen::Dynamic,Eigen::Dynamic> r(1,1);
-      r = invG.block().row(invG.size2()-1)*new_col_elements;
-      return r(0,0);
+      return invG.block().row(invG.size2()-1).transpose().cwiseProduct(new_col_elements.col(0)).sum();
     }
 
     /**
@@ -407,24 +543,304 @@ namespace alps {
     template<typename Scalar, typename Derived>
     void compute_inverse_matrix_replace_last_col(ResizableMatrix<Scalar> & invG,
                                                  const Eigen::MatrixBase<Derived>& new_col_elements, Scalar det_rat) {
+      FastUpdateWorkspace<Scalar> ws;
+      compute_inverse_matrix_replace_last_col(invG, new_col_elements, det_rat, ws);
+    }
+
+    template<typename Scalar, typename Derived>
+    void compute_inverse_matrix_replace_last_col(ResizableMatrix<Scalar> & invG,
+                                                 const Eigen::MatrixBase<Derived>& new_col_elements, Scalar det_rat,
+                                                 FastUpdateWorkspace<Scalar> &ws) {
       assert(new_col_elements.cols()==1);
 
       const int N = invG.size1();
-      Eigen::Matrix<Scalar,Eigen::Dynamic,Eigen::Dynamic> R(N, 1), last_row(1,N);
-      last_row = invG.block().row(N-1);
+      ws.C_invA.destructive_resize(1, N);
+      ws.invA_B.destructive_resize(N-1, 1);
+      ws.C_invA.block() = invG.block().row(N-1);
+      ws.invA_B.block().noalias() = invG.block(0,0, N-1,N)*new_col_elements;
+
+      ws.C_invA.block() *= 1.0/det_rat;
+      invG.block().row(N-1) = ws.C_invA.block();
+      invG.block(0,0, N-1,N).noalias() -= ws.invA_B.block()*ws.C_invA.block();
+    }
+  }
+}
+
+/**
+ * Definition of delayed updates
+ */
+namespace alps {
+  namespace fastupdate {
+    namespace detail {
+      //Append new columns to U and new rows to V
+      template<typename Scalar, typename Derived1, typename Derived2>
+      void append_delayed_update(ResizableMatrix<Scalar> &U, ResizableMatrix<Scalar> &V,
+                                 const Eigen::MatrixBase<Derived1> &new_cols, const Eigen::MatrixBase<Derived2> &new_rows) {
+        const int N = new_cols.rows();
+        const int K = U.size2();
+        const int M = new_cols.cols();
+        assert(new_rows.rows() == M && new_rows.cols() == N);
+        assert(K == 0 || (U.size1() == N && V.size2() == N));
+
+        U.conservative_resize(N, K + M);
+        U.block(0, K, N, M) = new_cols;
+        V.conservative_resize(K + M, N);
+        V.block(K, 0, M, N) = new_rows;
+      }
+    }
+
+    template<class Scalar>
+    void apply_delayed_updates(ResizableMatrix<Scalar> &invG, ResizableMatrix<Scalar> &U, ResizableMatrix<Scalar> &V) {
+      const int N = invG.size1();
+      if (U.size2() > 0 && N > 0) {
+        assert(U.size1() == N && V.size2() == N);
+        invG.block().noalias() += U.block() * V.block();
+      }
+      U.conservative_resize(N, 0);
+      V.conservative_resize(0, N);
+    }
+
+    template<typename Scalar, typename Derived>
+    Scalar
+    compute_det_ratio_up_delayed(
+      const Eigen::MatrixBase<Derived> &B,
+      const Eigen::MatrixBase<Derived> &C,
+      const Eigen::MatrixBase<Derived> &D,
+      const ResizableMatrix<Scalar> &invA,
+      const ResizableMatrix<Scalar> &U,
+      const ResizableMatrix<Scalar> &V,
+      FastUpdateWorkspace<Scalar> &ws) {
+      const int N = invA.size1();
+      const int M = D.rows();
+      const int K = U.size2();
+
+      assert(N > 0 && M > 0);
+      assert(num_rows(B) == N && num_cols(B) == M);
+      assert(num_rows(C) == M && num_cols(C) == N);
+
+      ws.invA_B.destructive_resize(N, M);
+      ws.C_invA.destructive_resize(M, N);
+      ws.invA_B.block().noalias() = invA.block() * B;
+      ws.C_invA.block().noalias() = C * invA.block();
+      if (K > 0) {
+        ws.tmp.destructive_resize(K, M);
+        ws.tmp.block().noalias() = V.block() * B;
+        ws.invA_B.block().noalias() += U.block() * ws.tmp.block();
+        ws.tmp.destructive_resize(M, K);
+        ws.tmp.block().noalias() = C * U.block();
+        ws.C_invA.block().noalias() += ws.tmp.block() * V.block();
+      }
+      ws.S.destructive_resize(M, M);
+      ws.S.block() = D;
+      ws.S.block().noalias() -= ws.C_invA.block() * B;
+      return detail::safe_determinant(ws.S.block());
+    }
+
+    template<typename Scalar, typename Derived>
+    Scalar
+    compute_inverse_matrix_up_delayed(
+      const Eigen::MatrixBase<Derived> &B,
+      const Eigen::MatrixBase<Derived> &D,
+      ResizableMatrix<Scalar> &invA,
+      ResizableMatrix<Scalar> &U,
+      ResizableMatrix<Scalar> &V,
+      FastUpdateWorkspace<Scalar> &ws) {
+      const int N = invA.size1();
+      const int M = D.rows();
+      const int K = U.size2();
+      assert(N > 0 && M > 0);
+      assert(ws.invA_B.size1() == N && ws.invA_B.size2() == M);
+      assert(ws.C_invA.size1() == M && ws.C_invA.size2() == N);
+
+      //H = (D - C_invA * B)^{-1}
+      ws.S.destructive_resize(M, M);
+      ws.S.block() = D;
+      ws.S.block().noalias() -= ws.C_invA.block() * B;
+      ws.invS.destructive_resize(M, M);
+      detail::safe_inverse(ws.S.block(), ws.invS.block());
+      ws.tmp.destructive_resize(M, N);
+      ws.tmp.block().noalias() = ws.invS.block() * ws.C_invA.block();
+
+      //The new inverse matrix reads
+      //  (invA + U*V + invA_B*H*C_invA, -invA_B*H)
+      //  (-H*C_invA,                     H       ).
+      //Only the last rows and cols are written into invA, the rest is appended to U and V.
+      invA.conservative_resize(N + M, N + M);
+      invA.block(0, N, N, M).setZero();
+      invA.block(N, 0, M, N) = -ws.tmp.block();
+      invA.block(N, N, M, M) = ws.invS.block();
+
+      U.conservative_resize(N + M, K + M);
+      V.conservative_resize(K + M, N + M);
+      if (K > 0) {
+        U.block(N, 0, M, K).setZero();
+        V.block(0, N, K, M).setZero();
+      }
+      U.block(0, K, N, M) = ws.invA_B.block();
+      U.block(N, K, M, M).setZero();
+      V.block(K, 0, M, N) = ws.tmp.block();
+      V.block(K, N, M, M) = -ws.invS.block();
+
+      return 1. / detail::safe_determinant(ws.invS.block());
+    }
 
-      R(N-1, 0) = 0.0;
-      R.block(0,0, N-1,1) = invG.block(0,0, N-1,N)*new_col_elements;
+    template<class Scalar>
+    Scalar
+    compute_det_ratio_down_delayed(
+      const int num_rows_cols_removed,
+      const ResizableMatrix<Scalar> &invG,
+      const ResizableMatrix<Scalar> &U,
+      const ResizableMatrix<Scalar> &V,
+      FastUpdateWorkspace<Scalar> &ws) {
+      const int M = num_rows_cols_removed;
+      const int N = num_rows(invG) - M;
+      const int K = U.size2();
+      assert(M > 0 && N >= 0);
+
+      if (K == 0) {
+        return detail::safe_determinant(invG.block(N, N, M, M));
+      }
+      ws.S.destructive_resize(M, M);
+      ws.S.block() = invG.block(N, N, M, M);
+      ws.S.block().noalias() += U.block(N, 0, M, K) * V.block(0, N, K, M);
+      return detail::safe_determinant(ws.S.block());
+    }
+
+    template<class Scalar>
+    void
+    compute_inverse_matrix_down_delayed(
+      const int num_rows_cols_removed,
+      ResizableMatrix<Scalar> &invG,
+      ResizableMatrix<Scalar> &U,
+      ResizableMatrix<Scalar> &V,
+      FastUpdateWorkspace<Scalar> &ws) {
+      const int M = num_rows_cols_removed;
+      const int N = num_rows(invG) - M;
+      const int K = U.size2();
+      assert(M > 0);
 
-      const Scalar inv_det_rat = 1.0/det_rat;
-      invG.block().row(N-1) = last_row*inv_det_rat;
+      if (N < 0) {
+        throw std::logic_error("N should not be negative!");
+      }
 
-      for (int m = 0; m < N-1; m++) {
-        for (int n = 0; n < N; n++) {
-          invG(m, n) -= last_row(0,n)*R(m,0)*inv_det_rat;
+      if (N > 0) {
+        //E -= F*H^{-1}*G, where E, F, G and H are the blocks of invG + U*V
+        ws.S.destructive_resize(M, M);
+        ws.invA_B.destructive_resize(N, M);
+        ws.C_invA.destructive_resize(M, N);
+        ws.S.block() = invG.block(N, N, M, M);
+        ws.invA_B.block() = invG.block(0, N, N, M);
+        ws.C_invA.block() = invG.block(N, 0, M, N);
+        if (K > 0) {
+          ws.S.block().noalias() += U.block(N, 0, M, K) * V.block(0, N, K, M);
+          ws.invA_B.block().noalias() += U.block(0, 0, N, K) * V.block(0, N, K, M);
+          ws.C_invA.block().noalias() += U.block(N, 0, M, K) * V.block(0, 0, K, N);
         }
+        ws.invS.destructive_resize(M, M);
+        detail::safe_inverse(ws.S.block(), ws.invS.block());
+        ws.tmp.destructive_resize(N, M);
+        ws.tmp.block().noalias() = -ws.invA_B.block() * ws.invS.block();
+
+        U.conservative_resize(N, K);
+        V.conservative_resize(K, N);
+        detail::append_delayed_update(U, V, ws.tmp.block(), ws.C_invA.block());
+      } else {
+        U.conservative_resize(0, 0);
+        V.conservative_resize(0, 0);
       }
+      invG.conservative_resize(N, N);
+    }
 
+    template<typename Scalar, typename Derived>
+    Scalar compute_det_ratio_relace_last_row_delayed(const ResizableMatrix<Scalar> & invG,
+                                                     const ResizableMatrix<Scalar> & U,
+                                                     const ResizableMatrix<Scalar> & V,
+                                                     const Eigen::MatrixBase<Derived>& new_row_elements,
+                                                     FastUpdateWorkspace<Scalar> &ws) {
+      assert(new_row_elements.rows()==1);
+      const int N = invG.size1();
+      const int K = U.size2();
+
+      Scalar r = new_row_elements.row(0).transpose().cwiseProduct(invG.block().col(N-1)).sum();
+      if (K > 0) {
+        ws.tmp.destructive_resize(1, K);
+        ws.tmp.block().noalias() = new_row_elements*U.block();
+        r += ws.tmp.block().row(0).transpose().cwiseProduct(V.block().col(N-1)).sum();
+      }
+      return r;
+    }
+
+    template<typename Scalar, typename Derived>
+    void compute_inverse_matrix_replace_last_row_delayed(const ResizableMatrix<Scalar> & invG,
+                                                         ResizableMatrix<Scalar> & U,
+                                                         ResizableMatrix<Scalar> & V,
+                                                         const Eigen::MatrixBase<Derived>& new_row_elements,
+                                                         Scalar det_rat,
+                                                         FastUpdateWorkspace<Scalar> &ws) {
+      assert(new_row_elements.rows()==1);
+      const int N = invG.size1();
+      const int K = U.size2();
+
+      //invG' = invG + last_col * (e_{N-1}^T - new_row * invG)/det_rat
+      ws.invA_B.destructive_resize(N, 1);
+      ws.C_invA.destructive_resize(1, N);
+      ws.invA_B.block() = invG.block().col(N-1);
+      ws.C_invA.block().noalias() = new_row_elements*invG.block();
+      if (K > 0) {
+        ws.invA_B.block().noalias() += U.block() * V.block().col(N-1);
+        ws.tmp.destructive_resize(1, K);
+        ws.tmp.block().noalias() = new_row_elements*U.block();
+        ws.C_invA.block().noalias() += ws.tmp.block() * V.block();
+      }
+      ws.C_invA(0, N-1) -= 1.0;
+      ws.C_invA.block() *= -1.0/det_rat;
+      detail::append_delayed_update(U, V, ws.invA_B.block(), ws.C_invA.block());
+    }
+
+    template<typename Scalar, typename Derived>
+    Scalar compute_det_ratio_relace_last_col_delayed(const ResizableMatrix<Scalar> & invG,
+                                                     const ResizableMatrix<Scalar> & U,
+                                                     const ResizableMatrix<Scalar> & V,
+                                                     const Eigen::MatrixBase<Derived>& new_col_elements,
+                                                     FastUpdateWorkspace<Scalar> &ws) {
+      assert(new_col_elements.cols()==1);
+      const int N = invG.size1();
+      const int K = U.size2();
+
+      Scalar r = invG.block().row(N-1).transpose().cwiseProduct(new_col_elements.col(0)).sum();
+      if (K > 0) {
+        ws.tmp.destructive_resize(K, 1);
+        ws.tmp.block().noalias() = V.block()*new_col_elements;
+        r += U.block().row(N-1).transpose().cwiseProduct(ws.tmp.block().col(0)).sum();
+      }
+      return r;
+    }
+
+    template<typename Scalar, typename Derived>
+    void compute_inverse_matrix_replace_last_col_delayed(const ResizableMatrix<Scalar> & invG,
+                                                         ResizableMatrix<Scalar> & U,
+                                                         ResizableMatrix<Scalar> & V,
+                                                         const Eigen::MatrixBase<Derived>& new_col_elements,
+                                                         Scalar det_rat,
+                                                         FastUpdateWorkspace<Scalar> &ws) {
+      assert(new_col_elements.cols()==1);
+      const int N = invG.size1();
+      const int K = U.size2();
+
+      //invG' = invG + (e_{N-1} - invG * new_col) * last_row/det_rat
+      ws.C_invA.destructive_resize(1, N);
+      ws.invA_B.destructive_resize(N, 1);
+      ws.C_invA.block() = invG.block().row(N-1);
+      ws.invA_B.block().noalias() = invG.block()*new_col_elements;
+      if (K > 0) {
+        ws.C_invA.block().noalias() += U.block().row(N-1) * V.block();
+        ws.tmp.destructive_resize(K, 1);
+        ws.tmp.block().noalias() = V.block()*new_col_elements;
+        ws.invA_B.block().noalias() += U.block() * ws.tmp.block();
+      }
+      ws.invA_B(N-1, 0) -= 1.0;
+      ws.invA_B.block() *= -1.0/det_rat;
+      detail::append_delayed_update(U, V, ws.invA_B.block(), ws.C_invA.block());
     }
   }
 }
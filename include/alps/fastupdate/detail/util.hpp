@@ -2,6 +2,9 @@
 
 #include <algorithm>
 #include <iterator>
+#include <vector>
+#include <stdexcept>
+#include <cassert>
 
 #include <Eigen/Core>
 
@@ -51,7 +54,7 @@ namespace alps {
       }
 
       //Compute the determinant of a matrix avoiding underflow and overflow
-      //Note: This make a copy of the matrix.
+      //Note: This make a copy of the matrix if it is larger than 2x2.
       template<typename Derived>
       typename Derived::Scalar
       safe_determinant(const Eigen::MatrixBase<Derived>& mat) {
@@ -61,6 +64,17 @@ namespace alps {
         if (N==0) {
           return 1.0;
         }
+        if (N==1) {
+          return mat(0,0);
+        }
+        if (N==2) {
+          const RealScalar max_coeff = max_abs_coeff(mat);
+          if (max_coeff==0.0) {
+            return 0.0;
+          }
+          return ((mat(0,0)/max_coeff)*(mat(1,1)/max_coeff) - (mat(0,1)/max_coeff)*(mat(1,0)/max_coeff))
+                 * (max_coeff*max_coeff);
+        }
         Eigen::Matrix<typename Derived::Scalar,Eigen::Dynamic,Eigen::Dynamic> mat_copy(mat);
         const RealScalar max_coeff = mat_copy.cwiseAbs().maxCoeff();
         if (max_coeff==0.0) {
@@ -149,6 +163,32 @@ namespace alps {
         return mat_copy.inverse()/max_coeff;
       }
 
+      //Compute the inverse of a matrix avoiding underflow and overflow and store it in result, which must be resized in advance.
+      //Note: This make a copy of the matrix if it is larger than 2x2.
+      template<typename Derived, typename Derived2>
+      void
+      safe_inverse(const Eigen::MatrixBase<Derived>& mat, const Eigen::MatrixBase<Derived2>& result_) {
+        typedef typename Derived::Scalar Scalar;
+        typedef typename Derived::RealScalar RealScalar;
+        Eigen::MatrixBase<Derived2>& result = result_.const_cast_derived();
+
+        const int N = mat.rows();
+        assert(mat.cols()==N && result.rows()==N && result.cols()==N);
+        if (N==1) {
+          result(0,0) = static_cast<Scalar>(1.0)/mat(0,0);
+        } else if (N==2) {
+          const RealScalar max_coeff = max_abs_coeff(mat);
+          const Scalar a = mat(0,0)/max_coeff, b = mat(0,1)/max_coeff, c = mat(1,0)/max_coeff, d = mat(1,1)/max_coeff;
+          const Scalar inv_det = static_cast<Scalar>(1.0)/((a*d - b*c)*max_coeff);
+          result(0,0) = d*inv_det;
+          result(0,1) = -b*inv_det;
+          result(1,0) = -c*inv_det;
+          result(1,1) = a*inv_det;
+        } else if (N>2) {
+          result = safe_inverse(mat);
+        }
+      }
+
       //Comb sort (in ascending order). Returns the permutation sign (1 or -1)
       //Assumption: no duplicate members
       //Compare: lesser operator
@@ -213,6 +253,81 @@ namespace alps {
       bool lesser_by_abs(const Scalar& v1, const Scalar& v2) {
         return std::abs(v1) < std::abs(v2);
       }
+
+      /**
+       * Map from the imaginary time of an operator to the position of its row/col in the matrix
+       * The elements are stored in a vector sorted by time.
+       * In contrast to std::map, insertion and removal do not allocate memory once the vector has grown,
+       * and the number of operators at or after a given time is obtained in O(log N).
+       */
+      template<typename Key>
+      class FlatPositionMap {
+      public:
+        typedef std::pair<Key,int> value_type;
+        typedef typename std::vector<value_type>::const_iterator const_iterator;
+
+        int size() const { return data_.size(); }
+        const_iterator begin() const { return data_.begin(); }
+        const_iterator end() const { return data_.end(); }
+
+        /** return false if the key already exists */
+        bool insert(const Key& key, int pos) {
+          typename std::vector<value_type>::iterator it = lower_bound(key);
+          if (it != data_.end() && !(key < it->first)) {
+            return false;
+          }
+          data_.insert(it, value_type(key, pos));
+          return true;
+        }
+
+        void erase(const Key& key) {
+          typename std::vector<value_type>::iterator it = lower_bound(key);
+          if (it != data_.end() && !(key < it->first)) {
+            data_.erase(it);
+          }
+        }
+
+        bool contains(const Key& key) const {
+          const_iterator it = lower_bound(key);
+          return it != data_.end() && !(key < it->first);
+        }
+
+        int at(const Key& key) const {
+          const_iterator it = lower_bound(key);
+          if (it == data_.end() || key < it->first) {
+            throw std::out_of_range("FlatPositionMap::at: key not found");
+          }
+          return it->second;
+        }
+
+        void set(const Key& key, int pos) {
+          typename std::vector<value_type>::iterator it = lower_bound(key);
+          assert(it != data_.end() && !(key < it->first));
+          it->second = pos;
+        }
+
+        /** number of elements whose keys are not smaller than key */
+        int count_not_less(const Key& key) const {
+          return std::distance(lower_bound(key), data_.end());
+        }
+
+      private:
+        struct KeyLess {
+          bool operator()(const value_type& v, const Key& key) const {
+            return v.first < key;
+          }
+        };
+
+        typename std::vector<value_type>::iterator lower_bound(const Key& key) {
+          return std::lower_bound(data_.begin(), data_.end(), key, KeyLess());
+        }
+
+        const_iterator lower_bound(const Key& key) const {
+          return std::lower_bound(data_.begin(), data_.end(), key, KeyLess());
+        }
+
+        std::vector<value_type> data_;
+      };
     }
   }
 }
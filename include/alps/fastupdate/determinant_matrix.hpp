@@ -17,12 +17,43 @@
 namespace alps {
   namespace fastupdate {
 
+    /**
+     * Evaluate a row of the G matrix: out(i) = gf(c_op, cdagg_ops[i]) for i = 0, ..., out.size()-1
+     *
+     * The Green's function may provide an overload of this function for a faster batched evaluation,
+     * which is found by argument-dependent lookup (like operator_time and operator_flavor).
+     */
+    template<typename GreensFunction, typename COp, typename CdaggerOp, typename Derived>
+    void evaluate_gf_row(const GreensFunction &gf, const COp &c_op, const CdaggerOp *cdagg_ops,
+                         const Eigen::MatrixBase<Derived> &out) {
+      Eigen::MatrixBase<Derived> &out_ = const_cast<Eigen::MatrixBase<Derived> &>(out);
+      const int n = out_.size();
+      for (int i = 0; i < n; ++i) {
+        out_(i) = gf(c_op, cdagg_ops[i]);
+      }
+    }
+
+    /**
+     * Evaluate a column of the G matrix: out(i) = gf(c_ops[i], cdagg_op) for i = 0, ..., out.size()-1
+     */
+    template<typename GreensFunction, typename COp, typename CdaggerOp, typename Derived>
+    void evaluate_gf_col(const GreensFunction &gf, const COp *c_ops, const CdaggerOp &cdagg_op,
+                         const Eigen::MatrixBase<Derived> &out) {
+      Eigen::MatrixBase<Derived> &out_ = const_cast<Eigen::MatrixBase<Derived> &>(out);
+      const int n = out_.size();
+      for (int i = 0; i < n; ++i) {
+        out_(i) = gf(c_ops[i], cdagg_op);
+      }
+    }
+
     /**
      * CdaggerOp and COp must have the following functionalities
      *   CdaggerOp::itime_type, COp::itime_type the type of time
      *
      *  Function itime_type operator_time(const CdaggerOp&) and operator_time(const COp&)
      *  Function int operator_flavor(const CdaggerOp&) and operator_flavor(const COp&)
+     *
+     * Rows and columns of the G matrix are computed by evaluate_gf_row and evaluate_gf_col.
      */
     template<
       typename Scalar,
@@ -50,7 +81,7 @@ namespace alps {
       typedef typename CdaggerOp::itime_type itime_t;
       typedef std::vector<CdaggerOp> cdagg_container_t;
       typedef std::vector<COp> c_container_t;
-      typedef std::map<itime_t,int> operator_map_t;
+      typedef detail::FlatPositionMap<itime_t> operator_map_t;
       typedef boost::multi_index::multi_index_container<CdaggerOp> cdagg_set_t;
       typedef boost::multi_index::multi_index_container<COp> c_set_t;
 
@@ -131,6 +162,9 @@ namespace alps {
        * Compute determinant. This may suffer from overflow
        */
       inline Scalar compute_determinant() const {
+        if (delayed_rank() > 0) {
+          return (1.*permutation_row_col_)/compute_inverse_matrix().determinant();
+        }
         return (1.*permutation_row_col_)/inv_matrix_.determinant();
       }
 
@@ -140,7 +174,9 @@ namespace alps {
           r[0] = 1.0;
           return r;
         } else {
-          const std::vector<Scalar>& vec = detail::lu_product<Scalar>(inv_matrix_.block());
+          const std::vector<Scalar>& vec = delayed_rank() > 0 ?
+                                           detail::lu_product<Scalar>(compute_inverse_matrix()) :
+                                           detail::lu_product<Scalar>(inv_matrix_.block());
           std::vector<Scalar> r(vec.size());
           std::transform(
               vec.begin(), vec.end(), r.begin(),
@@ -160,9 +196,27 @@ namespace alps {
        * Compute inverse matrix. The rows and cols may not be time-ordered.
        */
       eigen_matrix_t compute_inverse_matrix() const {
+        if (delayed_rank() > 0) {
+          return inv_matrix_.block() + delayed_U_.block() * delayed_V_.block();
+        }
         return eigen_matrix_t(inv_matrix_.block());
       }
 
+      /**
+       * Set the max rank of delayed updates.
+       * Accepted updates are kept as low-rank corrections in side buffers
+       * and applied to the inverse matrix at once when their total rank reaches max_rank.
+       * max_rank = 0 (default) disables delayed updates.
+       */
+      void set_max_delayed_rank(int max_rank);
+
+      int max_delayed_rank() const {return max_delayed_rank_;}
+
+      /**
+       * Apply pending delayed updates to the inverse matrix
+       */
+      void flush_delayed_updates();
+
       /**
        * Remove some operators and add new operators: no acutual update, just compute determinant ratio
        */
@@ -217,7 +271,7 @@ namespace alps {
       cdagg_container_t cdagg_ops_;
       c_container_t c_ops_;
 
-      //Time-ordered set
+      //Time-ordered set (updated only when an update is accepted)
       cdagg_set_t cdagg_ops_set_;
       c_set_t c_ops_set_;
 
@@ -235,8 +289,16 @@ namespace alps {
       std::vector<int> rem_cols_, rem_rows_;
       std::vector<std::pair<CdaggerOp,COp> > removed_op_pairs_;
 
-      eigen_matrix_t G_n_n_, G_n_j_, G_j_n_;
-      ReplaceHelper<Scalar,eigen_matrix_t,eigen_matrix_t,eigen_matrix_t> replace_helper_;
+      typedef typename ResizableMatrix<Scalar>::block_type block_type;
+      ResizableMatrix<Scalar> G_n_n_, G_n_j_, G_j_n_;
+      ReplaceHelper<Scalar,block_type,block_type,block_type> replace_helper_;
+
+      //delayed updates: the actual inverse matrix is inv_matrix_ + delayed_U_ * delayed_V_
+      int max_delayed_rank_;
+      ResizableMatrix<Scalar> delayed_U_, delayed_V_;
+
+      //work space reused by the fast-update formulas (grows but never shrinks)
+      FastUpdateWorkspace<Scalar> ws_;
 
       /*
        * Private auxially functions
@@ -360,7 +422,15 @@ namespace alps {
       /** remove excess operators, which were inserted by add_new_operators() */
       void remove_excess_operators();
 
-      inline Scalar compute_g(int row, int col) const {return p_gf_->operator()(c_ops_[row], cdagg_ops_[col]); }
+      /** rank of the pending delayed updates */
+      inline int delayed_rank() const {return delayed_U_.size2();}
+
+      /** apply the delayed updates to the inverse matrix if the buffers are full */
+      inline void flush_delayed_updates_if_full() {
+        if (delayed_rank() >= std::min(max_delayed_rank_, size())) {
+          apply_delayed_updates(inv_matrix_, delayed_U_, delayed_V_);
+        }
+      }
 
       /** return if there is an operator at a given time */
       inline bool exist_cdagg(const CdaggerOp& cdagg) const {
@@ -374,19 +444,37 @@ namespace alps {
 
       /** return if there is an operator at a given time */
       inline bool exist(itime_t time) const {
-        return cop_pos_.find(time)!=cop_pos_.end() || cdagg_op_pos_.find(time)!=cdagg_op_pos_.end();
+        return cop_pos_.contains(time) || cdagg_op_pos_.contains(time);
       }
 
       inline int find_cdagg(const CdaggerOp& cdagg) const {
-        assert(cdagg_op_pos_.find(operator_time(cdagg))!=cdagg_op_pos_.end());
+        assert(cdagg_op_pos_.contains(operator_time(cdagg)));
         return cdagg_op_pos_.at(operator_time(cdagg));
       }
 
       inline int find_c(const COp& c) const {
-        assert(cop_pos_.find(operator_time(c))!=cop_pos_.end());
+        assert(cop_pos_.contains(operator_time(c)));
         return cop_pos_.at(operator_time(c));
       }
 
+      /** insert the operators in the rows and cols from first_pos to the end into the time-ordered sets */
+      inline void insert_into_ops_sets(int first_pos) {
+        const int num_ops = static_cast<int>(cdagg_ops_.size());
+        for (int iop=first_pos; iop<num_ops; ++iop) {
+          cdagg_ops_set_.insert(cdagg_ops_[iop]);
+          c_ops_set_.insert(c_ops_[iop]);
+        }
+      }
+
+      /** erase the operators in removed_op_pairs_ from the time-ordered sets */
+      inline void erase_removed_ops_from_ops_sets() {
+        const int num_removed = static_cast<int>(removed_op_pairs_.size());
+        for (int iop=0; iop<num_removed; ++iop) {
+          cdagg_ops_set_.erase(removed_op_pairs_[iop].first);
+          c_ops_set_.erase(removed_op_pairs_[iop].second);
+        }
+      }
+
       void sanity_check() const;
 
     };
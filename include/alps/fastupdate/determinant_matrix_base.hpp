@@ -159,6 +159,18 @@ namespace alps {
        * Rebuild the matrix from scratch
        */
       void rebuild_inverse_matrix();
+
+      /**
+       * Set the max rank of delayed updates. Accepted updates are kept as low-rank corrections
+       * and applied to the inverse matrix by a single matrix-matrix product when their total rank reaches max_rank.
+       * max_rank = 0 disables delayed updates.
+       */
+      void set_max_delayed_rank(int max_rank);
+
+      /**
+       * Apply pending delayed updates to the inverse matrix
+       */
+      void flush_delayed_updates();
     };
 
     using detail::comb_sort;
@@ -281,6 +281,28 @@ namespace alps {
         }
       }
 
+      /**
+       * Set the max rank of delayed updates for all blocks (see DeterminantMatrix::set_max_delayed_rank)
+       */
+      void set_max_delayed_rank(int max_rank) {
+        for (int sector=0; sector<num_sectors_; ++sector) {
+          det_mat_[sector].set_max_delayed_rank(max_rank);
+        }
+      }
+
+      int max_delayed_rank() const {
+        return num_sectors_ > 0 ? det_mat_[0].max_delayed_rank() : 0;
+      }
+
+      /**
+       * Apply pending delayed updates to the inverse matrices of all blocks
+       */
+      void flush_delayed_updates() {
+        for (int sector=0; sector<num_sectors_; ++sector) {
+          det_mat_[sector].flush_delayed_updates();
+        }
+      }
+
     private:
       typedef DeterminantMatrix<Scalar,GreensFunction,CdaggerOp,COp> BlockMatrixType;
 
@@ -12,6 +12,21 @@
 namespace alps {
   namespace fastupdate {
 
+    /**
+     * Work space for the fast-update formulas
+     * The memory of these matrices only grows (see ResizableMatrix).
+     * Passing the same work space to every call avoids allocating temporary matrices in each update.
+     *
+     * For an update of the inverse matrix invA of size (N,N) with M rows and cols,
+     * C_invA: (M,N), invA_B: (N,M), S and invS: (M,M), tmp: any size
+     */
+    template<typename Scalar>
+    struct FastUpdateWorkspace {
+      FastUpdateWorkspace() : C_invA(0,0), invA_B(0,0), S(0,0), invS(0,0), tmp(0,0) {}
+
+      ResizableMatrix<Scalar> C_invA, invA_B, S, invS, tmp;
+    };
+
     /**
      * Compute the determinant ratio with addition rows and cols
      * We implement equations in Appendix B.1.1 of Luitz's thesis.
@@ -30,6 +45,18 @@ namespace alps {
       const Eigen::MatrixBase<Derived> &D,
       const ResizableMatrix<Scalar> &invA);
 
+    /**
+     * Similar function using a work space
+     */
+    template<typename Scalar, typename Derived>
+    Scalar
+      compute_det_ratio_up(
+      const Eigen::MatrixBase<Derived> &B,
+      const Eigen::MatrixBase<Derived> &C,
+      const Eigen::MatrixBase<Derived> &D,
+      const ResizableMatrix<Scalar> &invA,
+      FastUpdateWorkspace<Scalar> &ws);
+
     /**
      * Update the inverse matrix by adding rows and cols
      * We implement equations in Appendix B.1.1 of Luitz's thesis.
@@ -48,6 +75,18 @@ namespace alps {
       const Eigen::MatrixBase<Derived> &D,
       ResizableMatrix<Scalar> &invA);
 
+    /**
+     * Similar function using a work space
+     */
+    template<typename Scalar, typename Derived>
+    Scalar
+      compute_inverse_matrix_up(
+      const Eigen::MatrixBase<Derived> &B,
+      const Eigen::MatrixBase<Derived> &C,
+      const Eigen::MatrixBase<Derived> &D,
+      ResizableMatrix<Scalar> &invA,
+      FastUpdateWorkspace<Scalar> &ws);
+
     /**
      * Compute the determinant ratio for the removal of rows and cols
      * We implement equations in Appendix B.1.1 of Luitz's thesis.
@@ -117,6 +156,59 @@ namespace alps {
       ResizableMatrix<Scalar> &invG
     );
 
+    /**
+     * Similar function using a work space
+     */
+    template<class Scalar>
+    void
+      compute_inverse_matrix_down(
+      const int num_rows_cols_removed,
+      ResizableMatrix<Scalar> &invG,
+      FastUpdateWorkspace<Scalar> &ws
+    );
+
+    /**
+     * Compute the determinant ratio with addition of a single row and col (Sherman-Morrison)
+     * This is equivalent to compute_det_ratio_up with M=1 but works on vectors.
+     * On exit, ws.C_invA = C*invA, which is reused in compute_inverse_matrix_up_rank1.
+     *
+     * @param B right top block of the new matrix (N,1)
+     * @param C left bottom block of the new matrix (1,N)
+     * @param D right bottom element of the new matrix
+     * @param invA inverse of the currrent matrix
+     */
+    template<typename Scalar, typename Derived>
+    Scalar
+      compute_det_ratio_up_rank1(
+      const Eigen::MatrixBase<Derived> &B,
+      const Eigen::MatrixBase<Derived> &C,
+      Scalar D,
+      const ResizableMatrix<Scalar> &invA,
+      FastUpdateWorkspace<Scalar> &ws);
+
+    /**
+     * Update the inverse matrix by adding a single row and col (Sherman-Morrison)
+     * ws.C_invA must be the one computed by compute_det_ratio_up_rank1.
+     * The upper left block is updated by a rank-1 update of invA.
+     */
+    template<typename Scalar, typename Derived>
+    Scalar
+      compute_inverse_matrix_up_rank1(
+      const Eigen::MatrixBase<Derived> &B,
+      const Eigen::MatrixBase<Derived> &C,
+      Scalar D,
+      ResizableMatrix<Scalar> &invA,
+      FastUpdateWorkspace<Scalar> &ws);
+
+    /**
+     * Update the inverse matrix for the removal of the last row and col (Sherman-Morrison)
+     * This is equivalent to compute_inverse_matrix_down with num_rows_cols_removed=1.
+     * The determinant ratio is simply given by the last diagonal element of invG.
+     */
+    template<class Scalar>
+    void
+      compute_inverse_matrix_down_rank1(ResizableMatrix<Scalar> &invG);
+
     /**
      * Update the inverse matrix for addition and removal of rows and cols
      * We implement Ye-Hua Lie and Lei Wang (2015): Eqs. (17)-(26) before taking the limit of tS->0
@@ -127,8 +219,12 @@ namespace alps {
     template<typename Scalar, typename M0, typename M1, typename M2>
     class ReplaceHelper {
     public:
-      ReplaceHelper() {};
+      ReplaceHelper();
       ReplaceHelper(ResizableMatrix<Scalar>& invG, const M0& R, const M1& Q, const M2& S);
+      /**
+       * Set up for a new update. The work matrices are kept, so that no memory is allocated in steady state.
+       */
+      void init(ResizableMatrix<Scalar>& invG, const M0& R, const M1& Q, const M2& S);
       Scalar compute_det_ratio(ResizableMatrix<Scalar>& invG, const M0& R, const M1& Q, const M2& S);
       void compute_inverse_matrix(ResizableMatrix<Scalar>& invG, const M0& R, const M1& Q, const M2& S);
 
@@ -142,7 +238,9 @@ namespace alps {
       //M2& S_;
       int N_, M_, M_old_;
 
-      eigen_matrix_t Mmat_, inv_tSp_;
+      ResizableMatrix<Scalar> Mmat_, inv_tSp_;
+      //work space
+      ResizableMatrix<Scalar> inv_tS_, inv_tS_tR_, Mmat_Q_, tSp_R_;
     };
 
 
@@ -160,6 +258,14 @@ namespace alps {
     void compute_inverse_matrix_replace_last_row(ResizableMatrix<Scalar> & invG,
                              const Eigen::MatrixBase<Derived>& new_row_elements, Scalar det_rat);
 
+    /**
+     * Similar function using a work space
+     */
+    template<typename Scalar, typename Derived>
+    void compute_inverse_matrix_replace_last_row(ResizableMatrix<Scalar> & invG,
+                                                 const Eigen::MatrixBase<Derived>& new_row_elements, Scalar det_rat,
+                                                 FastUpdateWorkspace<Scalar> &ws);
+
     /**
      * Compute deteterminat ratio for the replacement of the last column of the G matrix
      */
@@ -173,6 +279,122 @@ namespace alps {
     template<typename Scalar, typename Derived>
     void compute_inverse_matrix_replace_last_col(ResizableMatrix<Scalar> & invG,
                                                  const Eigen::MatrixBase<Derived>& new_col_elements, Scalar det_rat);
+
+    /**
+     * Similar function using a work space
+     */
+    template<typename Scalar, typename Derived>
+    void compute_inverse_matrix_replace_last_col(ResizableMatrix<Scalar> & invG,
+                                                 const Eigen::MatrixBase<Derived>& new_col_elements, Scalar det_rat,
+                                                 FastUpdateWorkspace<Scalar> &ws);
+
+    /**
+     * Delayed updates: the inverse matrix is given implicitly by invG + U*V.
+     * Accepted updates are appended to U and V as low-rank corrections instead of being applied to invG.
+     * The corrections are applied to invG by a single matrix-matrix product in apply_delayed_updates.
+     *
+     * Each function below is the counterpart of the function without the suffix "_delayed".
+     * invG may no longer be invertible on its own, only invG + U*V is the inverse of the current G matrix.
+     */
+    template<class Scalar>
+    void apply_delayed_updates(ResizableMatrix<Scalar> &invG, ResizableMatrix<Scalar> &U, ResizableMatrix<Scalar> &V);
+
+    /**
+     * Compute the determinant ratio with addition rows and cols (delayed updates)
+     * On exit, ws.invA_B = (invA + U*V)*B and ws.C_invA = C*(invA + U*V), which are reused in compute_inverse_matrix_up_delayed.
+     */
+    template<typename Scalar, typename Derived>
+    Scalar
+      compute_det_ratio_up_delayed(
+      const Eigen::MatrixBase<Derived> &B,
+      const Eigen::MatrixBase<Derived> &C,
+      const Eigen::MatrixBase<Derived> &D,
+      const ResizableMatrix<Scalar> &invA,
+      const ResizableMatrix<Scalar> &U,
+      const ResizableMatrix<Scalar> &V,
+      FastUpdateWorkspace<Scalar> &ws);
+
+    /**
+     * Update the inverse matrix by adding rows and cols (delayed updates)
+     * ws.invA_B and ws.C_invA must be those computed by compute_det_ratio_up_delayed.
+     * invA, U and V are resized automatically. The rank of U*V increases by the number of rows added.
+     */
+    template<typename Scalar, typename Derived>
+    Scalar
+      compute_inverse_matrix_up_delayed(
+      const Eigen::MatrixBase<Derived> &B,
+      const Eigen::MatrixBase<Derived> &D,
+      ResizableMatrix<Scalar> &invA,
+      ResizableMatrix<Scalar> &U,
+      ResizableMatrix<Scalar> &V,
+      FastUpdateWorkspace<Scalar> &ws);
+
+    /**
+     * Compute the determinant ratio for the removal of the last rows and cols (delayed updates)
+     */
+    template<class Scalar>
+    Scalar
+      compute_det_ratio_down_delayed(
+      const int num_rows_cols_removed,
+      const ResizableMatrix<Scalar> &invG,
+      const ResizableMatrix<Scalar> &U,
+      const ResizableMatrix<Scalar> &V,
+      FastUpdateWorkspace<Scalar> &ws);
+
+    /**
+     * Update the inverse matrix for the removal of the last rows and cols (delayed updates)
+     * The rank of U*V increases by the number of rows removed.
+     */
+    template<class Scalar>
+    void
+      compute_inverse_matrix_down_delayed(
+      const int num_rows_cols_removed,
+      ResizableMatrix<Scalar> &invG,
+      ResizableMatrix<Scalar> &U,
+      ResizableMatrix<Scalar> &V,
+      FastUpdateWorkspace<Scalar> &ws);
+
+    /**
+     * Compute deteterminat ratio for the replacement of the last row of the G matrix (delayed updates)
+     */
+    template<typename Scalar, typename Derived>
+    Scalar compute_det_ratio_relace_last_row_delayed(const ResizableMatrix<Scalar> & invG,
+                                                     const ResizableMatrix<Scalar> & U,
+                                                     const ResizableMatrix<Scalar> & V,
+                                                     const Eigen::MatrixBase<Derived>& new_row_elements,
+                                                     FastUpdateWorkspace<Scalar> &ws);
+
+    /**
+     * Replace the last row of the G matrix (delayed updates)
+     */
+    template<typename Scalar, typename Derived>
+    void compute_inverse_matrix_replace_last_row_delayed(const ResizableMatrix<Scalar> & invG,
+                                                         ResizableMatrix<Scalar> & U,
+                                                         ResizableMatrix<Scalar> & V,
+                                                         const Eigen::MatrixBase<Derived>& new_row_elements,
+                                                         Scalar det_rat,
+                                                         FastUpdateWorkspace<Scalar> &ws);
+
+    /**
+     * Compute deteterminat ratio for the replacement of the last column of the G matrix (delayed updates)
+     */
+    template<typename Scalar, typename Derived>
+    Scalar compute_det_ratio_relace_last_col_delayed(const ResizableMatrix<Scalar> & invG,
+                                                     const ResizableMatrix<Scalar> & U,
+                                                     const ResizableMatrix<Scalar> & V,
+                                                     const Eigen::MatrixBase<Derived>& new_col_elements,
+                                                     FastUpdateWorkspace<Scalar> &ws);
+
+    /**
+     * Replace the last col of the G matrix (delayed updates)
+     */
+    template<typename Scalar, typename Derived>
+    void compute_inverse_matrix_replace_last_col_delayed(const ResizableMatrix<Scalar> & invG,
+                                                         ResizableMatrix<Scalar> & U,
+                                                         ResizableMatrix<Scalar> & V,
+                                                         const Eigen::MatrixBase<Derived>& new_col_elements,
+                                                         Scalar det_rat,
+                                                         FastUpdateWorkspace<Scalar> &ws);
   }
 }
 
@@ -131,8 +131,12 @@ namespace alps {
         if (!is_allocated()) {
           values_.resize(size1, size2);
         } else {
+          //The memory never shrinks, which allows to reuse the same object as a work space for matrices of various shapes
           if (size1 > memory_size1() || size2 > memory_size2()) {
-            values_.resize(1.2 * size1 + 1, 1.2 * size2 + 1);
+            values_.resize(
+              size1 > memory_size1() ? static_cast<int>(1.2 * size1 + 1) : memory_size1(),
+              size2 > memory_size2() ? static_cast<int>(1.2 * size2 + 1) : memory_size2()
+            );
           }
         }
         size1_ = size1;
@@ -131,12 +131,15 @@ class HybridizationSimulation: public alps::mcbase {
   void read_two_time_correlation_functions();
 
   void do_one_sweep(); // one sweep of the window
+  void update_outer_state(); // Metropolis update of the outer state (model.outer_state_sampling)
   void transition_between_config_spaces();
   void global_updates(); //expensive updates
   void update_MC_parameters(); //update parameters for MC moves during thermalization steps
   void measure_n();
   void measure_two_time_correlation_functions();
   void adjust_worm_space_weight();
+  void record_state_weights(); //weights of eigenstates in the trace during thermalization
+  void truncate_states(); //throw away high-energy states with small weights (model.truncation_weight_tolerance)
 
   int get_config_space_position(ConfigSpace config_space) const {
     if (config_space == Z_FUNCTION) {
@@ -255,8 +258,9 @@ class HybridizationSimulation: public alps::mcbase {
   //Deprecated: will be relaced by worm sampling
   boost::scoped_ptr<MeasCorrelation<SW_TYPE, EqualTimeOperator<1> > > p_meas_corr;
 
-  //Acceptance rate of global shift and swap updates
+  //Acceptance rate of global shift, swap and outer-state updates
   AcceptanceRateMeasurement global_shift_acc_rate;
+  AcceptanceRateMeasurement outer_state_acc_rate;
   std::vector<AcceptanceRateMeasurement> swap_acc_rate;
 
   //for measuring the volume of configuration spaces
@@ -276,6 +280,10 @@ class HybridizationSimulation: public alps::mcbase {
 
   std::vector<bool> config_spaces_visited_in_measurement_steps;
 
+  //Weights of inner states (for each sector) and outer states (for each braket) accumulated during thermalization
+  const double truncation_weight_tolerance;
+  std::vector<std::vector<double> > inner_state_weights, outer_state_weights;
+
   void sanity_check();
 
 };
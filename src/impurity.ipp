@@ -20,18 +20,31 @@ void HybridizationSimulation<IMP_MODEL>::define_parameters(parameters_type &para
       .define<int>("verbose", 0, "Verbose output for a non-zero value")
       .define<int>("sliding_window.max", 1000, "Max number of windows")
       .define<int>("sliding_window.min", 1, "Min number of windows")
+      .define<int>("sliding_window.n_threads", 1, "Number of OpenMP threads for evolving bras/kets in parallel")
+      .define<std::string>("sliding_window.engine",
+                           "stack",
+                           "Engine for trace evaluation: stack (sliding window) or tree (binary tree over [0, beta], no sliding window)")
+      .define<std::string>("sliding_window.norm_bound",
+                           "spectral",
+                           "Bound on norms of bras/kets for lazy trace evaluation: spectral (exact), holder (sqrt of the product of the 1- and infinity-norms, capped by the Frobenius norm) or frobenius. All of them are upper bounds.")
           //Model definition
       .define<int>("model.sites", "Number of sites/orbitals")
       .define<int>("model.spins", "Number of spins")
       .define<double>("model.beta", "Inverse temperature")
       .define<int>("model.n_tau_hyb",
                    "Hybridization function is defined on a uniform mesh of N_TAU + 1 imaginary points.")
+      .define<std::string>("model.hybridization_interpolation",
+                           "linear",
+                           "Interpolation of the hybridization function between the points of the mesh: linear or cubic (cubic spline, allows a much coarser mesh)")
           //Updates
       .define<int>("update.multi_pair_ins_rem", 2, "Perform 1, 2, ..., k-pair updates.")
       .define<int>("update.n_global_updates", 10, "Global updates are performed every N_GLOBAL_UPDATES updates.")
       .define<std::string>("update.swap_vector", "", "Definition of global flavor-exchange updates.")
       .define<int>("update.single_operator_shift", 1, "Perform shifts of a single operator if a non-zero value is specified.")
       .define<int>("update.operator_pair_flavor_update", 1, "Perform changes of flavors of a pair of operators if a non-zero value is specified.")
+      .define<int>("update.delayed_update_rank",
+                   0,
+                   "Accepted updates of the inverse matrix are kept as low-rank corrections and applied at once when their total rank reaches this value (0: no delayed updates).")
           //Measurement
       .define<int>("measurement.n_non_worm_meas",
                    10,
@@ -116,12 +129,14 @@ HybridizationSimulation<IMP_MODEL>::HybridizationSimulation(parameters_type cons
       g_meas_legendre(FLAVORS, p["measurement.G1.n_legendre"], p["measurement.G1.n_matsubara"], BETA),
       p_meas_corr(0),
       global_shift_acc_rate(),
+      outer_state_acc_rate(),
       swap_acc_rate(0),
       timings(4, 0.0),
       verbose(p["verbose"].template as<int>() != 0),
       thermalized(false),
       pert_order_recorder(),
-      config_spaces_visited_in_measurement_steps(0)
+      config_spaces_visited_in_measurement_steps(0),
+      truncation_weight_tolerance(p["model.truncation_weight_tolerance"].template as<double>())
 {
 
   if (thermalization_time < 0) {
@@ -138,6 +153,15 @@ HybridizationSimulation<IMP_MODEL>::HybridizationSimulation(parameters_type cons
   /////////////////////////////////////////////////////////////////////
   resize_vectors();
 
+  {
+    const std::string interpolation = p["model.hybridization_interpolation"].template as<std::string>();
+    if (interpolation == "cubic") {
+      F->set_interpolation(CUBIC_SPLINE_INTERPOLATION);
+    } else if (interpolation != "linear") {
+      throw std::runtime_error("Unknown model.hybridization_interpolation: " + interpolation);
+    }
+  }
+
   /////////////////////////////////////////////////////////////////////
   ////Initialize Monte Carlo configuration  ///////////////////////////
   /////////////////////////////////////////////////////////////////////
@@ -147,8 +171,52 @@ HybridizationSimulation<IMP_MODEL>::HybridizationSimulation(parameters_type cons
   if (p["sliding_window.max"].template as<int>() < p["sliding_window.max"].template as<int>()) {
     throw std::runtime_error("sliding_window.max cannot be smaller than sliding_window.max.");
   }
-  sliding_window.init_stacks(p["sliding_window.min"], mc_config.operators);
+  sliding_window.set_num_threads(p["sliding_window.n_threads"].template as<int>());
+#ifndef _OPENMP
+  if (p["sliding_window.n_threads"].template as<int>() > 1 && comm.rank() == 0) {
+    std::cerr << "Warning: sliding_window.n_threads is ignored because the solver was compiled without OpenMP." << std::endl;
+  }
+#endif
+  if (p["sliding_window.engine"].template as<std::string>() == "tree") {
+    sliding_window.set_trace_engine(TREE_ENGINE);
+  } else if (p["sliding_window.engine"].template as<std::string>() != "stack") {
+    throw std::runtime_error("Unknown sliding_window.engine: " + p["sliding_window.engine"].template as<std::string>());
+  }
+  {
+    const std::string norm_bound = p["sliding_window.norm_bound"].template as<std::string>();
+    if (norm_bound == "spectral") {
+      sliding_window.set_norm_bound_type(SPECTRAL_NORM_BOUND);
+    } else if (norm_bound == "holder") {
+      sliding_window.set_norm_bound_type(HOLDER_NORM_BOUND);
+    } else if (norm_bound == "frobenius") {
+      sliding_window.set_norm_bound_type(FROBENIUS_NORM_BOUND);
+    } else {
+      throw std::runtime_error("Unknown sliding_window.norm_bound: " + norm_bound);
+    }
+  }
+  sliding_window.init_stacks(
+      sliding_window.get_trace_engine() == TREE_ENGINE ? 1 : p["sliding_window.min"].template as<int>(),
+      mc_config.operators
+  );
+  mc_config.outer_state = p_model->outer_state_sampling() ? p_model->get_outer_state() : -1;
   mc_config.trace = sliding_window.compute_trace(mc_config.operators);
+
+  if (truncation_weight_tolerance < 0.0 || truncation_weight_tolerance >= 1.0) {
+    throw std::runtime_error("model.truncation_weight_tolerance must be in [0, 1).");
+  }
+  if (truncation_weight_tolerance > 0.0) {
+    inner_state_weights.resize(p_model->num_sectors());
+    for (int sector = 0; sector < p_model->num_sectors(); ++sector) {
+      inner_state_weights[sector].resize(p_model->dim_sector(sector), 0.0);
+    }
+    //The braket changes during the simulation if the outer states are sampled.
+    if (!p_model->outer_state_sampling()) {
+      outer_state_weights.resize(p_model->num_brakets());
+      for (int braket = 0; braket < p_model->num_brakets(); ++braket) {
+        outer_state_weights[braket].resize(size2(p_model->get_outer_ket(braket).obj()), 0.0);
+      }
+    }
+  }
   if (comm.rank() == 0 && verbose) {
     std::cout << "initial trace = " << mc_config.trace << " with N_SLIDING_WINDOW = " << sliding_window.get_n_window()
               << std::endl;
@@ -171,6 +239,11 @@ HybridizationSimulation<IMP_MODEL>::HybridizationSimulation(parameters_type cons
     }
   }
 
+  if (par["update.delayed_update_rank"].template as<int>() < 0) {
+    throw std::runtime_error("update.delayed_update_rank must not be negative.");
+  }
+  mc_config.M.set_max_delayed_rank(par["update.delayed_update_rank"].template as<int>());
+
   const int rank_ins_rem = par["update.multi_pair_ins_rem"].template as<int>();
   if (rank_ins_rem < 1) {
     throw std::runtime_error("update.multi_pair_ins_rem is not valid.");
@@ -260,6 +333,9 @@ template<typename IMP_MODEL>
 void HybridizationSimulation<IMP_MODEL>::measure_every_step() {
   assert(is_thermalized());
 
+  //Measurements need the full inverse matrix
+  mc_config.M.flush_delayed_updates();
+
   switch (mc_config.current_config_space()) {
     case Z_FUNCTION:
       g_meas_legendre.measure(mc_config);//measure Green's function by removal
@@ -363,6 +439,28 @@ void HybridizationSimulation<IMP_MODEL>::measure() {
   timings[3] = timer.elapsed().wall * 1E-9;
   measurements["TimingsSecPerNMEAS"] << timings;
   std::fill(timings.begin(), timings.end(), 0.0);
+
+  const std::pair<unsigned long, unsigned long> stack_cache_stats = sliding_window.get_stack_cache_stats();
+  measurements["SlidingWindowStatesReused"] << static_cast<double>(stack_cache_stats.first);
+  measurements["SlidingWindowStatesEvolved"] << static_cast<double>(stack_cache_stats.second);
+  sliding_window.reset_stack_cache_stats();
+
+  const std::pair<unsigned long, unsigned long> stack_pool_stats = sliding_window.get_braket_pool_stats();
+  const std::pair<unsigned long, unsigned long> work_pool_stats = p_model->get_work_pool_stats();
+  measurements["BraketBuffersAllocated"] << static_cast<double>(stack_pool_stats.first + work_pool_stats.first);
+  measurements["BraketBuffersReused"] << static_cast<double>(stack_pool_stats.second + work_pool_stats.second);
+  sliding_window.reset_braket_pool_stats();
+  p_model->reset_work_pool_stats();
+
+  const std::pair<unsigned long, unsigned long> lazy_eval_stats = sliding_window.get_lazy_eval_stats();
+  measurements["LazyTraceEvaluations"] << static_cast<double>(lazy_eval_stats.first);
+  measurements["LazyTraceEarlyRejections"] << static_cast<double>(lazy_eval_stats.second);
+  sliding_window.reset_lazy_eval_stats();
+
+  const std::pair<unsigned long, unsigned long> exp_cache_stats = p_model->get_exp_cache_stats();
+  measurements["ExpVectorCacheHits"] << static_cast<double>(exp_cache_stats.first);
+  measurements["ExpVectorCacheMisses"] << static_cast<double>(exp_cache_stats.second);
+  p_model->reset_exp_cache_stats();
 #endif
 }
 
@@ -400,6 +498,12 @@ void HybridizationSimulation<IMP_MODEL>::measure_Z_function_space() {
     global_shift_acc_rate.reset();
   }
 
+  //measure acceptance rate of outer-state update
+  if (outer_state_acc_rate.has_samples()) {
+    measurements["Acceptance_rate_outer_state"] << outer_state_acc_rate.compute_acceptance_rate();
+    outer_state_acc_rate.reset();
+  }
+
   //measure acceptance rate of swap update
   if (swap_acc_rate.size() > 0 && swap_acc_rate[0].has_samples()) {
     std::vector<double> acc_swap(swap_acc_rate.size());
@@ -506,7 +610,13 @@ void HybridizationSimulation<IMP_MODEL>::do_one_sweep() {
   const int rank_ins_rem = dist(random.engine()) + 1;
   const int current_n_window = std::max(N_win_standard / rank_ins_rem, 1);
   if (current_n_window != sliding_window.get_n_window()) {
-    sliding_window.set_window_size(current_n_window, mc_config.operators, 0, ITIME_LEFT);
+    //Start from the end of [0, beta] where the window currently is. Stacks on the other side can be reused.
+    if (sliding_window.get_position_right_edge() > 0 &&
+        sliding_window.get_position_right_edge() >= sliding_window.get_n_window() - 1) {
+      sliding_window.set_window_size(current_n_window, mc_config.operators, 2 * current_n_window - 2, ITIME_RIGHT);
+    } else {
+      sliding_window.set_window_size(current_n_window, mc_config.operators, 0, ITIME_LEFT);
+    }
   }
 
   //assert(sliding_window.get_position_right_edge() == 0);
@@ -538,12 +648,212 @@ void HybridizationSimulation<IMP_MODEL>::do_one_sweep() {
 
     transition_between_config_spaces();
 
+    if (!is_thermalized() && truncation_weight_tolerance > 0.0) {
+      record_state_weights();
+    }
+
     sliding_window.move_window_to_next_position(mc_config.operators);
   }
+
+  if (p_model->outer_state_sampling()) {
+    update_outer_state();
+  }
   sanity_check();
   //assert(sliding_window.get_position_right_edge() == 0 || sliding_window.get_position_right_edge() == 2*current_n_window-2);
 }
 
+//Propose another outer state uniformly at random.
+//The bras/kets of the sliding window are rebuilt from the new outer state and restored if the update is rejected.
+template<typename IMP_MODEL>
+void HybridizationSimulation<IMP_MODEL>::update_outer_state() {
+  const int num_outer_states = p_model->num_outer_states();
+  if (num_outer_states < 2) {
+    return;
+  }
+
+  const int outer_state_old = p_model->get_outer_state();
+  int outer_state_new = static_cast<int>(random() * (num_outer_states - 1));
+  if (outer_state_new >= outer_state_old) {
+    ++outer_state_new;
+  }
+
+  const int n_window = sliding_window.get_n_window();
+  p_model->set_outer_state(outer_state_new);
+  sliding_window.init_stacks(n_window, mc_config.operators);
+  const EXTENDED_SCALAR trace_new = sliding_window.compute_trace(mc_config.operators);
+  const SCALAR prob = convert_to_scalar(static_cast<EXTENDED_SCALAR>(trace_new / mc_config.trace));
+
+  if (prob != 0.0 && random() < std::abs(prob)) {
+    mc_config.trace = trace_new;
+    mc_config.sign *= mysign(prob);
+    mc_config.outer_state = outer_state_new;
+    mc_config.check_nan();
+    outer_state_acc_rate.accepted();
+  } else {
+    p_model->set_outer_state(outer_state_old);
+    sliding_window.init_stacks(n_window, mc_config.operators);
+    outer_state_acc_rate.rejected();
+  }
+}
+
+/**
+ * The ket at the right edge of the window is evolved to the left edge, where the weight of each eigenstate in the trace is measured.
+ * Each measurement is normalized to one.
+ * With a single window, the left edge is always at beta, where only the outer states are seen. Nothing is recorded then.
+ */
+template<typename IMP_MODEL>
+void HybridizationSimulation<IMP_MODEL>::record_state_weights() {
+  namespace bll = boost::lambda;
+  typedef typename SW_TYPE::op_it_t op_it_t;
+  typedef typename SW_TYPE::BRAKET_TYPE BRAKET_TYPE;
+
+  if (sliding_window.get_n_window() < 2) {
+    return;
+  }
+
+  const double tau_low = sliding_window.get_tau_low();
+  const double tau_high = sliding_window.get_tau_high();
+  const std::pair<op_it_t, op_it_t> ops_range = mc_config.operators.range(tau_low <= bll::_1, bll::_1 <= tau_high);
+
+  const int num_brakets = sliding_window.get_num_brakets();
+  std::vector<std::vector<double> > inner(num_brakets), outer(num_brakets);
+  std::vector<int> sector(num_brakets, nirvana);
+  std::vector<EXTENDED_REAL> coeff(num_brakets, 0.0);
+  EXTENDED_REAL max_coeff = 0.0;
+  for (int braket = 0; braket < num_brakets; ++braket) {
+    BRAKET_TYPE ket = sliding_window.get_ket(braket);
+    SW_TYPE::evolve_ket(*p_model, ket, ops_range, tau_low, tau_high);
+    const BRAKET_TYPE &bra = sliding_window.get_bra(braket);
+    if (p_model->state_contributions(bra, ket, inner[braket], outer[braket])) {
+      sector[braket] = ket.sector();
+      coeff[braket] = bra.coeff() * ket.coeff();
+      max_coeff = std::max(max_coeff, coeff[braket]);
+    }
+  }
+  if (max_coeff == 0.0) {
+    return;
+  }
+
+  double sum_inner = 0.0, sum_outer = 0.0;
+  for (int braket = 0; braket < num_brakets; ++braket) {
+    if (sector[braket] == nirvana) {
+      continue;
+    }
+    const double scale = convert_to_double(static_cast<EXTENDED_REAL>(coeff[braket] / max_coeff));
+    for (int i = 0; i < inner[braket].size(); ++i) {
+      inner[braket][i] *= scale;
+      sum_inner += inner[braket][i];
+    }
+    for (int i = 0; i < outer[braket].size(); ++i) {
+      outer[braket][i] *= scale;
+      sum_outer += outer[braket][i];
+    }
+  }
+  for (int braket = 0; braket < num_brakets; ++braket) {
+    if (sector[braket] == nirvana) {
+      continue;
+    }
+    if (sum_inner > 0.0) {
+      for (int i = 0; i < inner[braket].size(); ++i) {
+        inner_state_weights[sector[braket]][i] += inner[braket][i] / sum_inner;
+      }
+    }
+    if (sum_outer > 0.0 && outer_state_weights.size() > 0) {
+      for (int i = 0; i < outer[braket].size(); ++i) {
+        outer_state_weights[braket][i] += outer[braket][i] / sum_outer;
+      }
+    }
+  }
+}
+
+/**
+ * The weights are summed up over all the MPI processes, so that all the processes truncate the model in the same way.
+ * If the trace of the current configuration vanishes after the truncation on any of the processes,
+ * the truncation is reverted on all the processes.
+ */
+template<typename IMP_MODEL>
+void HybridizationSimulation<IMP_MODEL>::truncate_states() {
+  if (truncation_weight_tolerance <= 0.0) {
+    return;
+  }
+
+  std::vector<double> weights_local, weights;
+  for (int sector = 0; sector < inner_state_weights.size(); ++sector) {
+    weights_local.insert(weights_local.end(), inner_state_weights[sector].begin(), inner_state_weights[sector].end());
+  }
+  for (int braket = 0; braket < outer_state_weights.size(); ++braket) {
+    weights_local.insert(weights_local.end(), outer_state_weights[braket].begin(), outer_state_weights[braket].end());
+  }
+  if (weights_local.size() == 0) {
+    return;
+  }
+  my_all_reduce<double>(comm, weights_local, weights, std::plus<double>());
+
+  double sum_inner = 0.0, sum_outer = 0.0;
+  int pos = 0;
+  for (int sector = 0; sector < inner_state_weights.size(); ++sector) {
+    for (int i = 0; i < inner_state_weights[sector].size(); ++i) {
+      inner_state_weights[sector][i] = weights[pos++];
+      sum_inner += inner_state_weights[sector][i];
+    }
+  }
+  for (int braket = 0; braket < outer_state_weights.size(); ++braket) {
+    for (int i = 0; i < outer_state_weights[braket].size(); ++i) {
+      outer_state_weights[braket][i] = weights[pos++];
+      sum_outer += outer_state_weights[braket][i];
+    }
+  }
+  if (sum_inner == 0.0) {
+    if (comm.rank() == 0) {
+      std::cout << "Warning: no weights of states were recorded during thermalization. States are not truncated." << std::endl;
+    }
+    return;
+  }
+  for (int sector = 0; sector < inner_state_weights.size(); ++sector) {
+    for (int i = 0; i < inner_state_weights[sector].size(); ++i) {
+      inner_state_weights[sector][i] /= sum_inner;
+    }
+  }
+  if (sum_outer > 0.0) {
+    for (int braket = 0; braket < outer_state_weights.size(); ++braket) {
+      for (int i = 0; i < outer_state_weights[braket].size(); ++i) {
+        outer_state_weights[braket][i] /= sum_outer;
+      }
+    }
+  }
+
+  if (!p_model->truncate_states(inner_state_weights,
+                                sum_outer > 0.0 ? outer_state_weights : std::vector<std::vector<double> >(),
+                                truncation_weight_tolerance)) {
+    return;
+  }
+
+  //The trace tree and the stacks are rebuilt for the new eigenbasis
+  const int n_window = sliding_window.get_n_window();
+  sliding_window.set_trace_engine(sliding_window.get_trace_engine());
+  sliding_window.init_stacks(n_window, mc_config.operators);
+  const EXTENDED_SCALAR trace_new = sliding_window.compute_trace(mc_config.operators);
+  const SCALAR ratio = convert_to_scalar(static_cast<EXTENDED_SCALAR>(trace_new / mc_config.trace));
+
+  std::vector<int> ok_local(1, ratio != 0.0 ? 1 : 0), ok;
+  my_all_reduce<int>(comm, ok_local, ok, std::plus<int>());
+  if (ok[0] == comm.size()) {
+    p_model->commit_truncation();
+    mc_config.trace = trace_new;
+    mc_config.sign *= mysign(ratio);
+    mc_config.check_nan();
+  } else {
+    p_model->revert_truncation();
+    sliding_window.set_trace_engine(sliding_window.get_trace_engine());
+    sliding_window.init_stacks(n_window, mc_config.operators);
+    if (comm.rank() == 0) {
+      std::cout << "Warning: truncation of high-energy states is reverted because the trace of the current configuration vanishes."
+                << std::endl;
+    }
+  }
+  sanity_check();
+}
+
 template<typename IMP_MODEL>
 void HybridizationSimulation<IMP_MODEL>::transition_between_config_spaces() {
   //Worm insertion/removal
@@ -707,7 +1017,8 @@ void HybridizationSimulation<IMP_MODEL>::update_MC_parameters() {
       std::accumulate(min_pert_order_hist.begin(), min_pert_order_hist.end(), 0.0) / min_pert_order_hist.size();
 
   //new window size for single-pair insertion and removal update
-  N_win_standard = static_cast<std::size_t>(
+  //The tree engine works on the whole interval [0, beta].
+  N_win_standard = sliding_window.get_trace_engine() == TREE_ENGINE ? 1 : static_cast<std::size_t>(
       std::max(
           par["sliding_window.min"].template as<int>(),
           std::min(
@@ -764,6 +1075,8 @@ void HybridizationSimulation<IMP_MODEL>::prepare_for_measurement() {
     it->second->finalize_learning();
   }
 
+  truncate_states();
+
   if (comm.rank() == 0) {
     std::cout << "Thermalization process done after " << sweeps << " steps." << std::endl;
     std::cout << "The number of segments for sliding window update is " << N_win_standard << "."
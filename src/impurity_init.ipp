@@ -19,6 +19,7 @@ void HybridizationSimulation<IMP_MODEL>::create_observables() {
   operator_pair_flavor_updater.create_measurement_acc_rate(measurements);
 
   measurements << alps::accumulators::NoBinningAccumulator<double>("Acceptance_rate_global_shift");
+  measurements << alps::accumulators::NoBinningAccumulator<double>("Acceptance_rate_outer_state");
   measurements << alps::accumulators::NoBinningAccumulator<std::vector<double> >("Acceptance_rate_swap");
 
   measurements << alps::accumulators::NoBinningAccumulator<double>("Z_function_space_volume");
@@ -70,6 +71,14 @@ void HybridizationSimulation<IMP_MODEL>::create_observables() {
 
 #ifdef MEASURE_TIMING
   measurements << alps::accumulators::NoBinningAccumulator<std::vector<double> >("TimingsSecPerNMEAS");
+  measurements << alps::accumulators::NoBinningAccumulator<double>("SlidingWindowStatesReused");
+  measurements << alps::accumulators::NoBinningAccumulator<double>("SlidingWindowStatesEvolved");
+  measurements << alps::accumulators::NoBinningAccumulator<double>("BraketBuffersAllocated");
+  measurements << alps::accumulators::NoBinningAccumulator<double>("BraketBuffersReused");
+  measurements << alps::accumulators::NoBinningAccumulator<double>("LazyTraceEvaluations");
+  measurements << alps::accumulators::NoBinningAccumulator<double>("LazyTraceEarlyRejections");
+  measurements << alps::accumulators::NoBinningAccumulator<double>("ExpVectorCacheHits");
+  measurements << alps::accumulators::NoBinningAccumulator<double>("ExpVectorCacheMisses");
 #endif
 }
 
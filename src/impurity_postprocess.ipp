@@ -17,6 +17,32 @@ void HybridizationSimulation<IMP_MODEL>::show_statistics(const alps::accumulator
   std::cout << " Global updates (global shift etc.): " << timings[1] << std::endl;
   std::cout << " Worm measurement: " << timings[2] << std::endl;
   std::cout << " Non worm measurement: " << timings[3] << std::endl;
+  {
+    const double num_reused = results["SlidingWindowStatesReused"].template mean<double>();
+    const double num_evolved = results["SlidingWindowStatesEvolved"].template mean<double>();
+    std::cout << " Hit rate of cache of sliding-window stacks in changing window size: "
+              << (num_reused + num_evolved > 0 ? num_reused / (num_reused + num_evolved) : 0.0)
+              << " (" << num_reused << " reused, " << num_evolved << " evolved per measurement)" << std::endl;
+  }
+  {
+    const double num_allocated = results["BraketBuffersAllocated"].template mean<double>();
+    const double num_reused = results["BraketBuffersReused"].template mean<double>();
+    std::cout << " Storage of bras/kets: " << num_allocated << " allocations, " << num_reused
+              << " reuses from pools per measurement" << std::endl;
+  }
+  {
+    const double num_eval = results["LazyTraceEvaluations"].template mean<double>();
+    const double num_rejected = results["LazyTraceEarlyRejections"].template mean<double>();
+    std::cout << " Rate of early rejection in lazy trace evaluation (sliding_window.norm_bound = "
+              << par["sliding_window.norm_bound"].template as<std::string>() << "): "
+              << (num_eval > 0 ? num_rejected / num_eval : 0.0) << std::endl;
+  }
+  {
+    const double num_hits = results["ExpVectorCacheHits"].template mean<double>();
+    const double num_misses = results["ExpVectorCacheMisses"].template mean<double>();
+    std::cout << " Hit rate of cache of exp(-tau H0): "
+              << (num_hits + num_misses > 0 ? num_hits / (num_hits + num_misses) : 0.0) << std::endl;
+  }
 #endif
 
   std::cout << std::endl << "==== Thermalization analysis ====" << std::endl;
@@ -19,7 +19,8 @@ int main(int argc, const char *argv[]) {
   //Here we construct a parameter object by parsing an ini file.
   alps::params par(argc, argv);
 
-  par.define<std::string>("algorithm", "complex-matrix", "Name of algorithm (real-matrix, complex-matrix)");
+  par.define<std::string>("algorithm", "auto",
+                          "Name of algorithm (auto, real-matrix, complex-matrix). auto chooses real-matrix if all inputs are real.");
 
   char **argv_tmp = const_cast<char **>(argv);//FIXME: ugly solution
   alps::mpi::environment env(argc, argv_tmp);
@@ -29,18 +30,34 @@ int main(int argc, const char *argv[]) {
 
   //set up solver
   boost::shared_ptr<alps::cthyb::Solver> p_solver;
-  if (par["algorithm"].as<std::string>() == "real-matrix") {
+  std::string algorithm = par["algorithm"].as<std::string>();
+  if (algorithm == "auto") {
+    //The parameters do not depend on the scalar type
+    alps::cthyb::MatrixSolver<std::complex<double> >::define_parameters(par);
+    if (par.help_requested(std::cout)) { exit(0); } //If help message is requested, print it and exit normally.
+
+    std::string reason;
+    algorithm = alps::cthyb::Solver::is_real_problem(par, reason) ? "real-matrix" : "complex-matrix";
+    if (c.rank() == 0) {
+      std::cout << "algorithm=auto: using " << algorithm << " because " << reason << std::endl;
+    }
+    if (algorithm == "real-matrix") {
+      p_solver.reset(new alps::cthyb::MatrixSolver<double>(par));
+    } else {
+      p_solver.reset(new alps::cthyb::MatrixSolver<std::complex<double> >(par));
+    }
+  } else if (algorithm == "real-matrix") {
     alps::cthyb::MatrixSolver<double>::define_parameters(par);
     if (par.help_requested(std::cout)) { exit(0); } //If help message is requested, print it and exit normally.
 
     p_solver.reset(new alps::cthyb::MatrixSolver<double>(par));
-  } else if (par["algorithm"].as<std::string>() == "complex-matrix") {
+  } else if (algorithm == "complex-matrix") {
     alps::cthyb::MatrixSolver<std::complex<double> >::define_parameters(par);
     if (par.help_requested(std::cout)) { exit(0); } //If help message is requested, print it and exit normally.
 
     p_solver.reset(new alps::cthyb::MatrixSolver<std::complex<double> >(par));
   } else {
-    throw std::runtime_error("Unknown algorithm: " + par["algorithm"].as<std::string>());
+    throw std::runtime_error("Unknown algorithm: " + algorithm);
   }
 
   //solve the model
@@ -10,6 +10,11 @@
 #include "./sliding_window/sliding_window.hpp"
 #include "worm.hpp"
 
+enum HYBRIDIZATION_INTERPOLATION {
+  LINEAR_INTERPOLATION = 0, //piecewise linear interpolation between the points of the mesh
+  CUBIC_SPLINE_INTERPOLATION = 1, //cubic spline (a much coarser mesh gives the same accuracy)
+};
+
 template<typename SCALAR>
 class HybridizationFunction {
  private:
@@ -21,7 +26,8 @@ class HybridizationFunction {
       F_(F),
       n_tau_(n_tau),
       n_flavors_(n_flavors),
-      connected_(boost::extents[n_flavors_][n_flavors_]) {
+      connected_(boost::extents[n_flavors_][n_flavors_]),
+      interpolation_(LINEAR_INTERPOLATION) {
     assert(F_[0][0].size() == n_tau + 1);
     for (int flavor = 0; flavor < n_flavors; ++flavor) {
       for (int flavor2 = 0; flavor2 < n_flavors; ++flavor2) {
@@ -33,22 +39,53 @@ class HybridizationFunction {
         }
       }
     }
+    build_table();
   }
 
   int num_flavors() const { return n_flavors_; }
 
+  HYBRIDIZATION_INTERPOLATION interpolation() const { return interpolation_; }
+
+  void set_interpolation(HYBRIDIZATION_INTERPOLATION interpolation) {
+    if (interpolation == CUBIC_SPLINE_INTERPOLATION && n_tau_ < 3) {
+      throw std::runtime_error("Cubic spline interpolation of the hybridization function requires n_tau_hyb >= 3.");
+    }
+    interpolation_ = interpolation;
+    build_table();
+  }
+
   SCALAR operator()(const psi &c_op, const psi &cdagger_op) const {
-    double sign = 1;
-    double t = c_op.time() - cdagger_op.time();
-    if (t < 0) {
-      t += BETA_;
-      sign = -1;
+    return interpolate(&table_[(c_op.flavor() * n_flavors_ + cdagger_op.flavor()) * pair_stride_],
+                       c_op.time() - cdagger_op.time());
+  }
+
+  /**
+   * Batched evaluation: out(i) = F(c_op, cdagger_ops[i]) for i = 0, ..., out.size()-1
+   */
+  template<typename Derived>
+  void evaluate_row(const psi &c_op, const psi *cdagger_ops, const Eigen::MatrixBase<Derived> &out) const {
+    Eigen::MatrixBase<Derived> &out_ = const_cast<Eigen::MatrixBase<Derived> &>(out);
+    const int n = out_.size();
+    const double t_c = c_op.time().time();
+    const SCALAR *p_row = &table_[c_op.flavor() * n_flavors_ * pair_stride_];
+    for (int i = 0; i < n; ++i) {
+      out_(i) = interpolate(p_row + cdagger_ops[i].flavor() * pair_stride_, t_c - cdagger_ops[i].time().time());
     }
+  }
 
-    double n = t / BETA_ * n_tau_;
-    int n_lower = (int) n;
-    const SCALAR *pF = &F_[c_op.flavor()][cdagger_op.flavor()][0];
-    return sign * (pF[n_lower] + (n - n_lower) * (pF[n_lower + 1] - pF[n_lower]));
+  /**
+   * Batched evaluation: out(i) = F(c_ops[i], cdagger_op) for i = 0, ..., out.size()-1
+   */
+  template<typename Derived>
+  void evaluate_col(const psi *c_ops, const psi &cdagger_op, const Eigen::MatrixBase<Derived> &out) const {
+    Eigen::MatrixBase<Derived> &out_ = const_cast<Eigen::MatrixBase<Derived> &>(out);
+    const int n = out_.size();
+    const double t_cdagg = cdagger_op.time().time();
+    const SCALAR *p_col = &table_[cdagger_op.flavor() * pair_stride_];
+    const int row_stride = n_flavors_ * pair_stride_;
+    for (int i = 0; i < n; ++i) {
+      out_(i) = interpolate(p_col + c_ops[i].flavor() * row_stride, c_ops[i].time().time() - t_cdagg);
+    }
   }
 
   bool is_connected(int flavor1, int flavor2) const {
@@ -56,12 +93,123 @@ class HybridizationFunction {
   }
 
  private:
+  /**
+   * The coefficients of the polynomial on each interval [itau, itau+1] are stored next to each other
+   * so that an evaluation touches a single cache line:
+   *   linear: (F(itau), F(itau+1)-F(itau)),
+   *   cubic spline: (c0, c1, c2, c3) with F = c0 + c1 x + c2 x^2 + c3 x^3 (0 <= x < 1).
+   * The table is indexed as [flavor][flavor2][itau][coefficient].
+   */
+  void build_table() {
+    stride_ = interpolation_ == LINEAR_INTERPOLATION ? 2 : 4;
+    pair_stride_ = n_tau_ * stride_;
+    inv_dtau_ = n_tau_ / BETA_;
+    table_.resize(n_flavors_ * n_flavors_ * pair_stride_);
+
+    std::vector<SCALAR> M(n_tau_ + 1);
+    for (int flavor = 0; flavor < n_flavors_; ++flavor) {
+      for (int flavor2 = 0; flavor2 < n_flavors_; ++flavor2) {
+        const SCALAR *y = &F_[flavor][flavor2][0];
+        SCALAR *p = &table_[(flavor * n_flavors_ + flavor2) * pair_stride_];
+        if (interpolation_ == LINEAR_INTERPOLATION) {
+          for (int itau = 0; itau < n_tau_; ++itau) {
+            p[2 * itau] = y[itau];
+            p[2 * itau + 1] = y[itau + 1] - y[itau];
+          }
+        } else {
+          compute_spline_second_derivatives(y, M);
+          for (int itau = 0; itau < n_tau_; ++itau) {
+            p[4 * itau] = y[itau];
+            p[4 * itau + 1] = (y[itau + 1] - y[itau]) - (2.0 * M[itau] + M[itau + 1]) / 6.0;
+            p[4 * itau + 2] = 0.5 * M[itau];
+            p[4 * itau + 3] = (M[itau + 1] - M[itau]) / 6.0;
+          }
+        }
+      }
+    }
+  }
+
+  /**
+   * Second derivatives (in units of the mesh) of the cubic spline through y[0], ..., y[n_tau] with the not-a-knot
+   * end conditions: the third derivative is continuous at y[1] and y[n_tau-1], i.e., M[0] = 2M[1] - M[2] and
+   * M[n_tau] = 2M[n_tau-1] - M[n_tau-2].
+   * All interior second derivatives M[1], ..., M[n_tau-1] are solved from the tridiagonal system
+   * M[i-1] + 4M[i] + M[i+1] = 6(y[i-1] - 2y[i] + y[i+1]), into which the end conditions are substituted
+   * (Thomas algorithm). The spline is twice continuously differentiable and the error is O(dtau^4) up to both ends.
+   */
+  void compute_spline_second_derivatives(const SCALAR *y, std::vector<SCALAR> &M) const {
+    const int n = n_tau_;
+    if (n < 3) {
+      //a single parabola (or straight line) through all the points
+      const SCALAR m = n == 2 ? y[0] - 2.0 * y[1] + y[2] : SCALAR(0.0);
+      std::fill(M.begin(), M.begin() + n + 1, m);
+      return;
+    }
+
+    //forward elimination: row i reads sub * M[i-1] + diag * M[i] + super * M[i+1] = rhs
+    std::vector<double> c_prime(n, 0.0);
+    M[0] = 0.0;
+    for (int i = 1; i < n; ++i) {
+      const bool end_row = i == 1 || i == n - 1;
+      const double sub = end_row ? 0.0 : 1.0;
+      const double diag = end_row ? 6.0 : 4.0;
+      const double super = end_row ? 0.0 : 1.0;
+      const SCALAR rhs = 6.0 * (y[i - 1] - 2.0 * y[i] + y[i + 1]);
+      const double denom = diag - sub * c_prime[i - 1];
+      c_prime[i] = super / denom;
+      M[i] = (rhs - sub * M[i - 1]) / denom;
+    }
+    //back substitution
+    for (int i = n - 2; i >= 1; --i) {
+      M[i] -= c_prime[i] * M[i + 1];
+    }
+    M[0] = 2.0 * M[1] - M[2];
+    M[n] = 2.0 * M[n - 1] - M[n - 2];
+  }
+
+  inline SCALAR interpolate(const SCALAR *p, double t) const {
+    double sign = 1;
+    if (t < 0) {
+      t += BETA_;
+      sign = -1;
+    }
+
+    const double x = t * inv_dtau_;
+    const int itau = std::min(static_cast<int>(x), n_tau_ - 1);
+    const double dx = x - itau;
+    const SCALAR *c = p + itau * stride_;
+    if (interpolation_ == LINEAR_INTERPOLATION) {
+      return sign * (c[0] + dx * c[1]);
+    } else {
+      return sign * (c[0] + dx * (c[1] + dx * (c[2] + dx * c[3])));
+    }
+  }
+
   double BETA_;
   int n_tau_, n_flavors_;
   container_t F_;
   boost::multi_array<bool, 2> connected_;
+
+  HYBRIDIZATION_INTERPOLATION interpolation_;
+  int stride_, pair_stride_;
+  double inv_dtau_;
+  std::vector<SCALAR> table_;
 };
 
+/**
+ * Batched evaluation of rows and columns of the G matrix in DeterminantMatrix
+ */
+template<typename SCALAR, typename Derived>
+void evaluate_gf_row(const HybridizationFunction<SCALAR> &gf, const psi &c_op, const psi *cdagger_ops,
+                     const Eigen::MatrixBase<Derived> &out) {
+  gf.evaluate_row(c_op, cdagger_ops, out);
+}
+
+template<typename SCALAR, typename Derived>
+void evaluate_gf_col(const HybridizationFunction<SCALAR> &gf, const psi *c_ops, const psi &cdagger_op,
+                     const Eigen::MatrixBase<Derived> &out) {
+  gf.evaluate_col(c_ops, cdagger_op, out);
+}
 
 template<typename SCALAR>
 struct MonteCarloConfiguration {
@@ -75,7 +223,8 @@ struct MonteCarloConfiguration {
       trace(std::numeric_limits<double>::max()),
       M(F),
       operators(),
-      perm_sign(1) {
+      perm_sign(1),
+      outer_state(-1) {
   }
 
   ConfigSpace current_config_space() const {
@@ -111,6 +260,7 @@ struct MonteCarloConfiguration {
   operator_container_t operators; //all c and c^dagger operators hybridized with bath and those from the worm
   boost::shared_ptr<Worm> p_worm;
   int perm_sign;
+  int outer_state;  // outer state sampled by Monte Carlo (-1 if all outer states are summed up in the trace)
 };
 
 template<typename SCALAR>
@@ -132,6 +282,7 @@ void MonteCarloConfiguration<SCALAR>::sanity_check(SW &sliding_window) {
     throw std::runtime_error("operators is wrong!");
   }
   assert(operators2 == operators);
+  assert(outer_state == -1 || outer_state == sliding_window.get_p_model()->get_outer_state());
 
   //check determinant
   std::vector<SCALAR> det_old = M.compute_determinant_as_product();
@@ -1,8 +1,7 @@
 template<typename SCALAR>
 ImpurityModelEigenBasis<SCALAR>::ImpurityModelEigenBasis(const alps::params &par, bool verbose)
-    : ImpurityModel<SCALAR, ImpurityModelEigenBasis<SCALAR> >(par, verbose) {
-  build_basis(par);
-  build_outer_braket(par);
+    : ImpurityModel<SCALAR, ImpurityModelEigenBasis<SCALAR> >(par, verbose), loaded_from_cache_(false) {
+  init(par);
 }
 
 template<typename SCALAR>
@@ -16,14 +15,57 @@ ImpurityModelEigenBasis<SCALAR>::ImpurityModelEigenBasis(const alps::params &par
                                                                                         int,
                                                                                         SCALAR> > &nonzero_U_vals_list,
                                                          bool verbose)
-    : ImpurityModel<SCALAR, ImpurityModelEigenBasis<SCALAR> >(par, nonzero_t_vals_list, nonzero_U_vals_list, verbose) {
-  build_basis(par);
-  build_outer_braket(par);
+    : ImpurityModel<SCALAR, ImpurityModelEigenBasis<SCALAR> >(par, nonzero_t_vals_list, nonzero_U_vals_list, verbose),
+      loaded_from_cache_(false) {
+  init(par);
 }
 
 template<typename SCALAR>
 void ImpurityModelEigenBasis<SCALAR>::define_parameters(alps::params &parameters) {
   Base::define_parameters(parameters);
+  parameters
+      .define<std::string>("model.cache_file", "",
+                           "HDF5 file caching the eigenbasis (eigenvalues and operators) between runs with the same local Hamiltonian and cutoff energies (disabled if empty)")
+      .define<double>("model.truncation_weight_tolerance", 0.0,
+                      "Throw away high-energy inner/outer states whose total weight in the trace measured during thermalization does not exceed this value (disabled if zero)");
+}
+
+//Build the eigenbasis or load it from the model cache
+template<typename SCALAR>
+void ImpurityModelEigenBasis<SCALAR>::init(const alps::params &par) {
+  const std::string cache_file = par["model.cache_file"].template as<std::string>();
+  const std::string key = Base::input_hash(par);
+  loaded_from_cache_ = cache_file != "" && load_cache(cache_file, key);
+  bool saved_to_cache = false;
+  if (!loaded_from_cache_) {
+    build_basis(par);
+    if (cache_file != "") {
+      saved_to_cache = save_cache(cache_file, key);
+    }
+  }
+  if (Base::verbose_ && (loaded_from_cache_ || saved_to_cache)) {
+    std::cout << (loaded_from_cache_ ? "Eigenbasis loaded from " : "Eigenbasis saved into ") << cache_file
+              << " (key " << key << ")" << std::endl;
+  }
+  build_small_sector_table();
+  build_outer_braket(par);
+}
+
+//Dispatch table of fixed-size kernels for small sectors (dimensions after throwing away high-energy states)
+template<typename SCALAR>
+void ImpurityModelEigenBasis<SCALAR>::build_small_sector_table() {
+  SmallSectorKernels<SCALAR>::init();
+  small_dim_index_.resize(Base::num_sectors());
+  int num_small_sectors = 0;
+  for (int sector = 0; sector < Base::num_sectors(); ++sector) {
+    small_dim_index_[sector] = is_sector_active(sector) ? SmallSectorKernels<SCALAR>::dim_index(dim_sector(sector)) : -1;
+    if (small_dim_index_[sector] >= 0) {
+      ++num_small_sectors;
+    }
+  }
+  if (Base::verbose_) {
+    std::cout << "# of sectors with fixed-size kernels " << num_small_sectors << std::endl;
+  }
 }
 
 template<typename SCALAR, typename OP>
@@ -36,6 +78,59 @@ void construct_operator_object(const Eigen::Matrix<SCALAR, Eigen::Dynamic, Eigen
   }
 };
 
+template<typename SCALAR>
+void construct_operator_object(const Eigen::Matrix<SCALAR, Eigen::Dynamic, Eigen::Dynamic> &mat,
+                               OperatorMatrix<SCALAR> &op_obj) {
+  op_obj.set(mat);
+};
+
+/**
+ * Memory and timings of applying operators stored in the format chosen by OperatorMatrix, compared with the dense format.
+ * Only used for the verbose output.
+ */
+struct OperatorFormatReport {
+  OperatorFormatReport() : memory_dense(0), memory(0), time_dense(0.0), time(0.0) {
+    std::fill(num_ops, num_ops + 3, 0);
+  }
+
+  template<typename SCALAR>
+  void add(const Eigen::Matrix<SCALAR, Eigen::Dynamic, Eigen::Dynamic> &mat, const OperatorMatrix<SCALAR> &op) {
+    typedef Eigen::Matrix<SCALAR, Eigen::Dynamic, Eigen::Dynamic> matrix_t;
+    ++num_ops[op.format()];
+    memory_dense += mat.size() * sizeof(SCALAR);
+    memory += op.memory_bytes();
+
+    //a ket with as many columns as the source sector
+    const int num_repeat = 10;
+    const matrix_t x = matrix_t::Random(mat.cols(), mat.cols());
+    matrix_t y(mat.rows(), mat.cols());
+    std::clock_t start = std::clock();
+    for (int i = 0; i < num_repeat; ++i) {
+      y.noalias() = mat * x;
+    }
+    time_dense += static_cast<double>(std::clock() - start) / CLOCKS_PER_SEC;
+    start = std::clock();
+    for (int i = 0; i < num_repeat; ++i) {
+      op.apply_ket(x, y);
+    }
+    time += static_cast<double>(std::clock() - start) / CLOCKS_PER_SEC;
+  }
+
+  void print(const std::string &name) const {
+    std::cout << " " << name << " : dense " << num_ops[DENSE_FORMAT]
+              << ", CSR " << num_ops[CSR_FORMAT]
+              << ", block " << num_ops[BLOCK_FORMAT] << std::endl;
+    std::cout << "   memory " << memory << " bytes (dense " << memory_dense << " bytes, saved "
+              << memory_dense - static_cast<long>(memory) << " bytes)" << std::endl;
+    std::cout << "   speedup over dense format " << (time > 0.0 ? time_dense / time : 1.0) << std::endl;
+  }
+
+  int num_ops[3];
+  long memory_dense;
+  std::size_t memory;
+  double time_dense, time;
+};
+
 inline void print_sectors(const std::vector<std::vector<double> > &evals_sectors) {
   const int num_sectors = evals_sectors.size();
   for (int sector = 0; sector < num_sectors; ++sector) {
@@ -122,6 +217,23 @@ bool ImpurityModelEigenBasis<SCALAR>::is_sector_active(int sector) const {
   }
 }
 
+//Operators acting on a state lead to nirvana instead of sectors without states
+template<typename SCALAR>
+void ImpurityModelEigenBasis<SCALAR>::disconnect_inactive_sectors() {
+  for (int op = 0; op < 2; ++op) {
+    for (int flavor = 0; flavor < Base::num_flavors(); ++flavor) {
+      for (int src_sector = 0; src_sector < Base::num_sectors(); ++src_sector) {
+        if (!is_sector_active(Base::sector_connection[op][flavor][src_sector])) {
+          Base::sector_connection[op][flavor][src_sector] = nirvana;
+        }
+        if (!is_sector_active(Base::sector_connection_reverse[op][flavor][src_sector])) {
+          Base::sector_connection_reverse[op][flavor][src_sector] = nirvana;
+        }
+      }
+    }
+  }
+}
+
 template<typename SCALAR>
 void ImpurityModelEigenBasis<SCALAR>::build_basis(const alps::params &par) {
   //build eigenbasis
@@ -133,23 +245,39 @@ void ImpurityModelEigenBasis<SCALAR>::build_basis(const alps::params &par) {
   std::vector<dense_matrix_t> ham_sector;
 #endif
 
-  //Compute eigenvectors and eigenvalues
+  const int num_threads = num_model_setup_threads(par["model.n_threads"].template as<int>());
+  boost::timer::cpu_timer timer;
+
+  //Compute eigenvectors and eigenvalues.
+  //Sectors are processed in parallel starting from the largest one for load balancing.
+  //Each sector is diagonalized independently, so the results do not depend on the number of threads.
   min_eigenval_sector.resize(num_sectors);
   eigenvals_sector.resize(num_sectors);
   std::vector<dense_matrix_t> evecs_sector(num_sectors);
+#ifndef NDEBUG
+  ham_sector.resize(num_sectors);
+#endif
+  std::vector<std::pair<int, int> > sector_tasks;//(-dim, sector)
   for (int sector = 0; sector < num_sectors; ++sector) {
+    sector_tasks.push_back(std::make_pair(-static_cast<int>(sector_members[sector].size()), sector));
+  }
+  std::sort(sector_tasks.begin(), sector_tasks.end());
+#pragma omp parallel for num_threads(num_threads) schedule(dynamic) if(num_threads > 1)
+  for (int task = 0; task < num_sectors; ++task) {
+    const int sector = sector_tasks[task].second;
     const int dim_sector = sector_members[sector].size();
     dense_matrix_t ham_tmp(Base::ham_sectors[sector]);
 #ifndef NDEBUG
-    ham_sector.push_back(ham_tmp);
+    ham_sector[sector] = ham_tmp;
 #endif
     SOLVER_TYPE esolv(ham_tmp);
     eigenvals_sector[sector].resize(dim_sector);
     for (int ie = 0; ie < dim_sector; ++ie) {
       eigenvals_sector[sector][ie] = esolv.eigenvalues()[ie];
-      evecs_sector[sector] = esolv.eigenvectors();
     }
+    evecs_sector[sector] = esolv.eigenvectors();
   }
+  const double time_diag = timer.elapsed().wall * 1E-9;
 
   //Compute the lowest eigenenergy
   double eigenvalue_max, eigenvalue_min;
@@ -179,18 +307,7 @@ void ImpurityModelEigenBasis<SCALAR>::build_basis(const alps::params &par) {
 #endif
 
   //modify sector_connection
-  for (int op = 0; op < 2; ++op) {
-    for (int flavor = 0; flavor < flavors; ++flavor) {
-      for (int src_sector = 0; src_sector < num_sectors; ++src_sector) {
-        if (!is_sector_active(Base::sector_connection[op][flavor][src_sector])) {
-          Base::sector_connection[op][flavor][src_sector] = nirvana;
-        }
-        if (!is_sector_active(Base::sector_connection_reverse[op][flavor][src_sector])) {
-          Base::sector_connection_reverse[op][flavor][src_sector] = nirvana;
-        }
-      }
-    }
-  }
+  disconnect_inactive_sectors();
 
   //overflow prevention
   double overflow_prevention;
@@ -212,33 +329,200 @@ void ImpurityModelEigenBasis<SCALAR>::build_basis(const alps::params &par) {
     min_eigenval_sector[sector] -= Base::reference_energy_;
   }
 
-  //transform d, d^dagger to eigenbasis
+  //transform d, d^dagger to eigenbasis (in parallel, the most expensive pairs of sectors first)
+  timer.start();
   ddag_ops_eigen.resize(flavors);
   d_ops_eigen.resize(flavors);
   for (int flavor = 0; flavor < flavors; ++flavor) {
     ddag_ops_eigen[flavor].resize(num_sectors);
     d_ops_eigen[flavor].resize(num_sectors);
-    for (int src_sector = 0; src_sector < num_sectors; ++src_sector) {
-      int dst_sector = Base::get_dst_sector_ket(CREATION_OP, flavor, src_sector);
-      if (!is_sector_active(dst_sector) || !is_sector_active(src_sector)) {
-        ddag_ops_eigen[flavor][src_sector].resize(0, 0);
-      } else {
-        dense_matrix_t tmp_mat = evecs_sector[dst_sector].adjoint() * Base::creation_operators_hyb(flavor, src_sector)
-            * evecs_sector[src_sector];
-        construct_operator_object(tmp_mat, ddag_ops_eigen[flavor][src_sector]);
+  }
+  std::vector<std::pair<long, int> > op_tasks;//(-cost, index of (op, flavor, src_sector))
+  for (int op = 0; op < 2; ++op) {
+    for (int flavor = 0; flavor < flavors; ++flavor) {
+      for (int src_sector = 0; src_sector < num_sectors; ++src_sector) {
+        const int dst_sector = Base::get_dst_sector_ket(static_cast<OPERATOR_TYPE>(op), flavor, src_sector);
+        const long cost = is_sector_active(dst_sector) && is_sector_active(src_sector) ?
+                          static_cast<long>(dim_sector(dst_sector)) * dim_sector(src_sector)
+                              * (dim_sector(dst_sector) + dim_sector(src_sector)) : 0;
+        op_tasks.push_back(std::make_pair(-cost, (op * flavors + flavor) * num_sectors + src_sector));
+      }
+    }
+  }
+  std::sort(op_tasks.begin(), op_tasks.end());
+  //operators in the dense format are kept only for the verbose output
+  const int num_op_tasks = op_tasks.size();
+  std::vector<dense_matrix_t> ops_dense(Base::verbose_ ? num_op_tasks : 0);
+#pragma omp parallel for num_threads(num_threads) schedule(dynamic) if(num_threads > 1)
+  for (int task = 0; task < num_op_tasks; ++task) {
+    const int op = op_tasks[task].second / (flavors * num_sectors);
+    const int flavor = (op_tasks[task].second / num_sectors) % flavors;
+    const int src_sector = op_tasks[task].second % num_sectors;
+    const OPERATOR_TYPE op_type = static_cast<OPERATOR_TYPE>(op);
+    OperatorMatrix<SCALAR> &op_eigen =
+        op_type == CREATION_OP ? ddag_ops_eigen[flavor][src_sector] : d_ops_eigen[flavor][src_sector];
+    const int dst_sector = Base::get_dst_sector_ket(op_type, flavor, src_sector);
+    if (!is_sector_active(dst_sector) || !is_sector_active(src_sector)) {
+      op_eigen.set(dense_matrix_t());
+    } else {
+      dense_matrix_t tmp_mat = evecs_sector[dst_sector].adjoint() *
+          (op_type == CREATION_OP ? Base::creation_operators_hyb(flavor, src_sector)
+                                  : Base::annihilation_operators_hyb(flavor, src_sector))
+          * evecs_sector[src_sector];
+      construct_operator_object(tmp_mat, op_eigen);
+      if (Base::verbose_) {
+        ops_dense[task].swap(tmp_mat);
       }
+    }
+  }
+  const double time_transform = timer.elapsed().wall * 1E-9;
 
-      dst_sector = Base::get_dst_sector_ket(ANNIHILATION_OP, flavor, src_sector);
-      if (!is_sector_active(dst_sector) || !is_sector_active(src_sector)) {
-        d_ops_eigen[flavor][src_sector].resize(0, 0);
-      } else {
-        dense_matrix_t tmp_mat =
-            evecs_sector[dst_sector].adjoint() * Base::annihilation_operators_hyb(flavor, src_sector)
-                * evecs_sector[src_sector];
-        construct_operator_object(tmp_mat, d_ops_eigen[flavor][src_sector]);
+  if (Base::verbose_) {
+    std::cout << "Setup time with " << num_threads << " threads: diagonalization " << time_diag
+              << " sec, transformation of operators " << time_transform << " sec" << std::endl;
+  }
+
+  OperatorFormatReport report_ddag, report_d;
+  for (int task = 0; task < ops_dense.size(); ++task) {
+    if (ops_dense[task].size() == 0) {
+      continue;
+    }
+    const int op = op_tasks[task].second / (flavors * num_sectors);
+    const int flavor = (op_tasks[task].second / num_sectors) % flavors;
+    const int src_sector = op_tasks[task].second % num_sectors;
+    if (static_cast<OPERATOR_TYPE>(op) == CREATION_OP) {
+      report_ddag.add(ops_dense[task], ddag_ops_eigen[flavor][src_sector]);
+    } else {
+      report_d.add(ops_dense[task], d_ops_eigen[flavor][src_sector]);
+    }
+  }
+  if (Base::verbose_) {
+    std::cout << "Storage of operators in the eigenbasis" << std::endl;
+    report_ddag.print("Creation operators");
+    report_d.print("Annihilation operators");
+  }
+}
+
+/**
+ * The cache file is written into a temporary file first and then renamed,
+ * so that processes building the same model at the same time do not corrupt it.
+ * Operators are stored as lists of their elements and read one by one when loading.
+ * Return false if the file could not be written.
+ */
+template<typename SCALAR>
+bool ImpurityModelEigenBasis<SCALAR>::save_cache(const std::string &file, const std::string &key) const {
+  const int num_sectors = Base::num_sectors();
+  const int flavors = Base::num_flavors();
+  const std::string tmp_file = file + ".tmp" + boost::lexical_cast<std::string>(getpid());
+  try {
+    {
+      alps::hdf5::archive ar(tmp_file, "w");
+      ar["/key"] << key;
+      ar["/num_sectors"] << num_sectors;
+      ar["/reference_energy"] << Base::reference_energy_;
+      ar["/min_eigenval_sector"] << min_eigenval_sector;
+      for (int sector = 0; sector < num_sectors; ++sector) {
+        ar["/eigenvals/" + boost::lexical_cast<std::string>(sector)] << eigenvals_sector[sector];
+      }
+      ar["/sector_connection"] << std::vector<int>(Base::sector_connection.origin(),
+                                                   Base::sector_connection.origin() + Base::sector_connection.num_elements());
+      ar["/sector_connection_reverse"] << std::vector<int>(Base::sector_connection_reverse.origin(),
+                                                           Base::sector_connection_reverse.origin()
+                                                               + Base::sector_connection_reverse.num_elements());
+
+      std::vector<int> row_index, col_index;
+      std::vector<SCALAR> values;
+      for (int op = 0; op < 2; ++op) {
+        for (int flavor = 0; flavor < flavors; ++flavor) {
+          for (int sector = 0; sector < num_sectors; ++sector) {
+            const OperatorMatrix<SCALAR> &op_eigen = op == 0 ? ddag_ops_eigen[flavor][sector] : d_ops_eigen[flavor][sector];
+            const std::string path = (boost::format("/operators/%1%/%2%/%3%") % op % flavor % sector).str();
+            op_eigen.get_elements(row_index, col_index, values);
+            ar[path + "/rows"] << op_eigen.rows();
+            ar[path + "/cols"] << op_eigen.cols();
+            ar[path + "/format"] << static_cast<int>(op_eigen.format());
+            ar[path + "/row_index"] << row_index;
+            ar[path + "/col_index"] << col_index;
+            ar[path + "/values"] << values;
+          }
+        }
+      }
+    }
+    if (std::rename(tmp_file.c_str(), file.c_str()) != 0) {
+      throw std::runtime_error("Failed to rename " + tmp_file + " to " + file);
+    }
+  } catch (const std::exception &e) {
+    std::remove(tmp_file.c_str());
+    if (Base::verbose_) {
+      std::cout << "Warning: failed to write the model cache " << file << ": " << e.what() << std::endl;
+    }
+    return false;
+  }
+  return true;
+}
+
+//Return false if the file does not exist or was created for a different model
+template<typename SCALAR>
+bool ImpurityModelEigenBasis<SCALAR>::load_cache(const std::string &file, const std::string &key) {
+  if (!std::ifstream(file.c_str()).good()) {
+    return false;
+  }
+  const int num_sectors = Base::num_sectors();
+  const int flavors = Base::num_flavors();
+  try {
+    alps::hdf5::archive ar(file, "r");
+    std::string key_file;
+    int num_sectors_file;
+    ar["/key"] >> key_file;
+    ar["/num_sectors"] >> num_sectors_file;
+    if (key_file != key || num_sectors_file != num_sectors) {
+      return false;
+    }
+
+    ar["/reference_energy"] >> Base::reference_energy_;
+    ar["/min_eigenval_sector"] >> min_eigenval_sector;
+    eigenvals_sector.resize(num_sectors);
+    for (int sector = 0; sector < num_sectors; ++sector) {
+      ar["/eigenvals/" + boost::lexical_cast<std::string>(sector)] >> eigenvals_sector[sector];
+    }
+    std::vector<int> connection, connection_reverse;
+    ar["/sector_connection"] >> connection;
+    ar["/sector_connection_reverse"] >> connection_reverse;
+    if (connection.size() != Base::sector_connection.num_elements()
+        || connection_reverse.size() != Base::sector_connection_reverse.num_elements()) {
+      throw std::runtime_error("Inconsistent size of sector_connection");
+    }
+    std::copy(connection.begin(), connection.end(), Base::sector_connection.origin());
+    std::copy(connection_reverse.begin(), connection_reverse.end(), Base::sector_connection_reverse.origin());
+
+    ddag_ops_eigen.resize(flavors);
+    d_ops_eigen.resize(flavors);
+    std::vector<int> row_index, col_index;
+    std::vector<SCALAR> values;
+    for (int op = 0; op < 2; ++op) {
+      for (int flavor = 0; flavor < flavors; ++flavor) {
+        std::vector<OperatorMatrix<SCALAR> > &ops = op == 0 ? ddag_ops_eigen[flavor] : d_ops_eigen[flavor];
+        ops.resize(num_sectors);
+        for (int sector = 0; sector < num_sectors; ++sector) {
+          const std::string path = (boost::format("/operators/%1%/%2%/%3%") % op % flavor % sector).str();
+          int rows, cols, format;
+          ar[path + "/rows"] >> rows;
+          ar[path + "/cols"] >> cols;
+          ar[path + "/format"] >> format;
+          ar[path + "/row_index"] >> row_index;
+          ar[path + "/col_index"] >> col_index;
+          ar[path + "/values"] >> values;
+          ops[sector].set_elements(rows, cols, row_index, col_index, values, static_cast<OPERATOR_MATRIX_FORMAT>(format));
+        }
       }
     }
+  } catch (const std::exception &e) {
+    if (Base::verbose_) {
+      std::cout << "Warning: failed to read the model cache " << file << ": " << e.what() << std::endl;
+    }
+    return false;
   }
+  return true;
 }
 
 template<typename SCALAR>
@@ -249,6 +533,9 @@ void ImpurityModelEigenBasis<SCALAR>::build_outer_braket(const alps::params &par
   int active_sector = 0;
   bra_list.resize(0);
   ket_list.resize(0);
+  outer_states_.resize(0);
+  outer_state_sampling_ = par["model.outer_state_sampling"].template as<int>() != 0;
+  outer_state_ = -1;
   for (int sector = 0; sector < Base::num_sectors(); ++sector) {
     if (!is_sector_active(sector)) {
       continue;
@@ -261,6 +548,15 @@ void ImpurityModelEigenBasis<SCALAR>::build_outer_braket(const alps::params &par
       continue;
     }
 
+    for (int outer = 0; outer < dim; ++outer) {
+      if (eigenvals_sector[sector][outer] <= cutoff_outer) {
+        outer_states_.push_back(std::make_pair(sector, outer));
+      }
+    }
+    if (outer_state_sampling_) {
+      continue;
+    }
+
     braket_obj_t obj;
     obj.resize(dim, dim_outer);
     obj.setZero();
@@ -285,6 +581,255 @@ void ImpurityModelEigenBasis<SCALAR>::build_outer_braket(const alps::params &par
   num_braket_ = active_sector;
   //assert(num_braket_==std::count_if(eigenvals_sector.begin(),eigenvals_sector.end(),bll::_1.size()!=0));
   //std::cout << "num of active sector " << active_sector << std::endl;
+
+  if (outer_state_sampling_) {
+    //start from the lowest-energy outer state
+    int outer_state_min = 0;
+    for (int outer_state = 0; outer_state < outer_states_.size(); ++outer_state) {
+      if (eigenvals_sector[outer_states_[outer_state].first][outer_states_[outer_state].second] <
+          eigenvals_sector[outer_states_[outer_state_min].first][outer_states_[outer_state_min].second]) {
+        outer_state_min = outer_state;
+      }
+    }
+    set_outer_state(outer_state_min);
+    num_braket_ = 1;
+    if (Base::verbose_) {
+      std::cout << "Number of outer states sampled " << outer_states_.size() << std::endl;
+    }
+  }
+}
+
+template<typename SCALAR>
+void ImpurityModelEigenBasis<SCALAR>::set_outer_state(int outer_state) {
+  assert(outer_state_sampling_);
+  assert(outer_state >= 0 && outer_state < outer_states_.size());
+
+  const int sector = outer_states_[outer_state].first;
+  braket_obj_t obj(dim_sector(sector), 1);
+  obj.setZero();
+  obj(outer_states_[outer_state].second, 0) = 1.0;
+
+  bra_list.resize(1);
+  ket_list.resize(1);
+  bra_list[0] = BRAKET_T(sector, obj.transpose());
+  ket_list[0] = BRAKET_T(sector, obj);
+  outer_state_ = outer_state;
+}
+
+template<typename SCALAR>
+bool ImpurityModelEigenBasis<SCALAR>::state_contributions(const BRAKET_T &bra, const BRAKET_T &ket,
+                                                          std::vector<double> &inner, std::vector<double> &outer) const {
+  if (bra.invalid() || ket.invalid() || bra.sector() != ket.sector()) {
+    return false;
+  }
+  assert(size2(bra.obj()) == size1(ket.obj()));
+  assert(size1(bra.obj()) == size2(ket.obj()));
+  //(j, i) element is bra(i, j) * ket(j, i)
+  const Eigen::Array<SCALAR, Eigen::Dynamic, Eigen::Dynamic> prod = bra.obj().transpose().array() * ket.obj().array();
+  inner.resize(prod.rows());
+  for (int j = 0; j < prod.rows(); ++j) {
+    inner[j] = std::abs(prod.row(j).sum());
+  }
+  outer.resize(prod.cols());
+  for (int i = 0; i < prod.cols(); ++i) {
+    outer[i] = std::abs(prod.col(i).sum());
+  }
+  return true;
+}
+
+/**
+ * Throw away states from the highest energy as long as the sum of their weights does not exceed tolerance.
+ * The states of each group (a sector or a braket) are sorted in ascending order of energy,
+ * so that the states kept in a group are the first num_kept[group] ones.
+ */
+inline void drop_high_energy_states(const std::vector<std::vector<double> > &energies,
+                                    const std::vector<std::vector<double> > &weights,
+                                    double tolerance,
+                                    std::vector<int> &num_kept) {
+  std::vector<std::pair<double, std::pair<int, int> > > states;//(energy, (group, index))
+  for (int group = 0; group < num_kept.size(); ++group) {
+    for (int index = 0; index < num_kept[group]; ++index) {
+      states.push_back(std::make_pair(energies[group][index], std::make_pair(group, index)));
+    }
+  }
+  std::sort(states.begin(), states.end());
+
+  double dropped_weight = 0.0;
+  for (int s = static_cast<int>(states.size()) - 1; s >= 0; --s) {
+    const int group = states[s].second.first;
+    const int index = states[s].second.second;
+    dropped_weight += weights[group][index];
+    if (dropped_weight > tolerance) {
+      break;
+    }
+    num_kept[group] = index;
+  }
+}
+
+template<typename SCALAR>
+bool ImpurityModelEigenBasis<SCALAR>::truncate_states(const std::vector<std::vector<double> > &inner_weights,
+                                                      const std::vector<std::vector<double> > &outer_weights,
+                                                      double tolerance) {
+  const int num_sectors = Base::num_sectors();
+  const int flavors = Base::num_flavors();
+  assert(!truncation_backup_);
+  assert(inner_weights.size() == num_sectors);
+  assert(outer_weights.size() == 0 || outer_weights.size() == num_braket_);
+
+  std::vector<int> dim_inner(num_sectors);
+  for (int sector = 0; sector < num_sectors; ++sector) {
+    dim_inner[sector] = dim_sector(sector);
+  }
+  drop_high_energy_states(eigenvals_sector, inner_weights, tolerance, dim_inner);
+
+  //Outer states of a braket are the lowest-energy eigenstates of its sector (see build_outer_braket).
+  //The inner states must include all the outer states kept.
+  std::vector<int> dim_outer(num_braket_, 0);
+  bool truncated = false;
+  if (outer_state_sampling_) {
+    for (int outer_state = 0; outer_state < outer_states_.size(); ++outer_state) {
+      const int sector = outer_states_[outer_state].first;
+      dim_inner[sector] = std::max(dim_inner[sector], outer_states_[outer_state].second + 1);
+    }
+  } else {
+    std::vector<std::vector<double> > energies_outer(num_braket_);
+    for (int braket = 0; braket < num_braket_; ++braket) {
+      if (ket_list[braket].invalid()) {
+        continue;
+      }
+      dim_outer[braket] = size2(ket_list[braket].obj());
+      energies_outer[braket].assign(eigenvals_sector[ket_list[braket].sector()].begin(),
+                                    eigenvals_sector[ket_list[braket].sector()].begin() + dim_outer[braket]);
+    }
+    if (outer_weights.size() > 0) {
+      drop_high_energy_states(energies_outer, outer_weights, tolerance, dim_outer);
+    }
+    for (int braket = 0; braket < num_braket_; ++braket) {
+      if (ket_list[braket].invalid()) {
+        continue;
+      }
+      const int sector = ket_list[braket].sector();
+      dim_inner[sector] = std::max(dim_inner[sector], dim_outer[braket]);
+      truncated = truncated || dim_outer[braket] < size2(ket_list[braket].obj());
+    }
+  }
+  for (int sector = 0; sector < num_sectors; ++sector) {
+    truncated = truncated || dim_inner[sector] < dim_sector(sector);
+  }
+  if (!truncated) {
+    return false;
+  }
+
+  truncation_backup_.reset(new TruncationBackup());
+  truncation_backup_->eigenvals_sector = eigenvals_sector;
+  truncation_backup_->ddag_ops_eigen = ddag_ops_eigen;
+  truncation_backup_->d_ops_eigen = d_ops_eigen;
+  truncation_backup_->sector_connection.assign(Base::sector_connection.origin(),
+                                               Base::sector_connection.origin() + Base::sector_connection.num_elements());
+  truncation_backup_->sector_connection_reverse.assign(Base::sector_connection_reverse.origin(),
+                                                       Base::sector_connection_reverse.origin()
+                                                           + Base::sector_connection_reverse.num_elements());
+  truncation_backup_->bra_list = bra_list;
+  truncation_backup_->ket_list = ket_list;
+
+  for (int sector = 0; sector < num_sectors; ++sector) {
+    eigenvals_sector[sector].resize(dim_inner[sector]);
+  }
+
+  //Operators in the eigenbasis are truncated to the states kept (the first ones in each sector).
+  //The storage format is chosen again for the smaller matrices.
+  std::vector<int> row_index, col_index;
+  std::vector<SCALAR> values;
+  for (int op = 0; op < 2; ++op) {
+    for (int flavor = 0; flavor < flavors; ++flavor) {
+      for (int src_sector = 0; src_sector < num_sectors; ++src_sector) {
+        const OPERATOR_TYPE op_type = static_cast<OPERATOR_TYPE>(op);
+        OperatorMatrix<SCALAR> &op_eigen =
+            op_type == CREATION_OP ? ddag_ops_eigen[flavor][src_sector] : d_ops_eigen[flavor][src_sector];
+        const int dst_sector = Base::get_dst_sector_ket(op_type, flavor, src_sector);
+        if (!is_sector_active(dst_sector) || !is_sector_active(src_sector)) {
+          if (op_eigen.rows() > 0 || op_eigen.cols() > 0) {
+            op_eigen.set(dense_matrix_t());
+          }
+          continue;
+        }
+        if (op_eigen.rows() == dim_sector(dst_sector) && op_eigen.cols() == dim_sector(src_sector)) {
+          continue;
+        }
+        op_eigen.get_elements(row_index, col_index, values);
+        dense_matrix_t mat(dim_sector(dst_sector), dim_sector(src_sector));
+        mat.setZero();
+        for (int elem = 0; elem < values.size(); ++elem) {
+          if (row_index[elem] < mat.rows() && col_index[elem] < mat.cols()) {
+            mat(row_index[elem], col_index[elem]) = values[elem];
+          }
+        }
+        op_eigen.set(mat);
+      }
+    }
+  }
+  disconnect_inactive_sectors();
+
+  //The number of brakets does not change. A braket without outer states is invalid.
+  if (outer_state_sampling_) {
+    set_outer_state(outer_state_);
+  } else {
+    for (int braket = 0; braket < num_braket_; ++braket) {
+      if (ket_list[braket].invalid()) {
+        continue;
+      }
+      const int sector = ket_list[braket].sector();
+      if (dim_outer[braket] == 0) {
+        bra_list[braket] = BRAKET_T();
+        ket_list[braket] = BRAKET_T();
+      } else {
+        const braket_obj_t obj = braket_obj_t::Identity(dim_inner[sector], dim_outer[braket]);
+        bra_list[braket] = BRAKET_T(sector, obj.transpose());
+        ket_list[braket] = BRAKET_T(sector, obj);
+      }
+    }
+  }
+  build_small_sector_table();
+  return true;
+}
+
+template<typename SCALAR>
+void ImpurityModelEigenBasis<SCALAR>::commit_truncation() {
+  assert(truncation_backup_);
+  if (Base::verbose_) {
+    int dim_inner_old = 0, dim_inner_new = 0, dim_outer_old = 0, dim_outer_new = 0;
+    int num_active_sectors_old = 0, num_active_sectors_new = 0;
+    for (int sector = 0; sector < Base::num_sectors(); ++sector) {
+      dim_inner_old += truncation_backup_->eigenvals_sector[sector].size();
+      dim_inner_new += eigenvals_sector[sector].size();
+      num_active_sectors_old += truncation_backup_->eigenvals_sector[sector].size() > 0 ? 1 : 0;
+      num_active_sectors_new += eigenvals_sector[sector].size() > 0 ? 1 : 0;
+    }
+    for (int braket = 0; braket < num_braket_; ++braket) {
+      dim_outer_old += size2(truncation_backup_->ket_list[braket].obj());
+      dim_outer_new += size2(ket_list[braket].obj());
+    }
+    std::cout << "Truncation of high-energy states: inner states " << dim_inner_old << " -> " << dim_inner_new
+              << ", outer states " << dim_outer_old << " -> " << dim_outer_new
+              << ", active sectors " << num_active_sectors_old << " -> " << num_active_sectors_new << std::endl;
+  }
+  truncation_backup_.reset();
+}
+
+template<typename SCALAR>
+void ImpurityModelEigenBasis<SCALAR>::revert_truncation() {
+  assert(truncation_backup_);
+  std::swap(eigenvals_sector, truncation_backup_->eigenvals_sector);
+  std::swap(ddag_ops_eigen, truncation_backup_->ddag_ops_eigen);
+  std::swap(d_ops_eigen, truncation_backup_->d_ops_eigen);
+  std::copy(truncation_backup_->sector_connection.begin(), truncation_backup_->sector_connection.end(),
+            Base::sector_connection.origin());
+  std::copy(truncation_backup_->sector_connection_reverse.begin(), truncation_backup_->sector_connection_reverse.end(),
+            Base::sector_connection_reverse.origin());
+  std::swap(bra_list, truncation_backup_->bra_list);
+  std::swap(ket_list, truncation_backup_->ket_list);
+  build_small_sector_table();
+  truncation_backup_.reset();
 }
 
 template<typename SCALAR>
@@ -319,12 +864,24 @@ void ImpurityModelEigenBasis<SCALAR>::apply_op_hyb_ket(
   }
 
   EXTENDED_REAL max_norm_old = ket.max_norm();
-  if (op_type == CREATION_OP) {
-    dense_matrix_t work_mat = ddag_ops_eigen[flavor][ket.sector()] * ket.obj();
-    ket.swap_obj(work_mat);
+  const OperatorMatrix<SCALAR> &op =
+      op_type == CREATION_OP ? ddag_ops_eigen[flavor][ket.sector()] : d_ops_eigen[flavor][ket.sector()];
+  dense_matrix_t work_mat;
+  MatrixPool<dense_matrix_t> *p_pool = work_pool_.get();
+  if (p_pool) {
+    p_pool->acquire(op.rows(), ket.obj().cols(), work_mat);
+  } else {
+    work_mat.resize(op.rows(), ket.obj().cols());
+  }
+  const int row_index = small_dim_index_[sector_new], col_index = small_dim_index_[ket.sector()];
+  if (op.format() == DENSE_FORMAT && row_index >= 0 && col_index >= 0) {
+    SmallSectorKernels<SCALAR>::apply_ket(row_index, col_index)(op.dense_matrix(), ket.obj(), work_mat);
   } else {
-    dense_matrix_t work_mat = d_ops_eigen[flavor][ket.sector()] * ket.obj();
-    ket.swap_obj(work_mat);
+    op.apply_ket(ket.obj(), work_mat, p_pool);
+  }
+  ket.swap_obj(work_mat);
+  if (p_pool) {
+    p_pool->release(work_mat);
   }
   ket.set_sector(sector_new);
 
@@ -350,12 +907,24 @@ void ImpurityModelEigenBasis<SCALAR>::apply_op_hyb_bra(const OPERATOR_TYPE &op_t
 
   EXTENDED_REAL max_norm_old = bra.max_norm();
 
-  if (op_type == CREATION_OP) {
-    dense_matrix_t work_mat = bra.obj() * ddag_ops_eigen[flavor][sector_new];
-    bra.swap_obj(work_mat);
+  const OperatorMatrix<SCALAR> &op =
+      op_type == CREATION_OP ? ddag_ops_eigen[flavor][sector_new] : d_ops_eigen[flavor][sector_new];
+  dense_matrix_t work_mat;
+  MatrixPool<dense_matrix_t> *p_pool = work_pool_.get();
+  if (p_pool) {
+    p_pool->acquire(bra.obj().rows(), op.cols(), work_mat);
+  } else {
+    work_mat.resize(bra.obj().rows(), op.cols());
+  }
+  const int row_index = small_dim_index_[bra.sector()], col_index = small_dim_index_[sector_new];
+  if (op.format() == DENSE_FORMAT && row_index >= 0 && col_index >= 0) {
+    SmallSectorKernels<SCALAR>::apply_bra(row_index, col_index)(op.dense_matrix(), bra.obj(), work_mat);
   } else {
-    dense_matrix_t work_mat = bra.obj() * d_ops_eigen[flavor][sector_new];
-    bra.swap_obj(work_mat);
+    op.apply_bra(bra.obj(), work_mat, p_pool);
+  }
+  bra.swap_obj(work_mat);
+  if (p_pool) {
+    p_pool->release(work_mat);
   }
   bra.set_sector(sector_new);
 
@@ -376,28 +945,36 @@ ImpurityModelEigenBasis<SCALAR>::product(const BRAKET_T &bra, const BRAKET_T &ke
   return static_cast<typename ExtendedScalar<SCALAR>::value_type>(bra.coeff() * ket.coeff()) * (bra.obj() * ket.obj()).trace();
 }
 
+template<typename SCALAR>
+const ExpVectorCache::vector_t &
+ImpurityModelEigenBasis<SCALAR>::exp_vector(int sector, double t, ExpVectorCache::vector_t &work, double &coeff) const {
+  ExpVectorCache *p_cache = exp_cache_.get();
+  if (p_cache) {
+    return p_cache->get(sector, t, eigenvals_sector[sector], coeff);
+  }
+  coeff = ExpVectorCache::compute(t, eigenvals_sector[sector], work);
+  return work;
+}
+
 template<typename SCALAR>
 void ImpurityModelEigenBasis<SCALAR>::sector_propagate_ket(BRAKET_T &ket, double t) const {
   if (ket.invalid()) {
     return;
   }
 
-  const int dim = dim_sector(ket.sector());
-  const int rows = size1(ket.obj());
-  const int cols = size2(ket.obj());
-  assert(rows == dim);
-
-  std::vector<double> exp_v(dim);
   const int sector = ket.sector();
   assert(eigenvals_sector.size() > sector);
+  assert(size1(ket.obj()) == dim_sector(sector));
 
-  const double coeff = compute_exp_vector_safe(t, eigenvals_sector[sector], exp_v);
+  double coeff;
+  ExpVectorCache::vector_t work;
+  const ExpVectorCache::vector_t &exp_v = exp_vector(sector, t, work, coeff);
 
-  //Assuming the matrix in clumn major format
-  for (int j = 0; j < cols; ++j) {
-    for (int i = 0; i < rows; ++i) {
-      ket.obj()(i, j) *= exp_v[i];
-    }
+  //Scale the i-th row by exp_v[i] (vectorized along columns)
+  if (small_dim_index_[sector] >= 0) {
+    SmallSectorKernels<SCALAR>::propagate_ket(small_dim_index_[sector])(exp_v, ket.obj());
+  } else {
+    ket.obj().array().colwise() *= exp_v.cast<SCALAR>();
   }
   ket.set_coeff(ket.coeff() * coeff);
 }
@@ -409,19 +986,17 @@ void ImpurityModelEigenBasis<SCALAR>::sector_propagate_bra(BRAKET_T &bra, double
   }
 
   const int sector = bra.sector();
-  const int dim = dim_sector(sector);
-  std::vector<double> exp_v(dim);
-  const double coeff = compute_exp_vector_safe(t, eigenvals_sector[sector], exp_v);
+  assert(size2(bra.obj()) == dim_sector(sector));
 
-  const int rows = size1(bra.obj());
-  const int cols = size2(bra.obj());
-  assert(cols == dim);
+  double coeff;
+  ExpVectorCache::vector_t work;
+  const ExpVectorCache::vector_t &exp_v = exp_vector(sector, t, work, coeff);
 
-  //Assuming the matrix in clumn major format
-  for (int j = 0; j < cols; ++j) {
-    for (int i = 0; i < rows; ++i) {
-      bra.obj()(i, j) *= exp_v[j];
-    }
+  //Scale the j-th column by exp_v[j]
+  if (small_dim_index_[sector] >= 0) {
+    SmallSectorKernels<SCALAR>::propagate_bra(small_dim_index_[sector])(exp_v, bra.obj());
+  } else {
+    bra.obj().array().rowwise() *= exp_v.transpose().cast<SCALAR>();
   }
   bra.set_coeff(bra.coeff() * coeff);
 }
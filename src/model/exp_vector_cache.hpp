@@ -0,0 +1,135 @@
+#pragma once
+
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+#include <Eigen/Dense>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+/**
+ * @brief Cache of imaginary-time propagators exp(-t E_i) in the eigenbasis of each sector
+ *
+ * The same imaginary-time differences appear repeatedly (e.g. between the fixed edges of the sliding window).
+ * The last few vectors computed for each sector are kept and looked up by t.
+ * The entries are recycled as work space, so no memory is allocated once the cache is warmed up.
+ * exp is evaluated with Eigen array expressions, which are vectorized (SSE/AVX/AVX-512 depending on compiler flags).
+ * The relative error is of the order of 1E-14 (a few ulp larger than std::exp).
+ * A cache is not thread safe. Each thread must own its cache.
+ */
+class ExpVectorCache {
+ public:
+  typedef Eigen::Array<double, Eigen::Dynamic, 1> vector_t;
+
+  ExpVectorCache(int num_entries_per_sector = 4)
+      : num_entries_per_sector_(num_entries_per_sector), num_hits_(0), num_misses_(0) { }
+
+  /**
+   * Return exp(-t*energies[i] - max_val) and set coeff = exp(max_val), where max_val = max_i (-t*energies[i]).
+   * Elements smaller than exp(-60.0) ~ 10^{-26} are set to zero (same as compute_exp_vector_safe).
+   * The returned reference is valid until the next call for the same sector.
+   */
+  const vector_t &get(int sector, double t, const std::vector<double> &energies, double &coeff) {
+    if (sector >= entries_.size()) {
+      entries_.resize(sector + 1);
+      next_entry_.resize(sector + 1, 0);
+    }
+    std::vector<Entry> &entries = entries_[sector];
+    for (int i = 0; i < entries.size(); ++i) {
+      if (entries[i].t == t && entries[i].exp_v.size() == energies.size()) {
+        coeff = entries[i].coeff;
+        ++num_hits_;
+        return entries[i].exp_v;
+      }
+    }
+    ++num_misses_;
+
+    //replace the oldest entry
+    if (entries.size() < num_entries_per_sector_) {
+      entries.push_back(Entry());
+      next_entry_[sector] = entries.size() - 1;
+    }
+    Entry &entry = entries[next_entry_[sector]];
+    next_entry_[sector] = (next_entry_[sector] + 1) % num_entries_per_sector_;
+
+    entry.t = t;
+    entry.coeff = compute(t, energies, entry.exp_v);
+    coeff = entry.coeff;
+    return entry.exp_v;
+  }
+
+  //Compute exp_v without caching. Return the scaling factor.
+  static double compute(double t, const std::vector<double> &energies, vector_t &exp_v) {
+    const Eigen::Map<const vector_t> e(&energies[0], energies.size());
+    exp_v = -t * e;
+    const double max_val = exp_v.maxCoeff();
+    exp_v -= max_val;
+    exp_v = (exp_v < -60.0).select(0.0, exp_v.exp());
+    return std::exp(max_val);
+  }
+
+  //Statistics (number of hits, number of misses)
+  inline std::pair<unsigned long, unsigned long> stats() const {
+    return std::make_pair(num_hits_, num_misses_);
+  }
+  inline void reset_stats() {
+    num_hits_ = num_misses_ = 0;
+  }
+
+ private:
+  struct Entry {
+    double t, coeff;
+    vector_t exp_v;
+  };
+
+  int num_entries_per_sector_;
+  std::vector<std::vector<Entry> > entries_;//sector, entry
+  std::vector<int> next_entry_;//sector
+  unsigned long num_hits_, num_misses_;
+};
+
+/**
+ * @brief One ExpVectorCache for each OpenMP thread
+ *
+ * get() returns NULL if the calling thread has no cache (e.g. more threads than requested at construction).
+ */
+class PerThreadExpVectorCache {
+ public:
+  PerThreadExpVectorCache() {
+#ifdef _OPENMP
+    caches_.resize(std::max(omp_get_max_threads(), 1));
+#else
+    caches_.resize(1);
+#endif
+  }
+
+  inline ExpVectorCache *get() {
+#ifdef _OPENMP
+    const int thread = omp_get_thread_num();
+#else
+    const int thread = 0;
+#endif
+    return thread < caches_.size() ? &caches_[thread] : NULL;
+  }
+
+  std::pair<unsigned long, unsigned long> stats() const {
+    std::pair<unsigned long, unsigned long> r(0, 0);
+    for (int i = 0; i < caches_.size(); ++i) {
+      r.first += caches_[i].stats().first;
+      r.second += caches_[i].stats().second;
+    }
+    return r;
+  }
+
+  void reset_stats() {
+    for (int i = 0; i < caches_.size(); ++i) {
+      caches_[i].reset_stats();
+    }
+  }
+
+ private:
+  std::vector<ExpVectorCache> caches_;
+};
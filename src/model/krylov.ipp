@@ -0,0 +1,374 @@
+template<typename SCALAR>
+ImpurityModelKrylov<SCALAR>::ImpurityModelKrylov(const alps::params &par, bool verbose)
+    : ImpurityModel<SCALAR, ImpurityModelKrylov<SCALAR> >(par, verbose),
+      krylov_dim_(par["model.krylov.dim"]),
+      krylov_tolerance_(par["model.krylov.tolerance"]) {
+  build_outer_braket(par);
+}
+
+template<typename SCALAR>
+ImpurityModelKrylov<SCALAR>::ImpurityModelKrylov(const alps::params &par,
+                                                 const std::vector<boost::tuple<int, int, SCALAR> > &nonzero_t_vals_list,
+                                                 const std::vector<boost::tuple<int,
+                                                                                int,
+                                                                                int,
+                                                                                int,
+                                                                                SCALAR> > &nonzero_U_vals_list,
+                                                 bool verbose)
+    : ImpurityModel<SCALAR, ImpurityModelKrylov<SCALAR> >(par, nonzero_t_vals_list, nonzero_U_vals_list, verbose),
+      krylov_dim_(par["model.krylov.dim"]),
+      krylov_tolerance_(par["model.krylov.tolerance"]) {
+  build_outer_braket(par);
+}
+
+template<typename SCALAR>
+void ImpurityModelKrylov<SCALAR>::define_parameters(alps::params &parameters) {
+  Base::define_parameters(parameters);
+  parameters
+      .define<int>("model.krylov.dim", 30, "Max dimension of Krylov subspaces")
+      .define<double>("model.krylov.tolerance", 1E-10, "Relative tolerance of Lanczos iterations")
+      .define<int>("model.krylov.num_outer_states", 1, "Number of lowest eigenstates of each sector used as outer states");
+}
+
+/**
+ * Lanczos iterations with full reorthogonalization starting from a normalized vector v0.
+ * The columns of deflation (orthonormal) are projected out.
+ * Return the dimension of the Krylov subspace, which is smaller than max_dim if an invariant subspace is found.
+ * V: Lanczos vectors, T: tridiagonal matrix, beta_last: norm of the residual vector
+ */
+template<typename SCALAR>
+int lanczos_iterations(const Eigen::SparseMatrix<SCALAR> &H,
+                       const Eigen::Matrix<SCALAR, Eigen::Dynamic, 1> &v0,
+                       int max_dim,
+                       const Eigen::Matrix<SCALAR, Eigen::Dynamic, Eigen::Dynamic> &deflation,
+                       Eigen::Matrix<SCALAR, Eigen::Dynamic, Eigen::Dynamic> &V,
+                       Eigen::MatrixXd &T,
+                       double &beta_last) {
+  typedef Eigen::Matrix<SCALAR, Eigen::Dynamic, 1> vector_t;
+  const int dim = H.rows();
+  max_dim = std::max(1, std::min(max_dim, dim - static_cast<int>(deflation.cols())));
+
+  V.resize(dim, max_dim);
+  T.setZero(max_dim, max_dim);
+  V.col(0) = v0;
+  beta_last = 0.0;
+  vector_t w;
+  for (int j = 0; j < max_dim; ++j) {
+    w = H * V.col(j);
+    const double norm_Hv = w.norm();
+    T(j, j) = get_real(V.col(j).dot(w));
+    //twice is enough
+    for (int it = 0; it < 2; ++it) {
+      if (deflation.cols() > 0) {
+        w -= deflation * (deflation.adjoint() * w);
+      }
+      w -= V.leftCols(j + 1) * (V.leftCols(j + 1).adjoint() * w);
+    }
+    const double beta = w.norm();
+    if (j == max_dim - 1) {
+      beta_last = beta;
+      break;
+    }
+    if (beta < 1E-12 * std::max(norm_Hv, 1.0)) {
+      V.conservativeResize(dim, j + 1);
+      T.conservativeResize(j + 1, j + 1);
+      return j + 1;
+    }
+    T(j, j + 1) = T(j + 1, j) = beta;
+    V.col(j + 1) = w / beta;
+  }
+  return max_dim;
+}
+
+/**
+ * Compute the lowest eigenstates of a Hermitian sparse matrix.
+ * Small matrices (dim <= krylov_dim) are diagonalized exactly.
+ * Otherwise, the eigenstates are computed one by one with a restarted Lanczos method,
+ * projecting out the eigenstates already found.
+ */
+template<typename SCALAR>
+void lowest_eigenstates(const Eigen::SparseMatrix<SCALAR> &H, int num_states, int krylov_dim, double tol,
+                        std::vector<double> &evals, Eigen::Matrix<SCALAR, Eigen::Dynamic, Eigen::Dynamic> &evecs) {
+  typedef Eigen::Matrix<SCALAR, Eigen::Dynamic, Eigen::Dynamic> matrix_t;
+  typedef Eigen::Matrix<SCALAR, Eigen::Dynamic, 1> vector_t;
+
+  const int dim = H.rows();
+  num_states = std::min(num_states, dim);
+  evals.resize(num_states);
+
+  if (dim <= krylov_dim) {
+    const matrix_t H_dense(H);
+    Eigen::SelfAdjointEigenSolver<matrix_t> esolv(H_dense);
+    for (int ie = 0; ie < num_states; ++ie) {
+      evals[ie] = esolv.eigenvalues()[ie];
+    }
+    evecs = esolv.eigenvectors().leftCols(num_states);
+    return;
+  }
+
+  const int max_restarts = 1000;
+  boost::random::mt19937 gen(1234);
+  boost::random::uniform_real_distribution<> dist(-1.0, 1.0);
+  evecs.resize(dim, 0);
+  matrix_t V;
+  Eigen::MatrixXd T;
+  for (int ie = 0; ie < num_states; ++ie) {
+    vector_t v(dim);
+    for (int i = 0; i < dim; ++i) {
+      v(i) = dist(gen);
+    }
+    double beta_last, eval = 0.0;
+    for (int restart = 0; restart < max_restarts; ++restart) {
+      if (ie > 0) {
+        v -= evecs * (evecs.adjoint() * v);
+      }
+      v.normalize();
+      const int m = lanczos_iterations(H, v, krylov_dim, evecs, V, T, beta_last);
+      Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> esolv(T);
+      eval = esolv.eigenvalues()[0];
+      v = V * esolv.eigenvectors().col(0).cast<SCALAR>();
+      if (beta_last * std::abs(esolv.eigenvectors()(m - 1, 0)) < tol * std::max(std::abs(eval), 1.0)) {
+        break;
+      }
+      if (restart == max_restarts - 1) {
+        std::cerr << "Warning: Lanczos iterations did not converge." << std::endl;
+      }
+    }
+    v.normalize();
+    evals[ie] = eval;
+    evecs.conservativeResize(dim, ie + 1);
+    evecs.col(ie) = v;
+  }
+
+  //sort in ascending order of energy
+  std::vector<std::pair<double, int> > order;
+  for (int ie = 0; ie < num_states; ++ie) {
+    order.push_back(std::make_pair(evals[ie], ie));
+  }
+  std::sort(order.begin(), order.end());
+  const matrix_t evecs_unsorted(evecs);
+  for (int ie = 0; ie < num_states; ++ie) {
+    evals[ie] = order[ie].first;
+    evecs.col(ie) = evecs_unsorted.col(order[ie].second);
+  }
+}
+
+/**
+ * v <- exp(-t (H - shift)) v with the Krylov subspace method.
+ * If the error estimate exceeds tol, t is split into smaller time steps.
+ */
+template<typename SCALAR>
+void krylov_propagate(const Eigen::SparseMatrix<SCALAR> &H, double shift, double t, int krylov_dim, double tol,
+                      Eigen::Matrix<SCALAR, Eigen::Dynamic, 1> &v) {
+  typedef Eigen::Matrix<SCALAR, Eigen::Dynamic, Eigen::Dynamic> matrix_t;
+
+  const int max_halving = 50;
+  const matrix_t no_deflation;
+  matrix_t V;
+  Eigen::MatrixXd T;
+  Eigen::VectorXd c;
+  double t_remaining = t, dt = t;
+  while (t_remaining > 0.0) {
+    const double beta0 = v.norm();
+    if (beta0 == 0.0) {
+      return;
+    }
+    double beta_last;
+    const int m = lanczos_iterations(H, Eigen::Matrix<SCALAR, Eigen::Dynamic, 1>(v / beta0), krylov_dim,
+                                     no_deflation, V, T, beta_last);
+    Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> esolv(T);
+
+    //c = exp(-dt (T - shift)) e_1. Start from twice the last accepted time step.
+    dt = std::min(2 * dt, t_remaining);
+    for (int halving = 0; halving <= max_halving; ++halving) {
+      const Eigen::VectorXd exp_v = (-dt * (esolv.eigenvalues().array() - shift)).exp().matrix();
+      c = esolv.eigenvectors() * exp_v.cwiseProduct(esolv.eigenvectors().row(0).transpose());
+      if (beta_last * std::abs(c(m - 1)) <= tol * c.norm() || halving == max_halving) {
+        break;
+      }
+      dt *= 0.5;
+    }
+    v = beta0 * (V * c.cast<SCALAR>());
+    t_remaining -= dt;
+  }
+}
+
+template<typename SCALAR>
+void ImpurityModelKrylov<SCALAR>::build_outer_braket(const alps::params &par) {
+  namespace bll = boost::lambda;
+  const int num_sectors = Base::num_sectors();
+  const int num_outer_states = par["model.krylov.num_outer_states"].template as<int>();
+
+  const int num_threads = num_model_setup_threads(par["model.n_threads"].template as<int>());
+  boost::timer::cpu_timer timer;
+
+  //Sectors are processed in parallel (the results do not depend on the number of threads)
+  std::vector<std::vector<double> > evals_sector(num_sectors);
+  std::vector<dense_matrix_t> evecs_sector(num_sectors);
+#pragma omp parallel for num_threads(num_threads) schedule(dynamic) if(num_threads > 1)
+  for (int sector = 0; sector < num_sectors; ++sector) {
+    lowest_eigenstates(Base::ham_sectors[sector], std::max(num_outer_states, 1), krylov_dim_, krylov_tolerance_,
+                       evals_sector[sector], evecs_sector[sector]);
+  }
+  if (Base::verbose_) {
+    std::cout << "Setup time with " << num_threads << " threads: Lanczos " << timer.elapsed().wall * 1E-9 << " sec"
+              << std::endl;
+  }
+
+  min_eigenval_sector.resize(num_sectors);
+  for (int sector = 0; sector < num_sectors; ++sector) {
+    min_eigenval_sector[sector] = evals_sector[sector][0];
+  }
+  Base::reference_energy_ = *std::min_element(min_eigenval_sector.begin(), min_eigenval_sector.end());
+  for (int sector = 0; sector < num_sectors; ++sector) {
+    min_eigenval_sector[sector] -= Base::reference_energy_;
+  }
+  if (Base::verbose_) {
+    std::cout << "Reference energy " << Base::reference_energy_ << std::endl;
+  }
+
+  const double cutoff_outer = par["model.outer_cutoff_energy"].template as<double>() + Base::reference_energy_;
+  bra_list.resize(0);
+  ket_list.resize(0);
+  for (int sector = 0; sector < num_sectors; ++sector) {
+    const int dim_outer = std::min(num_outer_states, static_cast<int>(
+        std::count_if(evals_sector[sector].begin(), evals_sector[sector].end(), bll::_1 <= cutoff_outer)));
+    if (dim_outer == 0) {
+      continue;
+    }
+    const dense_matrix_t obj = evecs_sector[sector].leftCols(dim_outer);
+    bra_list.push_back(BRAKET_T(sector, obj.adjoint()));
+    ket_list.push_back(BRAKET_T(sector, obj));
+    if (Base::verbose_) {
+      std::cout << "Dim of ket: sector " << sector << " inner " << dim_sector(sector) << " outer " << dim_outer
+                << std::endl;
+    }
+  }
+}
+
+template<typename SCALAR>
+void ImpurityModelKrylov<SCALAR>::apply_op_hyb_ket(const OPERATOR_TYPE &op_type, int flavor, BRAKET_T &ket) const {
+  assert(flavor < Base::num_flavors());
+
+  if (ket.invalid()) {
+    return;
+  }
+
+  const int sector_new = Base::get_dst_sector_ket(op_type, flavor, ket.sector());
+  if (sector_new == nirvana) {
+    ket.set_invalid();
+    return;
+  }
+
+  EXTENDED_REAL max_norm_old = ket.max_norm();
+  const sparse_matrix_t &op =
+      op_type == CREATION_OP ? Base::ddag_ops_sectors[flavor][ket.sector()] : Base::d_ops_sectors[flavor][ket.sector()];
+  dense_matrix_t work_mat = op * ket.obj();
+  ket.swap_obj(work_mat);
+  ket.set_sector(sector_new);
+
+  if (ket.max_norm() / max_norm_old < 1E-30) {
+    ket.set_invalid();
+  }
+}
+
+template<typename SCALAR>
+void ImpurityModelKrylov<SCALAR>::apply_op_hyb_bra(const OPERATOR_TYPE &op_type, int flavor, BRAKET_T &bra) const {
+  assert(flavor < Base::num_flavors());
+
+  if (bra.invalid()) {
+    return;
+  }
+
+  const int sector_new = Base::get_dst_sector_bra(op_type, flavor, bra.sector());
+  if (sector_new == nirvana) {
+    bra.set_invalid();
+    return;
+  }
+
+  EXTENDED_REAL max_norm_old = bra.max_norm();
+  const sparse_matrix_t &op =
+      op_type == CREATION_OP ? Base::ddag_ops_sectors[flavor][sector_new] : Base::d_ops_sectors[flavor][sector_new];
+  dense_matrix_t work_mat = bra.obj() * op;
+  bra.swap_obj(work_mat);
+  bra.set_sector(sector_new);
+
+  if (bra.max_norm() / max_norm_old < 1E-30) {
+    bra.set_invalid();
+  }
+}
+
+template<typename SCALAR>
+typename ExtendedScalar<SCALAR>::value_type
+ImpurityModelKrylov<SCALAR>::product(const BRAKET_T &bra, const BRAKET_T &ket) const {
+  if (bra.invalid() || ket.invalid() || bra.sector() != ket.sector()) {
+    return 0.0;
+  }
+  assert(size2(bra.obj()) == size1(ket.obj()));
+  assert(size1(bra.obj()) == size2(ket.obj()));
+  return static_cast<typename ExtendedScalar<SCALAR>::value_type>(bra.coeff() * ket.coeff()) * (bra.obj() * ket.obj()).trace();
+}
+
+template<typename SCALAR>
+void ImpurityModelKrylov<SCALAR>::propagate_vector(int sector, double t, vector_t &v) const {
+  krylov_propagate(Base::ham_sectors[sector], min_eigenval_sector[sector] + Base::reference_energy_, t,
+                   krylov_dim_, krylov_tolerance_, v);
+}
+
+template<typename SCALAR>
+void ImpurityModelKrylov<SCALAR>::sector_propagate_ket(BRAKET_T &ket, double t) const {
+  if (ket.invalid()) {
+    return;
+  }
+
+  const int sector = ket.sector();
+  assert(size1(ket.obj()) == dim_sector(sector));
+
+  vector_t v;
+  for (int col = 0; col < ket.obj().cols(); ++col) {
+    v = ket.obj().col(col);
+    propagate_vector(sector, t, v);
+    ket.obj().col(col) = v;
+  }
+  ket.set_coeff(ket.coeff() * std::exp(-t * min_eigenval_sector[sector]));
+}
+
+template<typename SCALAR>
+void ImpurityModelKrylov<SCALAR>::sector_propagate_bra(BRAKET_T &bra, double t) const {
+  if (bra.invalid()) {
+    return;
+  }
+
+  const int sector = bra.sector();
+  assert(size2(bra.obj()) == dim_sector(sector));
+
+  //<v| exp(-t H) = (exp(-t H) |v>)^dagger
+  vector_t v;
+  for (int row = 0; row < bra.obj().rows(); ++row) {
+    v = bra.obj().row(row).adjoint();
+    propagate_vector(sector, t, v);
+    bra.obj().row(row) = v.adjoint();
+  }
+  bra.set_coeff(bra.coeff() * std::exp(-t * min_eigenval_sector[sector]));
+}
+
+template<typename SCALAR>
+typename model_traits<ImpurityModelKrylov<SCALAR> >::BRAKET_T ImpurityModelKrylov<SCALAR>::get_outer_bra(int bra) const {
+  assert(bra >= 0 && bra < num_brakets());
+  return bra_list[bra];
+}
+
+template<typename SCALAR>
+typename model_traits<ImpurityModelKrylov<SCALAR> >::BRAKET_T ImpurityModelKrylov<SCALAR>::get_outer_ket(int ket) const {
+  assert(ket >= 0 && ket < num_brakets());
+  return ket_list[ket];
+}
+
+template<typename SCALAR>
+bool ImpurityModelKrylov<SCALAR>::translationally_invariant() const {
+  int tot_dim = 0;
+  for (int bra = 0; bra < bra_list.size(); ++bra) {
+    tot_dim += std::min(size1(bra_list[bra].obj()), size2(bra_list[bra].obj()));
+  }
+  return std::abs(tot_dim - std::pow(2.0, Base::num_flavors())) < 1E-5;
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <map>
+#include <vector>
+#include <algorithm>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+/**
+ * @brief Pool of storage of dynamic-size matrices
+ *
+ * Matrices released into the pool are kept on free lists indexed by the number of elements.
+ * acquire() hands out storage of the same number of elements without calling the allocator
+ * (resizing an Eigen matrix does not reallocate if the number of elements is unchanged).
+ * A pool is not thread safe. Each thread or braket must own its pool.
+ */
+template<typename MAT>
+class MatrixPool {
+ public:
+  MatrixPool(int max_free_per_size = 256)
+      : max_free_per_size_(max_free_per_size), num_allocated_(0), num_reused_(0) { }
+
+  //Resize mat to rows x cols using storage from the pool if available. The old storage of mat is released into the pool.
+  void acquire(int rows, int cols, MAT &mat) {
+    const long size = static_cast<long>(rows) * cols;
+    if (size == mat.size()) {
+      mat.resize(rows, cols);
+      return;
+    }
+    release(mat);
+    if (size == 0) {
+      mat.resize(rows, cols);
+      return;
+    }
+    typename std::map<long, std::vector<MAT> >::iterator it = free_lists_.find(size);
+    if (it != free_lists_.end() && it->second.size() > 0) {
+      mat.swap(it->second.back());
+      it->second.pop_back();
+      ++num_reused_;
+    } else {
+      ++num_allocated_;
+    }
+    mat.resize(rows, cols);
+  }
+
+  //Move the storage of mat into the pool. mat becomes empty.
+  void release(MAT &mat) {
+    if (mat.size() == 0) {
+      return;
+    }
+    std::vector<MAT> &free_list = free_lists_[mat.size()];
+    if (free_list.size() < max_free_per_size_) {
+      free_list.push_back(MAT());
+      free_list.back().swap(mat);
+    }
+    mat.resize(0, 0);
+  }
+
+  void clear() {
+    free_lists_.clear();
+  }
+
+  //Statistics (number of allocations, number of reuses of storage)
+  inline std::pair<unsigned long, unsigned long> stats() const {
+    return std::make_pair(num_allocated_, num_reused_);
+  }
+  inline void reset_stats() {
+    num_allocated_ = num_reused_ = 0;
+  }
+
+ private:
+  int max_free_per_size_;
+  std::map<long, std::vector<MAT> > free_lists_;
+  unsigned long num_allocated_, num_reused_;
+};
+
+/**
+ * @brief One MatrixPool for each OpenMP thread
+ *
+ * get() returns NULL if the calling thread has no pool (e.g. more threads than requested at construction).
+ */
+template<typename MAT>
+class PerThreadMatrixPool {
+ public:
+  PerThreadMatrixPool() {
+#ifdef _OPENMP
+    pools_.resize(std::max(omp_get_max_threads(), 1));
+#else
+    pools_.resize(1);
+#endif
+  }
+
+  inline MatrixPool<MAT> *get() {
+#ifdef _OPENMP
+    const int thread = omp_get_thread_num();
+#else
+    const int thread = 0;
+#endif
+    return thread < pools_.size() ? &pools_[thread] : NULL;
+  }
+
+  std::pair<unsigned long, unsigned long> stats() const {
+    std::pair<unsigned long, unsigned long> r(0, 0);
+    for (int i = 0; i < pools_.size(); ++i) {
+      r.first += pools_[i].stats().first;
+      r.second += pools_[i].stats().second;
+    }
+    return r;
+  }
+
+  void reset_stats() {
+    for (int i = 0; i < pools_.size(); ++i) {
+      pools_[i].reset_stats();
+    }
+  }
+
+ private:
+  std::vector<MatrixPool<MAT> > pools_;
+};
@@ -1,28 +1,48 @@
 #pragma once
 
 #include <vector>
+#include <map>
 #include <complex>
 #include <fstream>
 #include <iterator>
 #include <algorithm>
 #include <utility>
+#include <ctime>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
 
 #include <boost/tuple/tuple.hpp>
+#include <boost/cstdint.hpp>
 #include <boost/multi_array.hpp>
 #include <boost/format.hpp>
 #include <boost/scoped_ptr.hpp>
+#include <boost/random.hpp>
+#include <boost/timer/timer.hpp>
 #include <boost/multiprecision/cpp_dec_float.hpp>
 
 #include <boost/lambda/lambda.hpp>
 
 #include <Eigen/Dense>
 
+#include <alps/hdf5/archive.hpp>
+#include <alps/hdf5/vector.hpp>
+#include <alps/hdf5/complex.hpp>
+
 #include "hybfermion.hpp"
 #include "clustering.hpp"
+#include "matrix_pool.hpp"
+#include "exp_vector_cache.hpp"
+#include "operator_matrix.hpp"
+#include "small_sector_kernels.hpp"
 #include "../util.hpp"
 #include "../operator.hpp"
 #include "../wide_scalar.hpp"
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 //forward declaration for alps::params
 namespace alps {
 namespace params_ns {
@@ -34,6 +54,62 @@ using params_ns::params;
 
 const int nirvana = -1;
 
+//Number of threads used for setting up a model (model.n_threads)
+//For 0, threads are used only if OMP_NUM_THREADS is set explicitly:
+//otherwise every MPI process would start as many threads as the node has cores.
+inline int num_model_setup_threads(int n_threads) {
+#ifdef _OPENMP
+  if (n_threads > 0) {
+    return n_threads;
+  }
+  return std::getenv("OMP_NUM_THREADS") != NULL ? std::max(omp_get_max_threads(), 1) : 1;
+#else
+  return 1;
+#endif
+}
+
+/**
+ * U tensor in the rotated basis:
+ * U_rot(f0,f1,f2,f3) = sum_{a,b,a',b'} U(a,b,a',b') conj(R(a,f0)) conj(R(b,f1)) R(a',f2) R(b',f3) with R = rotmat.
+ * The four indices are contracted one by one at the cost of O(F^5) (matrix-matrix products).
+ */
+template<typename SCALAR>
+void rotate_U_tensor(int flavors,
+                     const std::vector<boost::tuple<int, int, int, int, SCALAR> > &U_vals,
+                     const Eigen::Matrix<SCALAR, Eigen::Dynamic, Eigen::Dynamic> &rotmat,
+                     boost::multi_array<SCALAR, 4> &U_rot) {
+  typedef Eigen::Matrix<SCALAR, Eigen::Dynamic, Eigen::Dynamic> matrix_t;
+  const int F = flavors;
+  const int F3 = F * F * F;
+  //The tensor is stored in column-major order, i.e., element (i0, i1, i2, i3) at i0 + F*(i1 + F*(i2 + F*i3)).
+  matrix_t tensor(F, F3), tensor_tmp(F3, F);
+  tensor.setZero();
+  for (int elem = 0; elem < U_vals.size(); ++elem) {
+    const int a = boost::get<0>(U_vals[elem]);
+    const int b = boost::get<1>(U_vals[elem]);
+    const int ap = boost::get<2>(U_vals[elem]);
+    const int bp = boost::get<3>(U_vals[elem]);
+    tensor(a, b + F * (ap + F * bp)) += boost::get<4>(U_vals[elem]);
+  }
+  const matrix_t rotmat_conj = rotmat.conjugate();
+  for (int index = 0; index < 4; ++index) {
+    //Contract the leading index and append the new index at the end: (i0, i1, i2, i3) -> (i1, i2, i3, f)
+    const matrix_t &R = index < 2 ? rotmat_conj : rotmat;
+    tensor_tmp.noalias() = tensor.transpose() * R;
+    tensor = Eigen::Map<matrix_t>(tensor_tmp.data(), F, F3);
+  }
+  U_rot.resize(boost::extents[F][F][F][F]);
+  for (int flavor0 = 0; flavor0 < F; ++flavor0) {
+    for (int flavor1 = 0; flavor1 < F; ++flavor1) {
+      for (int flavor2 = 0; flavor2 < F; ++flavor2) {
+        for (int flavor3 = 0; flavor3 < F; ++flavor3) {
+          U_rot[flavor0][flavor1][flavor2][flavor3] = tensor(flavor0, flavor1 + F * (flavor2 + F * flavor3));
+        }
+      }
+    }
+  }
+}
+
 /*
  * A class holding a bra or a ket with some additional information
  * Usually, OBS is a matrix type.
@@ -42,6 +118,7 @@ template<typename Scalar, typename OBJ>
 class Braket {
  public:
   typedef EXTENDED_REAL norm_type;
+  typedef OBJ obj_type;
 
   Braket() : sector_(nirvana), obj_(0, 0), coeff_(1.0) { }
 
@@ -95,6 +172,16 @@ class Braket {
     return r;
   }
 
+  inline norm_type compute_frobenius_norm() {
+    normalize();
+    return invalid() ? norm_type(0.0) : coeff_ * frobenius_norm<Scalar>(obj_);
+  }
+
+  inline norm_type compute_holder_norm_bound() {
+    normalize();
+    return invalid() ? norm_type(0.0) : coeff_ * holder_norm_bound<Scalar>(obj_);
+  }
+
   inline norm_type max_norm() const {
     if (invalid()) return norm_type(0.0);
     return coeff_ * obj_.cwiseAbs().maxCoeff();
@@ -109,16 +196,9 @@ class Braket {
       return;
     }
     coeff_ *= maxval;
-    double rtmp = 1 / maxval;
-    for (int j = 0; j < obj_.cols(); ++j) {
-      for (int i = 0; i < obj_.rows(); ++i) {
-        if (std::abs(obj_(i, j)) < maxval * 1E-30) {
-          obj_(i, j) = 0.0;
-        } else {
-          obj_(i, j) *= rtmp;
-        }
-      }
-    }
+    const double rtmp = 1 / maxval;
+    //elements smaller than maxval * 1E-30 are set to zero (vectorized)
+    obj_.array() = (obj_.array().abs() < maxval * 1E-30).select(Scalar(0.0), obj_.array() * rtmp);
   }
 
  private:
@@ -286,6 +366,9 @@ class ImpurityModel {
   void read_rotation_hybridization_function(const alps::params &par);
   void hilbert_space_partioning(const alps::params &par);
 
+  //Hash (hex string) of the inputs determining the local Hamiltonian, its sectors and the cutoff energies
+  std::string input_hash(const alps::params &par) const;
+
   //getter
   const sparse_matrix_t &creation_operators_hyb(int flavor, int sector) {
     return ddag_ops_sectors[flavor][sector];
@@ -380,21 +463,91 @@ class ImpurityModelEigenBasis: public ImpurityModel<SCALAR, ImpurityModelEigenBa
     return num_braket_;
   }
 
+  //Monte Carlo sampling of outer states (model.outer_state_sampling):
+  // there is only one braket, which is the eigenstate set by set_outer_state().
+  inline bool outer_state_sampling() const { return outer_state_sampling_; }
+  inline int num_outer_states() const { return outer_states_.size(); }
+  inline int get_outer_state() const { return outer_state_; }
+  void set_outer_state(int outer_state);
+
   bool translationally_invariant() const;
 
+  //True if the eigenbasis was loaded from the model cache (model.cache_file) instead of being built
+  inline bool loaded_from_cache() const { return loaded_from_cache_; }
+
+  //Statistics of the work space used in applying operators (number of allocations, number of reuses of storage)
+  inline std::pair<unsigned long, unsigned long> get_work_pool_stats() const { return work_pool_.stats(); }
+  inline void reset_work_pool_stats() { work_pool_.reset_stats(); }
+
+  //Statistics of the cache of exp(-t H0) (number of hits, number of misses)
+  inline std::pair<unsigned long, unsigned long> get_exp_cache_stats() const { return exp_cache_.stats(); }
+  inline void reset_exp_cache_stats() { exp_cache_.reset_stats(); }
+
+  /**
+   * Adaptive truncation of high-energy states (model.truncation_weight_tolerance)
+   *
+   * state_contributions computes |sum_i bra(i,j) ket(j,i)| for each eigenstate j of the sector of ket (inner)
+   * and |sum_j bra(i,j) ket(j,i)| for each outer state i (outer) up to the factor bra.coeff()*ket.coeff().
+   * It returns false if the braket does not contribute to the trace.
+   *
+   * truncate_states throws away the highest-energy inner states of each sector and outer states of each braket
+   * as long as the sum of their weights does not exceed tolerance.
+   * Weights are given for each sector (inner) and each braket (outer). Outer states are not truncated if outer_weights is empty.
+   * The previous eigenbasis is kept until commit_truncation() or revert_truncation() is called.
+   * It returns false if no state is thrown away.
+   */
+  bool state_contributions(const BRAKET_T &bra, const BRAKET_T &ket,
+                           std::vector<double> &inner, std::vector<double> &outer) const;
+  bool truncate_states(const std::vector<std::vector<double> > &inner_weights,
+                       const std::vector<std::vector<double> > &outer_weights,
+                       double tolerance);
+  void commit_truncation();
+  void revert_truncation();
+
  private:
   void build_basis(const alps::params &par);
   void build_outer_braket(const alps::params &par);
+  //Model cache: eigenvalues, operators in the eigenbasis and sector connections (HDF5 file)
+  bool load_cache(const std::string &file, const std::string &key);
+  bool save_cache(const std::string &file, const std::string &key) const;
+  void init(const alps::params &par);
+  void disconnect_inactive_sectors();
   //for debug
   void check_evecs(const std::vector<dense_matrix_t> ham_sector, const std::vector<dense_matrix_t> &evecs_sector);
   bool is_sector_active(int sector) const;
   std::vector<std::vector<double> > eigenvals_sector;
   std::vector<double> min_eigenval_sector;
-  std::vector<std::vector<dense_matrix_t> > ddag_ops_eigen, d_ops_eigen;//flavor, sector
+  std::vector<std::vector<OperatorMatrix<SCALAR> > > ddag_ops_eigen, d_ops_eigen;//flavor, sector
+  bool loaded_from_cache_;
+
+  //Index of the dimension of each sector in SmallSectorKernels (-1 for sectors without fixed-size kernels)
+  std::vector<int> small_dim_index_;
+  void build_small_sector_table();
 
   int num_braket_;
   //equal to the number of active sectors
   std::vector<BRAKET_T> bra_list, ket_list;
+
+  bool outer_state_sampling_;
+  std::vector<std::pair<int, int> > outer_states_;//sector, index of eigenstate in the sector
+  int outer_state_;
+
+  //eigenbasis before truncate_states() (restored by revert_truncation())
+  struct TruncationBackup {
+    std::vector<std::vector<double> > eigenvals_sector;
+    std::vector<std::vector<OperatorMatrix<SCALAR> > > ddag_ops_eigen, d_ops_eigen;
+    std::vector<int> sector_connection, sector_connection_reverse;
+    std::vector<BRAKET_T> bra_list, ket_list;
+  };
+  boost::scoped_ptr<TruncationBackup> truncation_backup_;
+
+  //work space for applying operators on a bra/ket (one pool for each thread)
+  mutable PerThreadMatrixPool<dense_matrix_t> work_pool_;
+
+  //exp(-t H0) in the eigenbasis for recent values of t (one cache for each thread)
+  mutable PerThreadExpVectorCache exp_cache_;
+  //exp(-t H0) of a sector up to the factor coeff (work is used if the calling thread has no cache)
+  const ExpVectorCache::vector_t &exp_vector(int sector, double t, ExpVectorCache::vector_t &work, double &coeff) const;
 };
 
 template<typename SCALAR>
@@ -403,6 +556,75 @@ struct model_traits<ImpurityModelEigenBasis<SCALAR> > {
   typedef Braket<SCALAR, Eigen::Matrix<SCALAR, Eigen::Dynamic, Eigen::Dynamic> > BRAKET_T;
 };
 
+/**
+ * @brief Impurity model for Hilbert spaces too large for full diagonalization.
+ *
+ * The Hamiltonian is kept sparse in the occupation basis of each sector.
+ * A bra/ket is a few vectors in the occupation basis, and exp(-t H0) is applied with the Lanczos (Krylov subspace) method.
+ * The outer states are the lowest model.krylov.num_outer_states eigenstates of each sector
+ * (within model.outer_cutoff_energy), which are computed with a restarted Lanczos method with deflation.
+ * Sectors of dimension not larger than model.krylov.dim are diagonalized exactly.
+ */
+template<typename SCALAR>
+class ImpurityModelKrylov: public ImpurityModel<SCALAR, ImpurityModelKrylov<SCALAR> > {
+ private:
+  typedef ImpurityModel<SCALAR, ImpurityModelKrylov<SCALAR> > Base;
+  typedef typename Eigen::Matrix<SCALAR, Eigen::Dynamic, Eigen::Dynamic> dense_matrix_t;
+  typedef typename Eigen::Matrix<SCALAR, Eigen::Dynamic, 1> vector_t;
+  typedef typename Base::sparse_matrix_t sparse_matrix_t;
+
+ public:
+  typedef Braket<SCALAR, Eigen::Matrix<SCALAR, Eigen::Dynamic, Eigen::Dynamic> > BRAKET_T;
+  using typename Base::EXTENDED_SCALAR;
+
+  ImpurityModelKrylov(const alps::params &par, bool verbose = false);
+  ImpurityModelKrylov
+      (const alps::params &par, const std::vector<boost::tuple<int, int, SCALAR> > &nonzero_t_vals_list,
+       const std::vector<boost::tuple<int, int, int, int, SCALAR> > &nonzero_U_vals_list, bool verbose = false);
+  static void define_parameters(alps::params &parameters);
+
+  void apply_op_hyb_bra(const OPERATOR_TYPE &op_type, int flavor, BRAKET_T &bra) const;
+  void apply_op_hyb_ket(const OPERATOR_TYPE &op_type, int flavor, BRAKET_T &ket) const;
+  typename ExtendedScalar<SCALAR>::value_type product(const BRAKET_T &bra, const BRAKET_T &ket) const;
+
+  inline int dim_sector(int sector) const {
+    assert(sector >= 0 && sector < Base::num_sectors());
+    return Base::get_sector_members()[sector].size();
+  }
+  //Apply exp(-t H0) on a bra or a ket
+  void sector_propagate_bra(BRAKET_T &bra, double t) const;
+  void sector_propagate_ket(BRAKET_T &ket, double t) const;
+  typename model_traits<ImpurityModelKrylov<SCALAR> >::BRAKET_T get_outer_bra(int bra) const;
+  typename model_traits<ImpurityModelKrylov<SCALAR> >::BRAKET_T get_outer_ket(int ket) const;
+
+  inline double min_energy(int sector) const {
+    assert(sector >= 0 && sector < Base::num_sectors());
+    return min_eigenval_sector[sector];
+  }
+
+  inline int num_brakets() const {
+    return bra_list.size();
+  }
+
+  bool translationally_invariant() const;
+
+ private:
+  void build_outer_braket(const alps::params &par);
+  //exp(-t (H - E0)) v, where E0 is the lowest eigenenergy in the sector
+  void propagate_vector(int sector, double t, vector_t &v) const;
+
+  int krylov_dim_;
+  double krylov_tolerance_;
+  std::vector<double> min_eigenval_sector;//measured from the reference energy
+  std::vector<BRAKET_T> bra_list, ket_list;
+};
+
+template<typename SCALAR>
+struct model_traits<ImpurityModelKrylov<SCALAR> > {
+  typedef SCALAR SCALAR_T;
+  typedef Braket<SCALAR, Eigen::Matrix<SCALAR, Eigen::Dynamic, Eigen::Dynamic> > BRAKET_T;
+};
+
 //inline double compute_exp(double a) {
 //const double limit = std::log(std::numeric_limits<double>::min())/2;
 //if (a < limit) {
@@ -439,3 +661,5 @@ inline double compute_exp_vector_safe(const double tau,
 
 typedef ImpurityModelEigenBasis<double> REAL_EIGEN_BASIS_MODEL;
 typedef ImpurityModelEigenBasis<std::complex<double> > COMPLEX_EIGEN_BASIS_MODEL;
+typedef ImpurityModelKrylov<double> REAL_KRYLOV_MODEL;
+typedef ImpurityModelKrylov<std::complex<double> > COMPLEX_KRYLOV_MODEL;
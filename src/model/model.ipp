@@ -38,6 +38,14 @@ void ImpurityModel<SCALAR, DERIVED>::define_parameters(alps::params &parameters)
                       "Cutoff energy for inner states for computing trace (measured from the lowest eigenvalue)")
       .define<double>("model.outer_cutoff_energy", 0.1 * std::numeric_limits<double>::max(),
                       "Cutoff energy for outer states for computing trace (measured from the lowest eigenvalue)")
+      .define<int>("model.outer_state_sampling", 0,
+                   "Sample an outer state by Monte Carlo instead of summing over all outer states if a non-zero value is specified (bras/kets become vectors)")
+      .define<int>("model.n_threads", 0,
+                   "Number of OpenMP threads used for diagonalizing sectors and transforming operators at setup (0: the number given by OMP_NUM_THREADS if it is set, otherwise 1, so that MPI processes on the same node do not oversubscribe it)")
+      .define<std::string>("model.hamiltonian_assembly", "direct",
+                           "How to build the local Hamiltonian: \"direct\" (matrix elements computed from occupation bit strings) or \"operator_product\" (products of sparse fermionic operators)")
+      .define<std::string>("model.sector_enumeration", "clustering",
+                           "How to find symmetry sectors: \"clustering\" (clustering of all basis states connected by the Hamiltonian) or \"quantum_numbers\" (enumeration of basis states by conserved quantities detected from the U tensor and hopping matrix, followed by clustering inside each block)")
       .define<double>("model.cutoff_ham", 1E-12,
                       "Cutoff for entries in the local Hamiltonian matrix")
       .define<bool>("model.command_line_mode", false,
@@ -433,34 +441,275 @@ void ImpurityModel<SCALAR, DERIVED>::read_rotation_hybridization_function(const
   }
 }
 
-template<typename M, typename M2, typename P>
-void merge_according_to_c_or_cdag(const M &mat, M2 &block_mat, const P &p, P &p2) {
-  std::vector<int> rows;
+//Fermionic sign from the occupied flavors above a given flavor (same convention as FermionOperator)
+inline int fermion_sign_above(int state, int flavor) {
+  unsigned int above = static_cast<unsigned int>(state) >> (flavor + 1);
+#ifdef __GNUC__
+  const int count = __builtin_popcount(above);
+#else
+  int count = 0;
+  for (; above != 0; above &= above - 1) {
+    ++count;
+  }
+#endif
+  return count % 2 == 0 ? 1 : -1;
+}
+
+//Action of d_ops[flavor] on an occupation bit string: sets the bit (returns false if the result vanishes)
+inline bool apply_d_on_bits(int flavor, int &state, int &sign) {
+  if (state & (1 << flavor)) {
+    return false;
+  }
+  sign *= fermion_sign_above(state, flavor);
+  state |= (1 << flavor);
+  return true;
+}
+
+//Action of ddag_ops[flavor] on an occupation bit string: clears the bit (returns false if the result vanishes)
+inline bool apply_ddag_on_bits(int flavor, int &state, int &sign) {
+  if (!(state & (1 << flavor))) {
+    return false;
+  }
+  sign *= fermion_sign_above(state, flavor);
+  state ^= (1 << flavor);
+  return true;
+}
+
+template<typename T>
+struct CompareFirst {
+  bool operator()(const std::pair<int, T> &x, const std::pair<int, T> &y) const {
+    return x.first < y.first;
+  }
+};
+
+/**
+ * Compute the non-zero elements of the Hamiltonian directly from occupation bit strings, column by column.
+ * The result is the same as the sum of uval * ddag_ops[f1] * ddag_ops[f2] * d_ops[f3] * d_ops[f4]
+ * and t * ddag_ops[f1] * d_ops[f2] built with FermionOperator, but no operator products are formed.
+ * Elements whose absolute values are not larger than eps are dropped.
+ */
+template<typename SCALAR>
+void assemble_hamiltonian_direct(int flavors,
+                                 const std::vector<boost::tuple<int, int, int, int, SCALAR> > &U_vals,
+                                 const std::vector<boost::tuple<int, int, SCALAR> > &t_vals,
+                                 double eps,
+                                 std::vector<Eigen::Triplet<SCALAR> > &elements) {
+  const int dim = 1 << flavors;
+  std::vector<std::pair<int, SCALAR> > column;
+  elements.resize(0);
+  for (int src_state = 0; src_state < dim; ++src_state) {
+    column.resize(0);
+    for (int elem = 0; elem < U_vals.size(); ++elem) {
+      int state = src_state, sign = 1;
+      if (apply_d_on_bits(boost::get<3>(U_vals[elem]), state, sign) &&
+          apply_d_on_bits(boost::get<2>(U_vals[elem]), state, sign) &&
+          apply_ddag_on_bits(boost::get<1>(U_vals[elem]), state, sign) &&
+          apply_ddag_on_bits(boost::get<0>(U_vals[elem]), state, sign)) {
+        column.push_back(std::make_pair(state, static_cast<SCALAR>(sign) * boost::get<4>(U_vals[elem])));
+      }
+    }
+    for (int elem = 0; elem < t_vals.size(); ++elem) {
+      int state = src_state, sign = 1;
+      if (apply_d_on_bits(boost::get<1>(t_vals[elem]), state, sign) &&
+          apply_ddag_on_bits(boost::get<0>(t_vals[elem]), state, sign)) {
+        column.push_back(std::make_pair(state, static_cast<SCALAR>(sign) * boost::get<2>(t_vals[elem])));
+      }
+    }
+
+    //sum up contributions to the same element
+    std::stable_sort(column.begin(), column.end(), CompareFirst<SCALAR>());
+    for (int i = 0; i < column.size();) {
+      SCALAR sum = 0.0;
+      int j = i;
+      for (; j < column.size() && column[j].first == column[i].first; ++j) {
+        sum += column[j].second;
+      }
+      if (std::abs(sum) > eps) {
+        elements.push_back(Eigen::Triplet<SCALAR>(column[i].first, src_state, sum));
+      }
+      i = j;
+    }
+  }
+}
+
+//64-bit FNV-1a hash of a byte sequence
+class Fnv1aHash {
+ public:
+  Fnv1aHash() : hash_(14695981039346656037ULL) { }
 
-  const int n_c = p.get_num_clusters();
-  block_mat.resize(n_c, n_c);
-  block_mat.setZero();
+  void add_bytes(const void *p, std::size_t size) {
+    const unsigned char *bytes = static_cast<const unsigned char *>(p);
+    for (std::size_t i = 0; i < size; ++i) {
+      hash_ ^= bytes[i];
+      hash_ *= 1099511628211ULL;
+    }
+  }
+
+  template<typename T>
+  void add(const T &x) {
+    add_bytes(&x, sizeof(T));
+  }
 
-  const std::vector<int> &c_labels = p.get_cluster_labels();
+  void add(const std::string &str) {
+    add(str.size());
+    add_bytes(str.data(), str.size());
+  }
+
+  std::string str() const {
+    return (boost::format("%016x") % hash_).str();
+  }
 
+ private:
+  boost::uint64_t hash_;
+};
+
+//Blocks (clusters) connected to the same block by an operator belong to the same sector.
+//For each destination block, all source blocks are connected to the first one found.
+template<typename M, typename P>
+void merge_according_to_c_or_cdag(const M &mat, const std::vector<int> &c_labels, int n_c, P &p2) {
+  std::vector<int> first_src(n_c, -1);
   for (int k = 0; k < mat.outerSize(); ++k) {
     for (typename M::InnerIterator it(mat, k); it; ++it) {
-      block_mat(c_labels[it.row()], c_labels[it.col()]) += 1.0;
+      const int dst = c_labels[it.row()];
+      const int src = c_labels[it.col()];
+      if (first_src[dst] < 0) {
+        first_src[dst] = src;
+      } else {
+        p2.connect_vertices(first_src[dst], src);
+      }
     }
   }
+}
+
+//Find quantities Q = sum_f q_f n_f commuting with the Hamiltonian among the total particle number,
+//S_z (for both orderings of flavors, site-major and spin-major) and the occupation of each flavor.
+//Q is conserved if q_f1 + q_f2 = q_f3 + q_f4 for all U terms and q_f1 = q_f2 for all hopping terms.
+template<typename SCALAR>
+void detect_conserved_quantities(int sites, int spins,
+                                 const std::vector<boost::tuple<int, int, int, int, SCALAR> > &U_vals,
+                                 const std::vector<boost::tuple<int, int, SCALAR> > &t_vals,
+                                 std::vector<std::string> &names,
+                                 std::vector<std::vector<int> > &charges) {
+  const int flavors = sites * spins;
+  std::vector<std::string> candidate_names;
+  std::vector<std::vector<int> > candidates;
 
-  //search along each row
-  for (int i = 0; i < n_c; ++i) {
-    rows.resize(0);
-    for (int j = 0; j < n_c; ++j) {
-      if (block_mat(i, j) != 0.0) {
-        rows.push_back(j);
+  candidate_names.push_back("N");
+  candidates.push_back(std::vector<int>(flavors, 1));
+  if (spins == 2) {
+    std::vector<int> q_site_major(flavors), q_spin_major(flavors);
+    for (int site = 0; site < sites; ++site) {
+      for (int spin = 0; spin < 2; ++spin) {
+        q_site_major[2 * site + spin] = 1 - 2 * spin;
+        q_spin_major[site + spin * sites] = 1 - 2 * spin;
       }
     }
-    for (int row_idx = 1; row_idx < rows.size(); ++row_idx) {
-      p2.connect_vertices(rows[0], rows[row_idx]);
+    candidate_names.push_back("Sz");
+    candidates.push_back(q_site_major);
+    candidate_names.push_back("Sz");
+    candidates.push_back(q_spin_major);
+  }
+  for (int flavor = 0; flavor < flavors; ++flavor) {
+    std::vector<int> q(flavors, 0);
+    q[flavor] = 1;
+    candidate_names.push_back("n_" + boost::lexical_cast<std::string>(flavor));
+    candidates.push_back(q);
+  }
+
+  names.resize(0);
+  charges.resize(0);
+  for (int c = 0; c < candidates.size(); ++c) {
+    const std::vector<int> &q = candidates[c];
+    bool conserved = std::find(charges.begin(), charges.end(), q) == charges.end();
+    for (int elem = 0; elem < U_vals.size() && conserved; ++elem) {
+      conserved = q[boost::get<0>(U_vals[elem])] + q[boost::get<1>(U_vals[elem])]
+          == q[boost::get<2>(U_vals[elem])] + q[boost::get<3>(U_vals[elem])];
+    }
+    for (int elem = 0; elem < t_vals.size() && conserved; ++elem) {
+      conserved = q[boost::get<0>(t_vals[elem])] == q[boost::get<1>(t_vals[elem])];
+    }
+    if (conserved) {
+      names.push_back(candidate_names[c]);
+      charges.push_back(q);
+    }
+  }
+}
+
+inline std::vector<int> quantum_numbers_of_state(int state, const std::vector<std::vector<int> > &charges) {
+  std::vector<int> key(charges.size(), 0);
+  for (int q = 0; q < charges.size(); ++q) {
+    for (int flavor = 0; flavor < charges[q].size(); ++flavor) {
+      if ((state >> flavor) & 1) {
+        key[q] += charges[q][flavor];
+      }
+    }
+  }
+  return key;
+}
+
+//Enumerate basis states block by block of conserved quantities (states with N particles are generated
+//in ascending order by Gosper's hack) and find clusters connected by the Hamiltonian inside each block.
+//No clustering over the whole Hilbert space is needed.
+//Returns the number of clusters. Clusters are labeled block by block.
+template<typename SCALAR>
+int partition_by_quantum_numbers(int flavors,
+                                 const std::vector<std::vector<int> > &charges,
+                                 const std::vector<Eigen::Triplet<SCALAR> > &ham_elements,
+                                 std::vector<int> &cluster_of_state) {
+  typedef std::map<std::vector<int>, std::vector<int> > block_map_t;
+  const int dim = 1 << flavors;
+
+  block_map_t blocks;
+  for (int N = 0; N <= flavors; ++N) {
+    if (N == 0) {
+      blocks[quantum_numbers_of_state(0, charges)].push_back(0);
+      continue;
+    }
+    for (int state = (1 << N) - 1; state < dim;) {
+      blocks[quantum_numbers_of_state(state, charges)].push_back(state);
+      const int lowest = state & -state;
+      const int ripple = state + lowest;
+      state = (((ripple ^ state) >> 2) / lowest) | ripple;
+    }
+  }
+
+  std::vector<const std::vector<int> *> block_states;
+  std::map<std::vector<int>, int> block_index;
+  for (typename block_map_t::const_iterator it = blocks.begin(); it != blocks.end(); ++it) {
+    block_index[it->first] = block_states.size();
+    block_states.push_back(&(it->second));
+  }
+  const int num_blocks = block_states.size();
+
+  std::vector<Clustering> cl_blocks;
+  cl_blocks.reserve(num_blocks);
+  for (int b = 0; b < num_blocks; ++b) {
+    cl_blocks.push_back(Clustering(block_states[b]->size()));
+  }
+  for (int elem = 0; elem < ham_elements.size(); ++elem) {
+    const int dst_state = ham_elements[elem].row();
+    const int src_state = ham_elements[elem].col();
+    const std::vector<int> key = quantum_numbers_of_state(src_state, charges);
+    if (key != quantum_numbers_of_state(dst_state, charges)) {
+      throw std::logic_error("The Hamiltonian connects different blocks of conserved quantities.");
+    }
+    const std::vector<int> &states = *block_states[block_index[key]];
+    cl_blocks[block_index[key]].connect_vertices(
+        std::lower_bound(states.begin(), states.end(), dst_state) - states.begin(),
+        std::lower_bound(states.begin(), states.end(), src_state) - states.begin());
+  }
+
+  cluster_of_state.resize(dim);
+  int offset = 0;
+  for (int b = 0; b < num_blocks; ++b) {
+    cl_blocks[b].finalize_labeling();
+    const std::vector<int> &states = *block_states[b];
+    for (int i = 0; i < states.size(); ++i) {
+      cluster_of_state[states[i]] = offset + cl_blocks[b].get_cluster_label(i);
     }
+    offset += cl_blocks[b].get_num_clusters();
   }
+  return offset;
 }
 
 template<typename T, typename IT>
@@ -505,36 +754,49 @@ split_op_into_sectors(int num_sectors,
   }
 }
 
+template<typename SCALAR, typename DERIVED>
+std::string ImpurityModel<SCALAR, DERIVED>::input_hash(const alps::params &par) const {
+  Fnv1aHash hash;
+  hash.add(sizeof(SCALAR));
+  hash.add(sites_);
+  hash.add(spins_);
+  hash.add(nonzero_U_vals.size());
+  for (int elem = 0; elem < nonzero_U_vals.size(); ++elem) {
+    hash.add(boost::get<0>(nonzero_U_vals[elem]));
+    hash.add(boost::get<1>(nonzero_U_vals[elem]));
+    hash.add(boost::get<2>(nonzero_U_vals[elem]));
+    hash.add(boost::get<3>(nonzero_U_vals[elem]));
+    hash.add(boost::get<4>(nonzero_U_vals[elem]));
+  }
+  hash.add(nonzero_t_vals.size());
+  for (int elem = 0; elem < nonzero_t_vals.size(); ++elem) {
+    hash.add(boost::get<0>(nonzero_t_vals[elem]));
+    hash.add(boost::get<1>(nonzero_t_vals[elem]));
+    hash.add(boost::get<2>(nonzero_t_vals[elem]));
+  }
+  for (int j = 0; j < rotmat_Delta.cols(); ++j) {
+    for (int i = 0; i < rotmat_Delta.rows(); ++i) {
+      hash.add(rotmat_Delta(i, j));
+    }
+  }
+  hash.add(par["model.inner_outer_cutoff_energy"].template as<double>());
+  hash.add(par["model.outer_cutoff_energy"].template as<double>());
+  hash.add(par["model.cutoff_ham"].template as<double>());
+  hash.add(par["model.sector_enumeration"].template as<std::string>());
+  hash.add(num_sectors_);
+  for (int sector = 0; sector < num_sectors_; ++sector) {
+    hash.add(dim_sectors[sector]);
+  }
+  return hash.str();
+}
+
 template<typename SCALAR, typename DERIVED>
 void ImpurityModel<SCALAR, DERIVED>::hilbert_space_partioning(const alps::params &par) {
   const double eps_numerics = 1E-12;
   const double eps = par["model.cutoff_ham"];
 
   //Compute U tensor in the rotated basis
-  //very naive implementation. One might vectorize the code and use the cache...
-  matrix_t rotmat_Delta_trans = rotmat_Delta.transpose();
-  std::fill(U_tensor_rot.origin(), U_tensor_rot.origin() + U_tensor_rot.num_elements(), 0.0);
-  for (int elem = 0; elem < nonzero_U_vals.size(); ++elem) {
-    const int a = boost::get<0>(nonzero_U_vals[elem]);
-    const int b = boost::get<1>(nonzero_U_vals[elem]);
-    const int ap = boost::get<2>(nonzero_U_vals[elem]);
-    const int bp = boost::get<3>(nonzero_U_vals[elem]);
-    const SCALAR uval = boost::get<4>(nonzero_U_vals[elem]);
-
-    for (int flavor0 = 0; flavor0 < flavors_; ++flavor0) {
-      for (int flavor1 = 0; flavor1 < flavors_; ++flavor1) {
-        for (int flavor2 = 0; flavor2 < flavors_; ++flavor2) {
-          for (int flavor3 = 0; flavor3 < flavors_; ++flavor3) {
-            U_tensor_rot[flavor0][flavor1][flavor2][flavor3] +=
-                uval * myconj(rotmat_Delta_trans(flavor0, a)) *
-                    myconj(rotmat_Delta_trans(flavor1, b)) *
-                    rotmat_Delta_trans(flavor2, ap) *
-                    rotmat_Delta_trans(flavor3, bp);
-          }
-        }
-      }
-    }
-  }
+  rotate_U_tensor(flavors_, nonzero_U_vals, rotmat_Delta, U_tensor_rot);
 
   //Compute hopping matrix in the rotated basis
   matrix_t hopping_org_basis(flavors_, flavors_);
@@ -564,50 +826,96 @@ void ImpurityModel<SCALAR, DERIVED>::hilbert_space_partioning(const alps::params
     }
   }
 
-  //Build sparse matrix representation of Hamiltonian
-  sparse_matrix_t ham(dim_, dim_);
+  //Non-zero elements of the U tensor and hopping matrix in the rotated basis
+  std::vector<boost::tuple<int, int, int, int, SCALAR> > U_vals;
   for (int flavor1 = 0; flavor1 < flavors_; ++flavor1) {
     for (int flavor2 = 0; flavor2 < flavors_; ++flavor2) {
       for (int flavor3 = 0; flavor3 < flavors_; ++flavor3) {
         for (int flavor4 = 0; flavor4 < flavors_; ++flavor4) {
           const SCALAR uval = U_tensor_rot[flavor1][flavor2][flavor3][flavor4];
           if (std::abs(uval) > eps_numerics) {
-            ham += uval * ddag_ops[flavor1] * ddag_ops[flavor2] * d_ops[flavor3] * d_ops[flavor4];
+            U_vals.push_back(boost::make_tuple(flavor1, flavor2, flavor3, flavor4, uval));
           }
         }
       }
     }
   }
+  std::vector<boost::tuple<int, int, SCALAR> > t_vals;
   for (int flavor2 = 0; flavor2 < flavors_; ++flavor2) {
     for (int flavor1 = 0; flavor1 < flavors_; ++flavor1) {
       if (std::abs(hopping_rot(flavor1, flavor2)) > eps_numerics) {
-        ham += hopping_rot(flavor1, flavor2) * ddag_ops[flavor1] * d_ops[flavor2];
+        t_vals.push_back(boost::make_tuple(flavor1, flavor2, hopping_rot(flavor1, flavor2)));
       }
     }
   }
-  ham.prune(PruneHelper<SCALAR>(eps));
+
+  //Build sparse matrix representation of Hamiltonian (list of non-zero elements)
+  boost::timer::cpu_timer timer;
+  const std::string assembly = par["model.hamiltonian_assembly"].template as<std::string>();
+  std::vector<Eigen::Triplet<SCALAR> > ham_elements;
+  if (assembly == "direct") {
+    assemble_hamiltonian_direct(flavors_, U_vals, t_vals, eps, ham_elements);
+  } else if (assembly == "operator_product") {
+    sparse_matrix_t ham(dim_, dim_);
+    for (int elem = 0; elem < U_vals.size(); ++elem) {
+      ham += boost::get<4>(U_vals[elem]) * ddag_ops[boost::get<0>(U_vals[elem])] * ddag_ops[boost::get<1>(U_vals[elem])]
+          * d_ops[boost::get<2>(U_vals[elem])] * d_ops[boost::get<3>(U_vals[elem])];
+    }
+    for (int elem = 0; elem < t_vals.size(); ++elem) {
+      ham += boost::get<2>(t_vals[elem]) * ddag_ops[boost::get<0>(t_vals[elem])] * d_ops[boost::get<1>(t_vals[elem])];
+    }
+    ham.prune(PruneHelper<SCALAR>(eps));
+    for (int k = 0; k < ham.outerSize(); ++k) {
+      for (typename sparse_matrix_t::InnerIterator it(ham, k); it; ++it) {
+        ham_elements.push_back(Eigen::Triplet<SCALAR>(it.row(), it.col(), it.value()));
+      }
+    }
+  } else {
+    throw std::runtime_error("Unknown model.hamiltonian_assembly: " + assembly);
+  }
+  if (verbose_) {
+    std::cout << "Hamiltonian assembly (" << assembly << "): " << timer.elapsed().wall * 1E-9 << " sec, "
+              << ham_elements.size() << " non-zero elements" << std::endl;
+  }
 
   //Partionining of Hilbert space according to symmetry
-  Clustering cl(dim_);
-  for (int k = 0; k < ham.outerSize(); ++k) {
-    for (typename Eigen::SparseMatrix<SCALAR>::InnerIterator it(ham, k); it; ++it) {
-      cl.connect_vertices(it.row(), it.col());
+  const std::string enumeration = par["model.sector_enumeration"].template as<std::string>();
+  std::vector<int> cluster_of_state;
+  int num_clusters;
+  if (enumeration == "clustering") {
+    Clustering cl(dim_);
+    for (int elem = 0; elem < ham_elements.size(); ++elem) {
+      cl.connect_vertices(ham_elements[elem].row(), ham_elements[elem].col());
+    }
+    cl.finalize_labeling();
+    cluster_of_state = cl.get_cluster_labels();
+    num_clusters = cl.get_num_clusters();
+  } else if (enumeration == "quantum_numbers") {
+    std::vector<std::string> names;
+    std::vector<std::vector<int> > charges;
+    detect_conserved_quantities(sites_, spins_, U_vals, t_vals, names, charges);
+    if (verbose_) {
+      std::cout << "Conserved quantities:";
+      for (int q = 0; q < names.size(); ++q) {
+        std::cout << " " << names[q];
+      }
+      std::cout << std::endl;
     }
+    num_clusters = partition_by_quantum_numbers(flavors_, charges, ham_elements, cluster_of_state);
+  } else {
+    throw std::runtime_error("Unknown model.sector_enumeration: " + enumeration);
   }
-  cl.finalize_labeling();
 
   if (verbose_) {
     std::cout << "dim of Hilbert space " << dim_ << std::endl;
-    std::cout << "# of blocks " << cl.get_num_clusters() << std::endl;
+    std::cout << "# of blocks " << num_clusters << std::endl;
   }
 
   //Merge some blocks according to creation and annihilation operators
-  Clustering cl2(cl.get_num_clusters());
-  const int num_c = cl.get_num_clusters();
-  real_matrix_t block_mat(num_c, num_c);
+  Clustering cl2(num_clusters);
   for (int flavor = 0; flavor < flavors_; ++flavor) {
-    merge_according_to_c_or_cdag(ddag_ops[flavor], block_mat, cl, cl2);
-    merge_according_to_c_or_cdag(d_ops[flavor], block_mat, cl, cl2);
+    merge_according_to_c_or_cdag(ddag_ops[flavor], cluster_of_state, num_clusters, cl2);
+    merge_according_to_c_or_cdag(d_ops[flavor], cluster_of_state, num_clusters, cl2);
   }
   cl2.finalize_labeling();
 
@@ -621,7 +929,7 @@ void ImpurityModel<SCALAR, DERIVED>::hilbert_space_partioning(const alps::params
   sector_of_state.resize(dim_);
   index_of_state_in_sector.resize(dim_);
   for (int state = 0; state < dim_; ++state) {
-    int sector_tmp = cl2.get_cluster_label(cl.get_cluster_label(state));
+    int sector_tmp = cl2.get_cluster_label(cluster_of_state[state]);
     assert(sector_tmp < num_sectors_);
     index_of_state_in_sector[state] = sector_members[sector_tmp].size();
     sector_of_state[state] = sector_tmp;
@@ -632,27 +940,24 @@ void ImpurityModel<SCALAR, DERIVED>::hilbert_space_partioning(const alps::params
     dim_sectors[sector] = sector_members[sector].size();
   }
 
-#ifndef NDEBUG
-  for (int k = 0; k < ham.outerSize(); ++k) {
-    for (typename Eigen::SparseMatrix<SCALAR>::InnerIterator it(ham, k); it; ++it) {
-      const int dst_state = it.row();
-      const int src_state = it.col();
+  //divide Hamiltonian by sector (the elements are written directly into each sector)
+  ham_sectors.resize(num_sectors_);
+  {
+    std::vector<std::vector<Eigen::Triplet<SCALAR> > > ham_elements_sectors(num_sectors_);
+    for (int elem = 0; elem < ham_elements.size(); ++elem) {
+      const int dst_state = ham_elements[elem].row();
+      const int src_state = ham_elements[elem].col();
       assert(sector_of_state[src_state] == sector_of_state[dst_state]);
+      ham_elements_sectors[sector_of_state[src_state]].push_back(
+          Eigen::Triplet<SCALAR>(index_of_state_in_sector[dst_state], index_of_state_in_sector[src_state],
+                                 ham_elements[elem].value()));
+    }
+    std::vector<Eigen::Triplet<SCALAR> >().swap(ham_elements);
+    for (int sector = 0; sector < num_sectors_; ++sector) {
+      ham_sectors[sector].resize(dim_sectors[sector], dim_sectors[sector]);
+      ham_sectors[sector].setFromTriplets(ham_elements_sectors[sector].begin(), ham_elements_sectors[sector].end());
     }
   }
-#endif
-
-  //divide Hamiltonin by sector
-  ham_sectors.resize(num_sectors_);
-  std::vector<int> dummy(num_sectors_);
-  split_op_into_sectors(num_sectors_,
-                        ham,
-                        dim_sectors,
-                        index_of_state_in_sector,
-                        sector_of_state,
-                        dummy.begin(),
-                        ham_sectors,
-                        true);
 
   //identify which sectors are connected by a creation/annihilation operator
   sector_connection.resize(boost::extents[2][flavors_][num_sectors_]);
@@ -4,6 +4,7 @@
 #include "model.hpp"
 #include "model.ipp"
 #include "eigenbasis.ipp"
+#include "krylov.ipp"
 
 /**
  * Complex-number version
@@ -18,3 +19,13 @@ template void ImpurityModel<std::complex<double>, ImpurityModelEigenBasis<std::c
 template void ImpurityModel<std::complex<double>, ImpurityModelEigenBasis<std::complex<double> > >::apply_op_ket<1>
     (const EqualTimeOperator<1> &op,
      ImpurityModelEigenBasis<std::complex<double> >::BRAKET_T &ket) const;
+template
+class ImpurityModel<std::complex<double>, ImpurityModelKrylov<std::complex<double> > >;
+template
+class ImpurityModelKrylov<std::complex<double> >;
+template void ImpurityModel<std::complex<double>, ImpurityModelKrylov<std::complex<double> > >::apply_op_bra<1>
+    (const EqualTimeOperator<1> &op,
+     ImpurityModelKrylov<std::complex<double> >::BRAKET_T &bra) const;
+template void ImpurityModel<std::complex<double>, ImpurityModelKrylov<std::complex<double> > >::apply_op_ket<1>
+    (const EqualTimeOperator<1> &op,
+     ImpurityModelKrylov<std::complex<double> >::BRAKET_T &ket) const;
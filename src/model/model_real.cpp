@@ -4,6 +4,7 @@
 #include "model.hpp"
 #include "model.ipp"
 #include "eigenbasis.ipp"
+#include "krylov.ipp"
 
 /**
  * Real-number version
@@ -18,3 +19,13 @@ template void ImpurityModel<double, ImpurityModelEigenBasis<double> >::apply_op_
 template void ImpurityModel<double, ImpurityModelEigenBasis<double> >::apply_op_ket<1>(const EqualTimeOperator<1> &op,
                                                                                        ImpurityModelEigenBasis<double>::BRAKET_T &ket)
     const;
+template
+class ImpurityModel<double, ImpurityModelKrylov<double> >;
+template
+class ImpurityModelKrylov<double>;
+template void ImpurityModel<double, ImpurityModelKrylov<double> >::apply_op_bra<1>(const EqualTimeOperator<1> &op,
+                                                                                   ImpurityModelKrylov<double>::BRAKET_T &bra)
+    const;
+template void ImpurityModel<double, ImpurityModelKrylov<double> >::apply_op_ket<1>(const EqualTimeOperator<1> &op,
+                                                                                   ImpurityModelKrylov<double>::BRAKET_T &ket)
+    const;
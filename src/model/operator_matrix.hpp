@@ -0,0 +1,314 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cassert>
+
+#include <Eigen/Dense>
+#include <Eigen/Sparse>
+
+#include "clustering.hpp"
+#include "matrix_pool.hpp"
+
+enum OPERATOR_MATRIX_FORMAT {
+  DENSE_FORMAT = 0,
+  CSR_FORMAT = 1, //compressed sparse row
+  BLOCK_FORMAT = 2, //dense blocks (not necessarily contiguous rows/columns) connected by non-zero elements
+};
+
+/**
+ * @brief Matrix representation of a creation/annihilation operator between two sectors in the eigenbasis
+ *
+ * Depending on the density of the matrix, the operator is stored as a dense matrix, in the CSR format,
+ * or as a set of dense blocks, whichever has the lowest estimated cost of applying it to a bra/ket.
+ * Blocks appear when the eigenbasis respects conserved quantities not used for the sector partitioning.
+ * Elements smaller than 1E-12 times the largest element are dropped in the sparse formats.
+ */
+template<typename SCALAR>
+class OperatorMatrix {
+ public:
+  typedef Eigen::Matrix<SCALAR, Eigen::Dynamic, Eigen::Dynamic> dense_matrix_t;
+  typedef Eigen::SparseMatrix<SCALAR, Eigen::RowMajor> csr_matrix_t;
+
+  OperatorMatrix() : format_(DENSE_FORMAT), rows_(0), cols_(0), max_block_rows_(0), max_block_cols_(0) { }
+
+  //Store mat in the cheapest format (or in the format given)
+  void set(const dense_matrix_t &mat, bool choose_format = true, OPERATOR_MATRIX_FORMAT format = DENSE_FORMAT);
+
+  inline int rows() const { return rows_; }
+  inline int cols() const { return cols_; }
+  inline OPERATOR_MATRIX_FORMAT format() const { return format_; }
+
+  //Valid only in the dense format
+  inline const dense_matrix_t &dense_matrix() const { assert(format_ == DENSE_FORMAT); return dense_; }
+
+  //Memory used for storing the matrix elements and indices (in bytes)
+  std::size_t memory_bytes() const;
+
+  //Stored elements (all elements in the dense format), e.g., for saving the matrix into a file
+  void get_elements(std::vector<int> &row_index, std::vector<int> &col_index, std::vector<SCALAR> &values) const;
+
+  //Restore a matrix from the elements returned by get_elements() (the remaining elements are zero)
+  void set_elements(int rows, int cols, const std::vector<int> &row_index, const std::vector<int> &col_index,
+                    const std::vector<SCALAR> &values, OPERATOR_MATRIX_FORMAT format);
+
+  //y = op * x. y must be resized to rows() x x.cols() and must not alias x.
+  //Work space for the block format is taken from p_pool if given.
+  void apply_ket(const dense_matrix_t &x, dense_matrix_t &y, MatrixPool<dense_matrix_t> *p_pool = NULL) const;
+
+  //y = x * op. y must be resized to x.rows() x cols() and must not alias x.
+  //Work space for the block format is taken from p_pool if given.
+  void apply_bra(const dense_matrix_t &x, dense_matrix_t &y, MatrixPool<dense_matrix_t> *p_pool = NULL) const;
+
+ private:
+  struct Block {
+    std::vector<int> rows, cols;
+    dense_matrix_t mat;
+  };
+
+  OPERATOR_MATRIX_FORMAT format_;
+  int rows_, cols_;
+  dense_matrix_t dense_;
+  csr_matrix_t csr_;
+  std::vector<Block> blocks_;
+  int max_block_rows_, max_block_cols_;
+
+  //Work space large enough for every block
+  static void acquire_work(MatrixPool<dense_matrix_t> *p_pool, int rows, int cols, dense_matrix_t &mat) {
+    if (p_pool) {
+      p_pool->acquire(rows, cols, mat);
+    } else {
+      mat.resize(rows, cols);
+    }
+  }
+  static void release_work(MatrixPool<dense_matrix_t> *p_pool, dense_matrix_t &mat) {
+    if (p_pool) {
+      p_pool->release(mat);
+    }
+  }
+};
+
+template<typename SCALAR>
+void OperatorMatrix<SCALAR>::set(const dense_matrix_t &mat, bool choose_format, OPERATOR_MATRIX_FORMAT format) {
+  rows_ = mat.rows();
+  cols_ = mat.cols();
+  dense_.resize(0, 0);
+  csr_.resize(0, 0);
+  blocks_.resize(0);
+  max_block_rows_ = max_block_cols_ = 0;
+  format_ = DENSE_FORMAT;
+  if (rows_ == 0 || cols_ == 0) {
+    return;
+  }
+
+  const double cutoff = 1E-12 * mat.cwiseAbs().maxCoeff();
+
+  //Non-zero elements connect rows (vertices 0, ..., rows-1) and columns (vertices rows, ..., rows+cols-1)
+  Clustering cl(rows_ + cols_);
+  long nnz = 0;
+  for (int j = 0; j < cols_; ++j) {
+    for (int i = 0; i < rows_; ++i) {
+      if (std::abs(mat(i, j)) > cutoff) {
+        cl.connect_vertices(i, rows_ + j);
+        ++nnz;
+      }
+    }
+  }
+  cl.finalize_labeling();
+
+  long block_cost = rows_ + cols_;//gather/scatter
+  int num_blocks = 0;
+  for (int c = 0; c < cl.get_num_clusters(); ++c) {
+    const std::vector<int> &members = cl.get_cluster_members()[c];
+    //members are sorted in ascending order: rows come first
+    const long num_rows = std::lower_bound(members.begin(), members.end(), rows_) - members.begin();
+    const long num_cols = members.size() - num_rows;
+    if (num_rows > 0 && num_cols > 0) {
+      block_cost += num_rows * num_cols + 10;//overhead of a call to a dense kernel
+      ++num_blocks;
+    }
+  }
+
+  //Estimated costs of applying the operator to a single vector.
+  //Indirect access in the CSR format is assumed to be three times more expensive than dense arithmetic.
+  if (choose_format) {
+    const long dense_cost = static_cast<long>(rows_) * cols_;
+    const long csr_cost = 3 * nnz + rows_;
+    format = DENSE_FORMAT;
+    if (csr_cost < dense_cost && csr_cost <= block_cost) {
+      format = CSR_FORMAT;
+    } else if (num_blocks > 1 && block_cost < dense_cost) {
+      format = BLOCK_FORMAT;
+    }
+  }
+  format_ = format;
+
+  if (format_ == DENSE_FORMAT) {
+    dense_ = mat;
+  } else if (format_ == CSR_FORMAT) {
+    std::vector<Eigen::Triplet<SCALAR> > elements;
+    elements.reserve(nnz);
+    for (int j = 0; j < cols_; ++j) {
+      for (int i = 0; i < rows_; ++i) {
+        if (std::abs(mat(i, j)) > cutoff) {
+          elements.push_back(Eigen::Triplet<SCALAR>(i, j, mat(i, j)));
+        }
+      }
+    }
+    csr_.resize(rows_, cols_);
+    csr_.setFromTriplets(elements.begin(), elements.end());
+    csr_.makeCompressed();
+  } else {
+    for (int c = 0; c < cl.get_num_clusters(); ++c) {
+      const std::vector<int> &members = cl.get_cluster_members()[c];
+      Block block;
+      for (int m = 0; m < members.size(); ++m) {
+        if (members[m] < rows_) {
+          block.rows.push_back(members[m]);
+        } else {
+          block.cols.push_back(members[m] - rows_);
+        }
+      }
+      if (block.rows.size() == 0 || block.cols.size() == 0) {
+        continue;
+      }
+      block.mat.resize(block.rows.size(), block.cols.size());
+      for (int j = 0; j < block.cols.size(); ++j) {
+        for (int i = 0; i < block.rows.size(); ++i) {
+          block.mat(i, j) = mat(block.rows[i], block.cols[j]);
+        }
+      }
+      max_block_rows_ = std::max(max_block_rows_, static_cast<int>(block.rows.size()));
+      max_block_cols_ = std::max(max_block_cols_, static_cast<int>(block.cols.size()));
+      blocks_.push_back(block);
+    }
+  }
+}
+
+template<typename SCALAR>
+std::size_t OperatorMatrix<SCALAR>::memory_bytes() const {
+  switch (format_) {
+    case DENSE_FORMAT:
+      return dense_.size() * sizeof(SCALAR);
+    case CSR_FORMAT:
+      return csr_.nonZeros() * (sizeof(SCALAR) + sizeof(int)) + (rows_ + 1) * sizeof(int);
+    default: {
+      std::size_t r = 0;
+      for (int b = 0; b < blocks_.size(); ++b) {
+        r += blocks_[b].mat.size() * sizeof(SCALAR) + (blocks_[b].rows.size() + blocks_[b].cols.size()) * sizeof(int);
+      }
+      return r;
+    }
+  }
+}
+
+template<typename SCALAR>
+void OperatorMatrix<SCALAR>::get_elements(std::vector<int> &row_index,
+                                          std::vector<int> &col_index,
+                                          std::vector<SCALAR> &values) const {
+  row_index.resize(0);
+  col_index.resize(0);
+  values.resize(0);
+  if (format_ == DENSE_FORMAT) {
+    for (int j = 0; j < dense_.cols(); ++j) {
+      for (int i = 0; i < dense_.rows(); ++i) {
+        row_index.push_back(i);
+        col_index.push_back(j);
+        values.push_back(dense_(i, j));
+      }
+    }
+  } else if (format_ == CSR_FORMAT) {
+    for (int k = 0; k < csr_.outerSize(); ++k) {
+      for (typename csr_matrix_t::InnerIterator it(csr_, k); it; ++it) {
+        row_index.push_back(it.row());
+        col_index.push_back(it.col());
+        values.push_back(it.value());
+      }
+    }
+  } else {
+    for (int b = 0; b < blocks_.size(); ++b) {
+      const Block &block = blocks_[b];
+      for (int j = 0; j < block.cols.size(); ++j) {
+        for (int i = 0; i < block.rows.size(); ++i) {
+          row_index.push_back(block.rows[i]);
+          col_index.push_back(block.cols[j]);
+          values.push_back(block.mat(i, j));
+        }
+      }
+    }
+  }
+}
+
+template<typename SCALAR>
+void OperatorMatrix<SCALAR>::set_elements(int rows, int cols, const std::vector<int> &row_index,
+                                          const std::vector<int> &col_index, const std::vector<SCALAR> &values,
+                                          OPERATOR_MATRIX_FORMAT format) {
+  assert(row_index.size() == values.size() && col_index.size() == values.size());
+  dense_matrix_t mat(rows, cols);
+  mat.setZero();
+  for (int elem = 0; elem < values.size(); ++elem) {
+    mat(row_index[elem], col_index[elem]) = values[elem];
+  }
+  set(mat, false, format);
+}
+
+template<typename SCALAR>
+void OperatorMatrix<SCALAR>::apply_ket(const dense_matrix_t &x, dense_matrix_t &y,
+                                       MatrixPool<dense_matrix_t> *p_pool) const {
+  assert(x.rows() == cols_);
+  assert(y.rows() == rows_ && y.cols() == x.cols());
+  if (format_ == DENSE_FORMAT) {
+    y.noalias() = dense_ * x;
+  } else if (format_ == CSR_FORMAT) {
+    y.noalias() = csr_ * x;
+  } else {
+    y.setZero();
+    dense_matrix_t x_block, y_block;
+    acquire_work(p_pool, max_block_cols_, x.cols(), x_block);
+    acquire_work(p_pool, max_block_rows_, x.cols(), y_block);
+    for (int b = 0; b < blocks_.size(); ++b) {
+      const Block &block = blocks_[b];
+      const int num_rows = block.rows.size(), num_cols = block.cols.size();
+      for (int j = 0; j < num_cols; ++j) {
+        x_block.row(j) = x.row(block.cols[j]);
+      }
+      y_block.topRows(num_rows).noalias() = block.mat * x_block.topRows(num_cols);
+      for (int i = 0; i < num_rows; ++i) {
+        y.row(block.rows[i]) = y_block.row(i);
+      }
+    }
+    release_work(p_pool, x_block);
+    release_work(p_pool, y_block);
+  }
+}
+
+template<typename SCALAR>
+void OperatorMatrix<SCALAR>::apply_bra(const dense_matrix_t &x, dense_matrix_t &y,
+                                       MatrixPool<dense_matrix_t> *p_pool) const {
+  assert(x.cols() == rows_);
+  assert(y.rows() == x.rows() && y.cols() == cols_);
+  if (format_ == DENSE_FORMAT) {
+    y.noalias() = x * dense_;
+  } else if (format_ == CSR_FORMAT) {
+    y.noalias() = x * csr_;
+  } else {
+    y.setZero();
+    dense_matrix_t x_block, y_block;
+    acquire_work(p_pool, x.rows(), max_block_rows_, x_block);
+    acquire_work(p_pool, x.rows(), max_block_cols_, y_block);
+    for (int b = 0; b < blocks_.size(); ++b) {
+      const Block &block = blocks_[b];
+      const int num_rows = block.rows.size(), num_cols = block.cols.size();
+      for (int i = 0; i < num_rows; ++i) {
+        x_block.col(i) = x.col(block.rows[i]);
+      }
+      y_block.leftCols(num_cols).noalias() = x_block.leftCols(num_rows) * block.mat;
+      for (int j = 0; j < num_cols; ++j) {
+        y.col(block.cols[j]) = y_block.col(j);
+      }
+    }
+    release_work(p_pool, x_block);
+    release_work(p_pool, y_block);
+  }
+}
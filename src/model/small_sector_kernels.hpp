@@ -0,0 +1,125 @@
+#pragma once
+
+#include <Eigen/Dense>
+
+/**
+ * @brief Fixed-size kernels for small sectors
+ *
+ * For sectors whose dimension is one of SmallSectorKernels::dim(i), the loops over eigenstates are unrolled at compile time.
+ * Only the number of columns of a ket (rows of a bra) is a runtime value.
+ * The kernels work on storage allocated by the caller and do not allocate memory.
+ * Kernels are looked up in a table indexed by dim_index() of the sectors involved.
+ */
+template<typename SCALAR>
+class SmallSectorKernels {
+ public:
+  typedef Eigen::Matrix<SCALAR, Eigen::Dynamic, Eigen::Dynamic> dense_matrix_t;
+  typedef Eigen::Array<double, Eigen::Dynamic, 1> exp_vector_t;
+
+  //y = op * x for a ket or y = x * op for a bra. y must be resized by the caller.
+  typedef void (*apply_t)(const dense_matrix_t &op, const dense_matrix_t &x, dense_matrix_t &y);
+  //Scale the i-th row of a ket (the i-th column of a bra) by exp_v[i]
+  typedef void (*propagate_t)(const exp_vector_t &exp_v, dense_matrix_t &obj);
+
+  static const int num_dims = 7;
+
+  static int dim(int index) {
+    static const int dims[num_dims] = {1, 2, 3, 4, 6, 8, 16};
+    return dims[index];
+  }
+
+  //Index of a sector dimension in the list of fixed sizes (-1 if there is no fixed-size kernel)
+  static int dim_index(int dim_sector) {
+    for (int index = 0; index < num_dims; ++index) {
+      if (dim(index) == dim_sector) {
+        return index;
+      }
+    }
+    return -1;
+  }
+
+  //Kernels for an operator of dim(row_index) x dim(col_index)
+  static apply_t apply_ket(int row_index, int col_index) { return table().ket[row_index][col_index]; }
+  static apply_t apply_bra(int row_index, int col_index) { return table().bra[row_index][col_index]; }
+
+  //Kernels for a sector of dim(index)
+  static propagate_t propagate_ket(int index) { return table().propagate_ket[index]; }
+  static propagate_t propagate_bra(int index) { return table().propagate_bra[index]; }
+
+  //The table is built at the first call (call this once before using the kernels from multiple threads)
+  static void init() { table(); }
+
+ private:
+  struct Table {
+    apply_t ket[num_dims][num_dims], bra[num_dims][num_dims];
+    propagate_t propagate_ket[num_dims], propagate_bra[num_dims];
+
+    Table() {
+      fill_row<1>(0);
+      fill_row<2>(1);
+      fill_row<3>(2);
+      fill_row<4>(3);
+      fill_row<6>(4);
+      fill_row<8>(5);
+      fill_row<16>(6);
+    }
+
+    template<int R>
+    void fill_row(int row_index) {
+      fill<R, 1>(row_index, 0);
+      fill<R, 2>(row_index, 1);
+      fill<R, 3>(row_index, 2);
+      fill<R, 4>(row_index, 3);
+      fill<R, 6>(row_index, 4);
+      fill<R, 8>(row_index, 5);
+      fill<R, 16>(row_index, 6);
+      propagate_ket[row_index] = &SmallSectorKernels::template propagate_ket_fixed<R>;
+      propagate_bra[row_index] = &SmallSectorKernels::template propagate_bra_fixed<R>;
+    }
+
+    template<int R, int C>
+    void fill(int row_index, int col_index) {
+      ket[row_index][col_index] = &SmallSectorKernels::template apply_ket_fixed<R, C>;
+      bra[row_index][col_index] = &SmallSectorKernels::template apply_bra_fixed<R, C>;
+    }
+  };
+
+  static const Table &table() {
+    static const Table t;
+    return t;
+  }
+
+  template<int R, int C>
+  static void apply_ket_fixed(const dense_matrix_t &op, const dense_matrix_t &x, dense_matrix_t &y) {
+    assert(op.rows() == R && op.cols() == C && x.rows() == C);
+    const Eigen::Map<const Eigen::Matrix<SCALAR, R, C> > op_fixed(op.data());
+    const Eigen::Map<const Eigen::Matrix<SCALAR, C, Eigen::Dynamic> > x_fixed(x.data(), C, x.cols());
+    Eigen::Map<Eigen::Matrix<SCALAR, R, Eigen::Dynamic> > y_fixed(y.data(), R, x.cols());
+    y_fixed.noalias() = op_fixed.lazyProduct(x_fixed);
+  }
+
+  template<int R, int C>
+  static void apply_bra_fixed(const dense_matrix_t &op, const dense_matrix_t &x, dense_matrix_t &y) {
+    assert(op.rows() == R && op.cols() == C && x.cols() == R);
+    const Eigen::Map<const Eigen::Matrix<SCALAR, R, C> > op_fixed(op.data());
+    const Eigen::Map<const Eigen::Matrix<SCALAR, Eigen::Dynamic, R> > x_fixed(x.data(), x.rows(), R);
+    Eigen::Map<Eigen::Matrix<SCALAR, Eigen::Dynamic, C> > y_fixed(y.data(), x.rows(), C);
+    y_fixed.noalias() = x_fixed.lazyProduct(op_fixed);
+  }
+
+  template<int R>
+  static void propagate_ket_fixed(const exp_vector_t &exp_v, dense_matrix_t &obj) {
+    assert(exp_v.size() == R && obj.rows() == R);
+    const Eigen::Map<const Eigen::Array<double, R, 1> > exp_fixed(exp_v.data());
+    Eigen::Map<Eigen::Array<SCALAR, R, Eigen::Dynamic> > obj_fixed(obj.data(), R, obj.cols());
+    obj_fixed.colwise() *= exp_fixed.template cast<SCALAR>();
+  }
+
+  template<int R>
+  static void propagate_bra_fixed(const exp_vector_t &exp_v, dense_matrix_t &obj) {
+    assert(exp_v.size() == R && obj.cols() == R);
+    const Eigen::Map<const Eigen::Array<double, R, 1> > exp_fixed(exp_v.data());
+    Eigen::Map<Eigen::Array<SCALAR, Eigen::Dynamic, R> > obj_fixed(obj.data(), obj.rows(), R);
+    obj_fixed.rowwise() *= exp_fixed.transpose().template cast<SCALAR>();
+  }
+};
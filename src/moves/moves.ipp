@@ -876,6 +876,7 @@ global_update(R &rng,
         operator_pairs.begin(),
         operator_pairs.end()
     );
+    M_new.set_max_delayed_rank(mc_config.M.max_delayed_rank());
 
     mc_config.trace = trace_new;
     std::swap(mc_config.operators, operators_new);
@@ -0,0 +1,185 @@
+//
+// Real scalar type represented by a double mantissa and a 64-bit binary exponent.
+// This has the precision of double but (practically) does not overflow/underflow.
+// Activated by USE_SCALED_DOUBLE (see wide_scalar.hpp).
+//
+
+#pragma once
+
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <iostream>
+
+#include <boost/cstdint.hpp>
+#include <boost/math/special_functions/fpclassify.hpp>
+
+class scaled_double {
+ public:
+  typedef boost::int64_t exponent_type;
+
+  scaled_double() : m_(0.0), e_(0) { };
+  scaled_double(double x) : m_(x), e_(0) { normalize(); };
+  scaled_double(double mantissa, exponent_type exponent) : m_(mantissa), e_(exponent) { normalize(); };
+
+  //value = mantissa * 2^exponent, 0.5 <= |mantissa| < 1 (mantissa = 0 for zero)
+  inline double mantissa() const { return m_; }
+  inline exponent_type exponent() const { return e_; }
+
+  template<typename S>
+  S convert_to() const {
+    //ldexp saturates to inf/0 long before the exponent overflows int.
+    return static_cast<S>(std::ldexp(m_, static_cast<int>(std::max<exponent_type>(std::min<exponent_type>(e_, 4096), -4096))));
+  }
+
+  scaled_double operator-() const {
+    scaled_double r(*this);
+    r.m_ = -r.m_;
+    return r;
+  }
+
+  scaled_double &operator*=(const scaled_double &x) {
+    m_ *= x.m_;
+    e_ += x.e_;
+    //|m_| is in [0.25, 1) if both are normalized and non-zero
+    if (std::abs(m_) < 0.5) {
+      normalize();
+    }
+    return *this;
+  }
+
+  scaled_double &operator/=(const scaled_double &x) {
+    m_ /= x.m_;
+    e_ -= x.e_;
+    normalize();
+    return *this;
+  }
+
+  scaled_double &operator+=(const scaled_double &x) {
+    if (x.m_ == 0.0) {
+      return *this;
+    }
+    if (m_ == 0.0) {
+      return *this = x;
+    }
+    if (e_ >= x.e_) {
+      m_ += shifted_mantissa(x, e_ - x.e_);
+    } else {
+      m_ = x.m_ + shifted_mantissa(*this, x.e_ - e_);
+      e_ = x.e_;
+    }
+    normalize();
+    return *this;
+  }
+
+  scaled_double &operator-=(const scaled_double &x) {
+    return *this += -x;
+  }
+
+  friend scaled_double operator*(scaled_double x, const scaled_double &y) { return x *= y; }
+  friend scaled_double operator/(scaled_double x, const scaled_double &y) { return x /= y; }
+  friend scaled_double operator+(scaled_double x, const scaled_double &y) { return x += y; }
+  friend scaled_double operator-(scaled_double x, const scaled_double &y) { return x -= y; }
+
+  friend bool operator==(const scaled_double &x, const scaled_double &y) { return x.m_ == y.m_ && x.e_ == y.e_; }
+  friend bool operator!=(const scaled_double &x, const scaled_double &y) { return !(x == y); }
+  friend bool operator<(const scaled_double &x, const scaled_double &y) { return less(x, y); }
+  friend bool operator>(const scaled_double &x, const scaled_double &y) { return less(y, x); }
+  friend bool operator<=(const scaled_double &x, const scaled_double &y) { return less(x, y) || x == y; }
+  friend bool operator>=(const scaled_double &x, const scaled_double &y) { return less(y, x) || x == y; }
+
+  //Found by argument-dependent lookup only
+  friend scaled_double abs(const scaled_double &x) {
+    return x.mantissa() < 0.0 ? -x : x;
+  }
+
+  friend bool isnan(const scaled_double &x) {
+    return (boost::math::isnan)(x.mantissa());
+  }
+
+  friend scaled_double sqrt(const scaled_double &x) {
+    const exponent_type e = x.exponent();
+    //make the exponent even
+    return e % 2 == 0 ?
+           scaled_double(std::sqrt(x.mantissa()), e / 2) :
+           scaled_double(std::sqrt(2 * x.mantissa()), (e - 1) / 2);
+  }
+
+  //sqrt(x^2 + y^2) without overflow/underflow
+  friend scaled_double hypot(const scaled_double &x, const scaled_double &y) {
+    if (x.mantissa() == 0.0) {
+      return abs(y);
+    }
+    if (y.mantissa() == 0.0) {
+      return abs(x);
+    }
+    const exponent_type e = std::max(x.exponent(), y.exponent());
+    const exponent_type max_shift = std::numeric_limits<double>::digits + 1;
+    const double xm = e - x.exponent() > max_shift ? 0.0 : std::ldexp(x.mantissa(), static_cast<int>(x.exponent() - e));
+    const double ym = e - y.exponent() > max_shift ? 0.0 : std::ldexp(y.mantissa(), static_cast<int>(y.exponent() - e));
+    return scaled_double(std::sqrt(xm * xm + ym * ym), e);
+  }
+
+  //x^N (x must be positive unless N is an integer)
+  template<typename T>
+  friend scaled_double pow(const scaled_double &x, T N) {
+    if (x.mantissa() == 0.0) {
+      return scaled_double(N == 0 ? 1.0 : 0.0);
+    }
+    //log2(|x|^N) = N * (log2|m| + e) is split into integer and fractional parts
+    const double log2_abs = N * (std::log(std::abs(x.mantissa())) / std::log(2.0) + x.exponent());
+    const double e = std::floor(log2_abs);
+    double m = std::pow(2.0, log2_abs - e);
+    if (x.mantissa() < 0.0) {
+      const double N_double = static_cast<double>(N);
+      if (N_double != std::floor(N_double)) {
+        return scaled_double(std::numeric_limits<double>::quiet_NaN());
+      }
+      if (std::fmod(N_double, 2.0) != 0.0) {
+        m = -m;
+      }
+    }
+    return scaled_double(m, static_cast<exponent_type>(e));
+  }
+
+ private:
+  double m_;
+  exponent_type e_;
+
+  inline void normalize() {
+    if (m_ == 0.0 || !(boost::math::isfinite)(m_)) {
+      e_ = 0;
+      return;
+    }
+    int e;
+    m_ = std::frexp(m_, &e);
+    e_ += e;
+  }
+
+  //mantissa of x in units of 2^(x.exponent() + shift)
+  static inline double shifted_mantissa(const scaled_double &x, exponent_type shift) {
+    return shift > std::numeric_limits<double>::digits + 1 ? 0.0 : std::ldexp(x.m_, -static_cast<int>(shift));
+  }
+
+  static inline bool less(const scaled_double &x, const scaled_double &y) {
+    //Zero, different signs, same exponents, NaN or inf: the mantissas decide.
+    if (x.m_ == 0.0 || y.m_ == 0.0 || (x.m_ < 0.0) != (y.m_ < 0.0) || x.e_ == y.e_ ||
+        !(boost::math::isfinite)(x.m_) || !(boost::math::isfinite)(y.m_)) {
+      return x.m_ < y.m_;
+    }
+    return x.m_ > 0.0 ? x.e_ < y.e_ : x.e_ > y.e_;
+  }
+};
+
+inline std::ostream &operator<<(std::ostream &os, const scaled_double &x) {
+  if (x.mantissa() == 0.0 || !(boost::math::isfinite)(x.mantissa())) {
+    os << x.mantissa();
+    return os;
+  }
+  //print in decimal scientific notation: m * 2^e = m10 * 10^e10
+  const double log10_abs = std::log10(std::abs(x.mantissa())) + x.exponent() * std::log10(2.0);
+  const double e10 = std::floor(log10_abs);
+  const double m10 = (x.mantissa() < 0.0 ? -1 : 1) * std::pow(10.0, log10_abs - e10);
+  os << m10 << "e" << static_cast<scaled_double::exponent_type>(e10);
+  return os;
+}
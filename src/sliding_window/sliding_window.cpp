@@ -2,6 +2,7 @@
                       // see discussion at https://github.com/ALPSCore/CT-HYB/issues/13
 #include "sliding_window.hpp"
 #include "sliding_window.ipp"
+#include "trace_tree.ipp"
 #include "meas_static_obs.ipp"
 #include "meas_correlation.ipp"
 
@@ -9,6 +10,8 @@
  * Real-number version
  */
 template
+class TraceTree<REAL_EIGEN_BASIS_MODEL>;
+template
 class SlidingWindowManager<REAL_EIGEN_BASIS_MODEL>;
 template
 class MeasStaticObs<SlidingWindowManager<REAL_EIGEN_BASIS_MODEL>, CdagC>;
@@ -19,6 +22,8 @@ class MeasCorrelation<SlidingWindowManager<REAL_EIGEN_BASIS_MODEL>, EqualTimeOpe
  * Complex-number version
  */
 template
+class TraceTree<COMPLEX_EIGEN_BASIS_MODEL>;
+template
 class SlidingWindowManager<COMPLEX_EIGEN_BASIS_MODEL>;
 template
 class MeasStaticObs<SlidingWindowManager<COMPLEX_EIGEN_BASIS_MODEL>, CdagC>;
@@ -26,3 +31,15 @@ template
 class MeasCorrelation<SlidingWindowManager<COMPLEX_EIGEN_BASIS_MODEL>, EqualTimeOperator<1> >;
 
 
+
+/**
+ * Krylov models
+ */
+template
+class TraceTree<REAL_KRYLOV_MODEL>;
+template
+class SlidingWindowManager<REAL_KRYLOV_MODEL>;
+template
+class TraceTree<COMPLEX_KRYLOV_MODEL>;
+template
+class SlidingWindowManager<COMPLEX_KRYLOV_MODEL>;
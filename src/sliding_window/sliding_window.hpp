@@ -2,16 +2,33 @@
 
 #include <boost/tuple/tuple.hpp>
 #include <boost/multi_array.hpp>
+#include <boost/scoped_ptr.hpp>
+
+#include <map>
 
 #include "../wide_scalar.hpp"
 #include "../operator.hpp"
 #include "../model/model.hpp"
+#include "trace_tree.hpp"
 
 enum ITIME_AXIS_LEFT_OR_RIGHT {
   ITIME_LEFT = 0,
   ITIME_RIGHT = 1,
 };
 
+//Engine for evaluating the trace over the whole window
+enum TRACE_ENGINE {
+  STACK_ENGINE = 0, //evolve the kets at the right edge through the window
+  TREE_ENGINE = 1, //binary tree of partial products over [0, beta] (used only when the window covers [0, beta])
+};
+
+//Upper bound on the norm of a bra/ket used for the lazy trace evaluation
+enum NORM_BOUND_TYPE {
+  SPECTRAL_NORM_BOUND = 0, //exact spectral norm (eigenvalue solver)
+  HOLDER_NORM_BOUND = 1, //min(sqrt(1-norm * infinity-norm), Frobenius norm)
+  FROBENIUS_NORM_BOUND = 2, //Frobenius norm (cheapest, loosest)
+};
+
 //Implementation of sliding window update + lazy trace evaluation
 template<typename MODEL>
 class SlidingWindowManager {
@@ -19,6 +36,7 @@ class SlidingWindowManager {
   typedef MODEL IMPURITY_MODEL;
   typedef typename model_traits<MODEL>::SCALAR_T HAM_SCALAR_TYPE;
   typedef typename model_traits<MODEL>::BRAKET_T BRAKET_TYPE;
+  typedef typename BRAKET_TYPE::obj_type BRAKET_OBJ_TYPE;
   //class Braket is defined in model.hpp
   typedef typename ExtendedScalar<HAM_SCALAR_TYPE>::value_type EXTENDED_SCALAR;
   typedef typename operator_container_t::iterator op_it_t;
@@ -30,6 +48,18 @@ class SlidingWindowManager {
   //Initialization
   void init_stacks(int n_window_size, const operator_container_t &operators);
 
+  //Number of threads for evolving bras/kets in parallel (effective only if compiled with OpenMP)
+  void set_num_threads(int num_threads);
+  inline int get_num_threads() const { return num_threads; }
+
+  //Select the engine for evaluating the trace
+  void set_trace_engine(TRACE_ENGINE engine);
+  inline TRACE_ENGINE get_trace_engine() const { return trace_engine; }
+
+  //Select how norms of bras/kets are bounded (takes effect for bras/kets evolved afterwards)
+  inline void set_norm_bound_type(NORM_BOUND_TYPE type) { norm_bound_type = type; }
+  inline NORM_BOUND_TYPE get_norm_bound_type() const { return norm_bound_type; }
+
   //Change window size during MC simulation
   void set_window_size(int n_window_size, const operator_container_t &operators, int new_position_right_edge = 0,
                        ITIME_AXIS_LEFT_OR_RIGHT new_direction_move = ITIME_LEFT);
@@ -56,6 +86,26 @@ class SlidingWindowManager {
   inline const BRAKET_TYPE &get_bra(int bra) const { return left_states[bra].back(); }
   inline const BRAKET_TYPE &get_ket(int ket) const { return right_states[ket].back(); }
 
+  //Statistics of the cache of stacks used in set_window_size (number of states reused, number of states evolved)
+  inline std::pair<unsigned long, unsigned long> get_stack_cache_stats() const {
+    return std::make_pair(num_states_reused, num_states_evolved);
+  }
+  inline void reset_stack_cache_stats() {
+    num_states_reused = num_states_evolved = 0;
+  }
+
+  //Statistics of lazy trace evaluation (number of calls, number of rejections before all brakets are evaluated)
+  inline std::pair<unsigned long, unsigned long> get_lazy_eval_stats() const {
+    return std::make_pair(num_lazy_eval, num_lazy_eval_rejected);
+  }
+  inline void reset_lazy_eval_stats() {
+    num_lazy_eval = num_lazy_eval_rejected = 0;
+  }
+
+  //Statistics of the storage of bras/kets in the stacks (number of allocations, number of reuses of storage)
+  std::pair<unsigned long, unsigned long> get_braket_pool_stats() const;
+  void reset_braket_pool_stats();
+
   //Manipulation of window
   void move_window_to_next_position(const operator_container_t &operators);
   void move_backward_edge(ITIME_AXIS_LEFT_OR_RIGHT, int num_move = 1);
@@ -85,6 +135,9 @@ class SlidingWindowManager {
   const double BETA;
   const int num_brakets;
   const double norm_cutoff;
+  TRACE_ENGINE trace_engine;
+  int num_threads;
+  mutable boost::scoped_ptr<TraceTree<MODEL> > p_trace_tree;
 
   inline int depth_left_states() const { return left_states[0].size(); }
   inline int depth_right_states() const { return right_states[0].size(); }
@@ -102,6 +155,9 @@ class SlidingWindowManager {
   inline bool is_braket_invalid(int braket) const {
     return right_states[braket].back().invalid() || left_states[braket].back().invalid();
   }
+  inline bool use_trace_tree() const {
+    return trace_engine == TREE_ENGINE && position_right_edge == 0 && position_left_edge == 2 * n_window;
+  }
   inline typename ExtendedScalar<typename model_traits<MODEL>::SCALAR_T>::value_type
       compute_trace_braket(int braket, std::pair<op_it_t, op_it_t> ops_range, double tau_left, double tau_right) const;
 
@@ -113,6 +169,37 @@ class SlidingWindowManager {
   //for lazy evalulation of trace using spectral norm
   std::vector<std::vector<EXTENDED_REAL> > norm_left_states, norm_right_states;
 
+  //Storage of bras/kets popped from the stacks is recycled through a pool for each braket.
+  //Brakets are processed by different threads, so that pools are never shared by threads.
+  mutable std::vector<MatrixPool<BRAKET_OBJ_TYPE> > braket_pools;
+  static void copy_braket(MatrixPool<BRAKET_OBJ_TYPE> &pool, const BRAKET_TYPE &src, BRAKET_TYPE &dst);
+  static void push_back_copy(MatrixPool<BRAKET_OBJ_TYPE> &pool, std::vector<BRAKET_TYPE> &stack);
+
+  //Stacks built for other window sizes are kept for reuse in set_window_size.
+  //An entry at imaginary time tau is reused if it lies on the new grid and
+  //no operator it has been evolved through has changed since.
+  struct StackCache {
+    std::vector<std::vector<BRAKET_TYPE> > left_states, right_states;
+    std::vector<std::vector<EXTENDED_REAL> > norm_left_states, norm_right_states;
+    std::vector<psi> operators; //configuration for which the stacks were built
+    double tau_first_change, tau_last_change; //operators in [tau_first_change, tau_last_change] have changed since
+    unsigned long last_used;
+  };
+  static const int max_num_cached_stacks = 8;
+  std::map<int, StackCache> stack_cache;
+  unsigned long cache_clock, num_states_reused, num_states_evolved;
+  //Configuration from which the current stacks were last extended.
+  //The stacks are labelled with it when cached: the configuration passed to the next set_window_size may differ
+  //(e.g. a global update builds the stacks for a proposed configuration and then goes back to the current one).
+  std::vector<psi> stack_operators;
+  void save_stacks_to_cache();
+  void update_cache_validity(const operator_container_t &operators);
+  bool restore_from_cache(ITIME_AXIS_LEFT_OR_RIGHT which_edge);
+
+  NORM_BOUND_TYPE norm_bound_type;
+  EXTENDED_REAL compute_norm_bound(int braket, ITIME_AXIS_LEFT_OR_RIGHT which_edge);
+  mutable unsigned long num_lazy_eval, num_lazy_eval_rejected;
+
   inline void sanity_check() const;
 };
 
@@ -5,7 +5,34 @@ SlidingWindowManager<MODEL>::SlidingWindowManager(MODEL *p_model_, double beta)
     : p_model(p_model_),
       BETA(beta),
       num_brakets(p_model->num_brakets()),
-      norm_cutoff(std::sqrt(std::numeric_limits<double>::min())) { };
+      norm_cutoff(std::sqrt(std::numeric_limits<double>::min())),
+      trace_engine(STACK_ENGINE),
+      num_threads(1),
+      p_trace_tree(),
+      cache_clock(0),
+      num_states_reused(0),
+      num_states_evolved(0),
+      norm_bound_type(SPECTRAL_NORM_BOUND),
+      num_lazy_eval(0),
+      num_lazy_eval_rejected(0) { };
+
+template<typename MODEL>
+void SlidingWindowManager<MODEL>::set_num_threads(int num_threads_) {
+  if (num_threads_ < 1) {
+    throw std::runtime_error("The number of threads must be positive.");
+  }
+  num_threads = num_threads_;
+}
+
+template<typename MODEL>
+void SlidingWindowManager<MODEL>::set_trace_engine(TRACE_ENGINE engine) {
+  trace_engine = engine;
+  if (trace_engine == TREE_ENGINE) {
+    p_trace_tree.reset(new TraceTree<MODEL>(p_model, BETA));
+  } else {
+    p_trace_tree.reset();
+  }
+}
 
 template<typename MODEL>
 void
@@ -14,6 +41,8 @@ SlidingWindowManager<MODEL>::init_stacks(int n_window_size, const operator_conta
   right_states.resize(num_brakets);
   norm_left_states.resize(num_brakets);//for bra
   norm_right_states.resize(num_brakets);//for ket
+  braket_pools.resize(num_brakets);
+  stack_cache.clear();
   for (int braket = 0; braket < num_brakets; ++braket) {
     left_states[braket].resize(0);
     right_states[braket].resize(0);
@@ -26,8 +55,8 @@ SlidingWindowManager<MODEL>::init_stacks(int n_window_size, const operator_conta
 
     norm_left_states[braket].resize(0);
     norm_right_states[braket].resize(0);
-    norm_left_states[braket].push_back(left_states[braket].back().compute_spectral_norm());
-    norm_right_states[braket].push_back(right_states[braket].back().compute_spectral_norm());
+    norm_left_states[braket].push_back(compute_norm_bound(braket, ITIME_LEFT));
+    norm_right_states[braket].push_back(compute_norm_bound(braket, ITIME_RIGHT));
   }
 
   set_window_size(n_window_size, operators);
@@ -42,6 +71,10 @@ void SlidingWindowManager<MODEL>::set_window_size(int n_window_new,
   assert(n_window_new > 0);
   sanity_check();
 
+  //keep the current stacks for reuse
+  save_stacks_to_cache();
+  update_cache_validity(operators);
+
   //reset
   while (depth_right_states() > 1) {
     move_backward_edge(ITIME_RIGHT);
@@ -56,10 +89,16 @@ void SlidingWindowManager<MODEL>::set_window_size(int n_window_new,
     position_left_edge = 2 * n_window;
 
     for (int i = 0; i < new_position_right_edge; ++i) {
-      move_forward_right_edge(operators);
+      if (!restore_from_cache(ITIME_RIGHT)) {
+        move_forward_right_edge(operators);
+        ++num_states_evolved;
+      }
     }
     for (int i = 0; i < 2 * n_window - 2 - new_position_right_edge; ++i) {
-      move_forward_left_edge(operators);
+      if (!restore_from_cache(ITIME_LEFT)) {
+        move_forward_left_edge(operators);
+        ++num_states_evolved;
+      }
     }
     assert(position_left_edge - position_right_edge == 2);
     assert(position_right_edge == new_position_right_edge);
@@ -74,9 +113,128 @@ void SlidingWindowManager<MODEL>::set_window_size(int n_window_new,
     position_right_edge = 0;
     position_left_edge = 2 * n_window;
   }
+  stack_operators.assign(operators.begin(), operators.end());
   sanity_check();
 }
 
+template<typename MODEL>
+void SlidingWindowManager<MODEL>::save_stacks_to_cache() {
+  if (depth_right_states() == 1 && depth_left_states() == 1) {
+    return;
+  }
+
+  StackCache &cache = stack_cache[n_window];
+  std::swap(cache.left_states, left_states);
+  std::swap(cache.right_states, right_states);
+  std::swap(cache.norm_left_states, norm_left_states);
+  std::swap(cache.norm_right_states, norm_right_states);
+  std::swap(cache.operators, stack_operators);
+  cache.last_used = ++cache_clock;
+
+  //restart from the outer states
+  left_states.resize(num_brakets);
+  right_states.resize(num_brakets);
+  norm_left_states.resize(num_brakets);
+  norm_right_states.resize(num_brakets);
+  for (int braket = 0; braket < num_brakets; ++braket) {
+    left_states[braket].assign(1, cache.left_states[braket][0]);
+    right_states[braket].assign(1, cache.right_states[braket][0]);
+    norm_left_states[braket].assign(1, cache.norm_left_states[braket][0]);
+    norm_right_states[braket].assign(1, cache.norm_right_states[braket][0]);
+  }
+  position_right_edge = 0;
+  position_left_edge = 2 * n_window;
+
+  //forget the least recently used stacks
+  if (stack_cache.size() > max_num_cached_stacks) {
+    typename std::map<int, StackCache>::iterator it_oldest = stack_cache.begin();
+    for (typename std::map<int, StackCache>::iterator it = stack_cache.begin(); it != stack_cache.end(); ++it) {
+      if (it->second.last_used < it_oldest->second.last_used) {
+        it_oldest = it;
+      }
+    }
+    stack_cache.erase(it_oldest);
+  }
+}
+
+template<typename MODEL>
+void SlidingWindowManager<MODEL>::update_cache_validity(const operator_container_t &operators) {
+  for (typename std::map<int, StackCache>::iterator it = stack_cache.begin(); it != stack_cache.end(); ++it) {
+    StackCache &cache = it->second;
+
+    //first operator that differs, from tau=0
+    std::vector<psi>::const_iterator it_cache = cache.operators.begin();
+    operator_container_t::const_iterator it_op = operators.begin();
+    while (it_cache != cache.operators.end() && it_op != operators.end() && *it_cache == *it_op) {
+      ++it_cache;
+      ++it_op;
+    }
+    cache.tau_first_change = std::numeric_limits<double>::max();
+    if (it_cache != cache.operators.end()) {
+      cache.tau_first_change = it_cache->time().time();
+    }
+    if (it_op != operators.end()) {
+      cache.tau_first_change = std::min(cache.tau_first_change, it_op->time().time());
+    }
+
+    //last operator that differs, from tau=beta
+    std::vector<psi>::const_reverse_iterator rit_cache = cache.operators.rbegin();
+    operator_container_t::const_reverse_iterator rit_op = operators.rbegin();
+    while (rit_cache != cache.operators.rend() && rit_op != operators.rend() && *rit_cache == *rit_op) {
+      ++rit_cache;
+      ++rit_op;
+    }
+    cache.tau_last_change = -std::numeric_limits<double>::max();
+    if (rit_cache != cache.operators.rend()) {
+      cache.tau_last_change = rit_cache->time().time();
+    }
+    if (rit_op != operators.rend()) {
+      cache.tau_last_change = std::max(cache.tau_last_change, rit_op->time().time());
+    }
+  }
+}
+
+//Look for a valid state at the next position of the edge in the cache and push it to the stack
+template<typename MODEL>
+bool SlidingWindowManager<MODEL>::restore_from_cache(ITIME_AXIS_LEFT_OR_RIGHT which_edge) {
+  const int pos_new = which_edge == ITIME_RIGHT ? position_right_edge + 1 : position_left_edge - 1;
+  const double tau_new = get_tau_edge(pos_new);
+
+  for (typename std::map<int, StackCache>::iterator it = stack_cache.begin(); it != stack_cache.end(); ++it) {
+    const int n_window_cache = it->first;
+    StackCache &cache = it->second;
+    if ((pos_new * n_window_cache) % n_window != 0) {
+      continue;
+    }
+    const int pos_cache = (pos_new * n_window_cache) / n_window;
+
+    if (which_edge == ITIME_RIGHT) {
+      if (pos_cache >= cache.right_states[0].size() || tau_new > cache.tau_first_change) {
+        continue;
+      }
+      for (int braket = 0; braket < num_brakets; ++braket) {
+        right_states[braket].push_back(cache.right_states[braket][pos_cache]);
+        norm_right_states[braket].push_back(cache.norm_right_states[braket][pos_cache]);
+      }
+      ++position_right_edge;
+    } else {
+      const int depth = 2 * n_window_cache - pos_cache;
+      if (depth >= cache.left_states[0].size() || tau_new < cache.tau_last_change) {
+        continue;
+      }
+      for (int braket = 0; braket < num_brakets; ++braket) {
+        left_states[braket].push_back(cache.left_states[braket][depth]);
+        norm_left_states[braket].push_back(cache.norm_left_states[braket][depth]);
+      }
+      --position_left_edge;
+    }
+    cache.last_used = ++cache_clock;
+    ++num_states_reused;
+    return true;
+  }
+  return false;
+}
+
 template<typename MODEL>
 void
 SlidingWindowManager<MODEL>::move_backward_edge(ITIME_AXIS_LEFT_OR_RIGHT which_edge, int num_move) {
@@ -105,6 +263,7 @@ void
 SlidingWindowManager<MODEL>::move_forward_right_edge(const operator_container_t &operators, int num_move) {
   namespace bll = boost::lambda;
   sanity_check();
+  stack_operators.assign(operators.begin(), operators.end());
 
   for (int move = 0; move < num_move; ++move) {
     //range check
@@ -114,11 +273,15 @@ SlidingWindowManager<MODEL>::move_forward_right_edge(const operator_container_t
     const double tau_edge_new = get_tau_edge(position_right_edge + 1);
     //const int new_size = depth_right_states()+1;
     std::pair<op_it_t, op_it_t> ops_range = operators.range(tau_edge_old <= bll::_1, bll::_1 < tau_edge_new);
-    EXTENDED_REAL max_norm = -1;
+    //Brakets are independent. The max norm is computed afterwards in a fixed order.
+#pragma omp parallel for num_threads(num_threads) schedule(dynamic) if(num_threads > 1)
     for (int i_braket = 0; i_braket < num_brakets; ++i_braket) {
-      right_states[i_braket].push_back(right_states[i_braket].back());
+      push_back_copy(braket_pools[i_braket], right_states[i_braket]);
       evolve_ket(*p_model, right_states[i_braket].back(), ops_range, tau_edge_old, tau_edge_new);
-      norm_right_states[i_braket].push_back(right_states[i_braket].back().compute_spectral_norm());
+      norm_right_states[i_braket].push_back(compute_norm_bound(i_braket, ITIME_RIGHT));
+    }
+    EXTENDED_REAL max_norm = -1;
+    for (int i_braket = 0; i_braket < num_brakets; ++i_braket) {
       if (max_norm < norm_right_states[i_braket].back()) {
         max_norm = norm_right_states[i_braket].back();
       }
@@ -143,6 +306,7 @@ template<typename MODEL>
 void
 SlidingWindowManager<MODEL>::move_forward_left_edge(const operator_container_t &operators_tmp, int num_move) {
   namespace bll = boost::lambda;
+  stack_operators.assign(operators_tmp.begin(), operators_tmp.end());
 
   for (int move = 0; move < num_move; ++move) {
     //range check
@@ -157,11 +321,14 @@ SlidingWindowManager<MODEL>::move_forward_left_edge(const operator_container_t &
                                                                       bll::_1 <= tau_edge_old);
     //const int num_ops = std::distance(ops_range.first, ops_range.second);
 
-    EXTENDED_REAL max_norm = -1;
+#pragma omp parallel for num_threads(num_threads) schedule(dynamic) if(num_threads > 1)
     for (int i_braket = 0; i_braket < num_brakets; ++i_braket) {
-      left_states[i_braket].push_back(left_states[i_braket].back());
+      push_back_copy(braket_pools[i_braket], left_states[i_braket]);
       evolve_bra(*p_model, left_states[i_braket].back(), ops_range, tau_edge_old, tau_edge_new);
-      norm_left_states[i_braket].push_back(left_states[i_braket].back().compute_spectral_norm());
+      norm_left_states[i_braket].push_back(compute_norm_bound(i_braket, ITIME_LEFT));
+    }
+    EXTENDED_REAL max_norm = -1;
+    for (int i_braket = 0; i_braket < num_brakets; ++i_braket) {
       if (max_norm < norm_left_states[i_braket].back()) {
         max_norm = norm_left_states[i_braket].back();
       }
@@ -215,6 +382,19 @@ SlidingWindowManager<MODEL>::compute_trace(const operator_container_t &operators
   const double tau_left = get_tau_edge(position_left_edge);
   std::pair<op_it_t, op_it_t> ops_range = operators.range(tau_right <= bll::_1, bll::_1 <= tau_left);
 
+  if (use_trace_tree()) {
+    p_trace_tree->update(operators);
+    for (int i_braket = 0; i_braket < num_brakets; ++i_braket) {
+      if (!is_braket_invalid(i_braket)) {
+        trace += p_trace_tree->compute_trace_braket(left_states[i_braket].back(), right_states[i_braket].back());
+      }
+    }
+    return trace;
+  }
+
+  //Contributions are summed up in a fixed order so that the result does not depend on the number of threads.
+  std::vector<EXTENDED_SCALAR> trace_brakets(num_brakets, EXTENDED_SCALAR(0.0));
+#pragma omp parallel for num_threads(num_threads) schedule(dynamic) if(num_threads > 1)
   for (int i_braket = 0; i_braket < num_brakets; ++i_braket) {
     if (is_braket_invalid(i_braket)) {
       continue;
@@ -223,11 +403,13 @@ SlidingWindowManager<MODEL>::compute_trace(const operator_container_t &operators
 
     evolve_ket(*p_model, ket, ops_range, tau_right, tau_left);
     if (left_states[i_braket].back().sector() == ket.sector()) {
-      const EXTENDED_SCALAR trace_braket = p_model->product(left_states[i_braket].back(), ket);
-      assert(!my_isnan(trace_braket));
-      trace += trace_braket;
+      trace_brakets[i_braket] = p_model->product(left_states[i_braket].back(), ket);
+      assert(!my_isnan(trace_brakets[i_braket]));
     }
   }
+  for (int i_braket = 0; i_braket < num_brakets; ++i_braket) {
+    trace += trace_brakets[i_braket];
+  }
   return trace;
 }
 
@@ -236,13 +418,16 @@ typename ExtendedScalar<typename model_traits<MODEL>::SCALAR_T>::value_type
 SlidingWindowManager<MODEL>::compute_trace_braket(int braket,
                                                   std::pair<op_it_t, op_it_t> ops_range, double tau_left,
                                                   double tau_right) const {
-  BRAKET_TYPE ket = right_states[braket].back();
-  evolve_ket(*p_model, ket, ops_range, tau_right, tau_left);
-  if (left_states[braket].back().sector() == ket.sector()) {
-    return p_model->product(left_states[braket].back(), ket);
-  } else {
-    return 0.0;
+  if (use_trace_tree()) {
+    return p_trace_tree->compute_trace_braket(left_states[braket].back(), right_states[braket].back());
   }
+  BRAKET_TYPE ket;
+  copy_braket(braket_pools[braket], right_states[braket].back(), ket);
+  evolve_ket(*p_model, ket, ops_range, tau_right, tau_left);
+  const EXTENDED_SCALAR trace =
+      left_states[braket].back().sector() == ket.sector() ? p_model->product(left_states[braket].back(), ket) : EXTENDED_SCALAR(0.0);
+  braket_pools[braket].release(ket.obj());
+  return trace;
 }
 
 template<typename T>
@@ -264,9 +449,6 @@ SlidingWindowManager<MODEL>::lazy_eval_trace(const operator_container_t &operato
   const double tau_left = get_tau_edge(position_left_edge);
   std::pair<op_it_t, op_it_t> ops_range = operators.range(tau_right <= bll::_1, bll::_1 <= tau_left);
 
-  EXTENDED_REAL trace_bound_current = std::accumulate(trace_bound.begin(), trace_bound.end(), EXTENDED_REAL(0.0));
-  assert(trace_bound_current >= 0.0);
-
   //sort trace bounds in decreasing order
   std::vector<std::pair<EXTENDED_REAL, int> > indices(num_brakets);
   for (int braket = 0; braket < num_brakets; ++braket) {
@@ -275,27 +457,87 @@ SlidingWindowManager<MODEL>::lazy_eval_trace(const operator_container_t &operato
   std::sort(indices.begin(), indices.end(), bound_greater<EXTENDED_REAL>());
 #ifndef NDEBUG
   for (int idx = 0; idx < num_brakets - 1; ++idx) {
-    assert(indices[idx].first >= indices[idx].first);
+    assert(indices[idx].first >= indices[idx + 1].first);
   }
 #endif
+  if (use_trace_tree()) {
+    p_trace_tree->update(operators);
+  }
+
+  //bound_rest[idx]: sum of the bounds of the brakets idx, idx+1, ... in the sorted order
+  std::vector<EXTENDED_REAL> bound_rest(num_brakets + 1, EXTENDED_REAL(0.0));
+  for (int idx = num_brakets - 1; idx >= 0; --idx) {
+    bound_rest[idx] = bound_rest[idx + 1] + indices[idx].first;
+  }
+  assert(bound_rest[0] >= 0.0);
 
+  //Brakets are evaluated (possibly by several threads) in the sorted order and the results are committed in this order.
+  //Thus, the decision does not depend on the number of threads.
+  //trace bound = (sum of |trace| of the committed brakets) + (sum of the bounds of the others)
+  enum { RUNNING, REJECTED, DONE };
+  int status = RUNNING, num_committed = 0, next_idx = 0;
   EXTENDED_SCALAR trace_sum = 0.0;
-  for (int idx = 0; idx < num_brakets; ++idx) {
-    int braket = indices[idx].second;
-    if (trace_bound[braket] < 1E-15 * myabs(trace_sum)) {
-      break;
-    }
+  EXTENDED_REAL abs_trace_sum = 0.0;
+  std::vector<EXTENDED_SCALAR> trace_brakets(num_brakets);
+  std::vector<char> evaluated(num_brakets, 0);
+
+  //The tree engine has a cache which is not thread safe
+  const int num_threads_eval = use_trace_tree() ? 1 : std::min(num_threads, num_brakets);
+#pragma omp parallel num_threads(num_threads_eval) if(num_threads_eval > 1)
+  {
+    while (true) {
+      int idx;
+#pragma omp atomic capture
+      idx = next_idx++;
+
+      int status_local;
+#pragma omp atomic read
+      status_local = status;
+
+      if (idx >= num_brakets || status_local != RUNNING) {
+        break;
+      }
 
-    const EXTENDED_SCALAR trace_braket = compute_trace_braket(braket, ops_range, tau_left, tau_right);
+      trace_brakets[idx] = compute_trace_braket(indices[idx].second, ops_range, tau_left, tau_right);
+
+#pragma omp critical(lazy_eval_trace_commit)
+      {
+        //status is read outside this critical section, so it is accessed only atomically here as well
+        int status_commit;
+#pragma omp atomic read
+        status_commit = status;
+
+        evaluated[idx] = 1;
+        while (status_commit == RUNNING && num_committed < num_brakets && evaluated[num_committed]) {
+          const int braket = indices[num_committed].second;
+          if (trace_bound[braket] < 1E-15 * myabs(trace_sum)) {
+            status_commit = DONE;
+            break;
+          }
+          const EXTENDED_SCALAR &trace_braket = trace_brakets[num_committed];
+          assert(myabs(trace_braket) <= trace_bound[braket] * 1.01);
+          trace_sum += trace_braket;
+          trace_bound[braket] = myabs(trace_braket);
+          abs_trace_sum += trace_bound[braket];
+          ++num_committed;
+          if (abs_trace_sum + bound_rest[num_committed] < trace_cutoff) {
+            status_commit = REJECTED;
+          }
+        }
 
-    assert(myabs(trace_braket) <= trace_bound[braket] * 1.01);
-    trace_sum += trace_braket;
-    trace_bound[braket] = myabs(trace_braket);
-    trace_bound_current = std::accumulate(trace_bound.begin(), trace_bound.end(), EXTENDED_REAL(0.0));
-    if (trace_bound_current < trace_cutoff) {
-      return std::make_pair(false, 0.0);
+#pragma omp atomic write
+        status = status_commit;
+      }
     }
   }
+
+  ++num_lazy_eval;
+  if (status == REJECTED) {
+    if (num_committed < num_brakets) {
+      ++num_lazy_eval_rejected;
+    }
+    return std::make_pair(false, 0.0);
+  }
   return std::make_pair(myabs(trace_sum) > trace_cutoff, trace_sum);
 }
 
@@ -492,6 +734,9 @@ template<typename MODEL>
 void SlidingWindowManager<MODEL>::pop_back_bra(int num_pop_back) {
   const int new_size = depth_left_states() - num_pop_back;
   for (int braket = 0; braket < num_brakets; ++braket) {
+    for (int i = new_size; i < left_states[braket].size(); ++i) {
+      braket_pools[braket].release(left_states[braket][i].obj());
+    }
     left_states[braket].resize(new_size);
     norm_left_states[braket].resize(new_size);
   }
@@ -501,11 +746,62 @@ template<typename MODEL>
 void SlidingWindowManager<MODEL>::pop_back_ket(int num_pop_back) {
   const int new_size = depth_right_states() - num_pop_back;
   for (int braket = 0; braket < num_brakets; ++braket) {
+    for (int i = new_size; i < right_states[braket].size(); ++i) {
+      braket_pools[braket].release(right_states[braket][i].obj());
+    }
     right_states[braket].resize(new_size);
     norm_right_states[braket].resize(new_size);
   }
 }
 
+template<typename MODEL>
+EXTENDED_REAL SlidingWindowManager<MODEL>::compute_norm_bound(int braket, ITIME_AXIS_LEFT_OR_RIGHT which_edge) {
+  BRAKET_TYPE &state = which_edge == ITIME_LEFT ? left_states[braket].back() : right_states[braket].back();
+  switch (norm_bound_type) {
+    case SPECTRAL_NORM_BOUND:
+      return state.compute_spectral_norm();
+    case FROBENIUS_NORM_BOUND:
+      return state.compute_frobenius_norm();
+    case HOLDER_NORM_BOUND:
+      return state.compute_holder_norm_bound();
+    default:
+      throw std::runtime_error("Unknown norm bound type");
+  }
+}
+
+template<typename MODEL>
+void SlidingWindowManager<MODEL>::copy_braket(MatrixPool<BRAKET_OBJ_TYPE> &pool,
+                                              const BRAKET_TYPE &src,
+                                              BRAKET_TYPE &dst) {
+  pool.acquire(src.obj().rows(), src.obj().cols(), dst.obj());
+  dst.obj() = src.obj();
+  dst.set_sector(src.sector());
+  dst.set_coeff(src.coeff());
+}
+
+template<typename MODEL>
+void SlidingWindowManager<MODEL>::push_back_copy(MatrixPool<BRAKET_OBJ_TYPE> &pool, std::vector<BRAKET_TYPE> &stack) {
+  stack.push_back(BRAKET_TYPE());
+  copy_braket(pool, stack[stack.size() - 2], stack.back());
+}
+
+template<typename MODEL>
+std::pair<unsigned long, unsigned long> SlidingWindowManager<MODEL>::get_braket_pool_stats() const {
+  std::pair<unsigned long, unsigned long> r(0, 0);
+  for (int braket = 0; braket < braket_pools.size(); ++braket) {
+    r.first += braket_pools[braket].stats().first;
+    r.second += braket_pools[braket].stats().second;
+  }
+  return r;
+}
+
+template<typename MODEL>
+void SlidingWindowManager<MODEL>::reset_braket_pool_stats() {
+  for (int braket = 0; braket < braket_pools.size(); ++braket) {
+    braket_pools[braket].reset_stats();
+  }
+}
+
 template<typename MODEL>
 void SlidingWindowManager<MODEL>::restore_state(const operator_container_t &ops, state_t state) {
   set_window_size(boost::get<3>(state), ops, boost::get<1>(state), boost::get<2>(state));
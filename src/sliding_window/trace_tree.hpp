@@ -0,0 +1,75 @@
+#pragma once
+
+#include <vector>
+
+#include "../wide_scalar.hpp"
+#include "../operator.hpp"
+#include "../model/model.hpp"
+
+/**
+ * @brief Binary tree of partial products of the local propagator over imaginary-time segments
+ *
+ * [0, beta] is split into 2^n uniform leaf segments.
+ * Each node of the tree stores the products of sector matrices (exp(-tau H) and operators) over its segment,
+ * one matrix for each sector a ket enters the segment from. These are computed lazily.
+ * A change of operators in one leaf invalidates only the path from the leaf to the root,
+ * so a local update anywhere on [0, beta] requires O(log N) matrix products.
+ *
+ * Each node keeps two cache slots (the current configuration and the previous one).
+ * A rejected update thus costs no re-computation when the old configuration is evaluated again.
+ */
+template<typename MODEL>
+class TraceTree {
+ public:
+  typedef typename model_traits<MODEL>::SCALAR_T HAM_SCALAR_TYPE;
+  typedef typename model_traits<MODEL>::BRAKET_T BRAKET_TYPE;
+  typedef typename ExtendedScalar<HAM_SCALAR_TYPE>::value_type EXTENDED_SCALAR;
+
+  TraceTree(const MODEL *p_model, double beta, int ops_per_leaf = 2);
+
+  //Synchronize the tree with a configuration. Only nodes affected by changes are invalidated.
+  void update(const operator_container_t &operators);
+
+  //<bra| U(beta, 0) |ket>, where U is the propagator stored at the root of the tree
+  EXTENDED_SCALAR compute_trace_braket(const BRAKET_TYPE &bra, const BRAKET_TYPE &ket);
+
+  inline int num_leaves() const { return num_leaves_; }
+
+ private:
+  struct Slot {
+    Slot() : id(0), propagators(0), computed(0) {
+      child_id[0] = child_id[1] = 0;
+    }
+    unsigned long id; //zero means empty
+    std::vector<psi> ops; //key for a leaf
+    unsigned long child_id[2]; //key for an inner node
+    std::vector<BRAKET_TYPE> propagators; //indexed by the sector from which a ket enters
+    std::vector<char> computed;
+  };
+
+  struct Node {
+    Node() : active(0) { }
+    Slot slots[2];
+    int active;
+    inline Slot &current() { return slots[active]; }
+    inline const Slot &current() const { return slots[active]; }
+  };
+
+  const MODEL *const p_model_;
+  const double BETA;
+  const int ops_per_leaf_;
+  int num_leaves_;
+  unsigned long next_id_;
+  std::vector<Node> nodes_; //heap layout: node 1 is the root, the children of node i are 2i (small tau) and 2i+1
+  std::vector<std::vector<psi> > ops_leaf_; //work space
+
+  void resize_tree(int num_leaves);
+  void activate_slot(Node &node, const std::vector<psi> &ops);
+  void activate_slot(Node &node, unsigned long id_left, unsigned long id_right);
+  void reset_slot(Slot &slot);
+  inline double tau_leaf(int leaf) const { return (BETA * leaf) / num_leaves_; }
+  inline bool is_leaf(int node) const { return node >= num_leaves_; }
+
+  const BRAKET_TYPE &propagator(int node, int sector);
+  void compute_leaf_propagator(int leaf, int sector, BRAKET_TYPE &prop) const;
+};
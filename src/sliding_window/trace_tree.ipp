@@ -0,0 +1,151 @@
+#include "trace_tree.hpp"
+
+template<typename MODEL>
+TraceTree<MODEL>::TraceTree(const MODEL *p_model, double beta, int ops_per_leaf)
+    : p_model_(p_model),
+      BETA(beta),
+      ops_per_leaf_(std::max(ops_per_leaf, 1)),
+      num_leaves_(0),
+      next_id_(1) {
+  resize_tree(1);
+}
+
+template<typename MODEL>
+void TraceTree<MODEL>::resize_tree(int num_leaves) {
+  assert(num_leaves > 0 && (num_leaves & (num_leaves - 1)) == 0);
+  num_leaves_ = num_leaves;
+  nodes_.clear();
+  nodes_.resize(2 * num_leaves_);
+  ops_leaf_.resize(num_leaves_);
+}
+
+template<typename MODEL>
+void TraceTree<MODEL>::reset_slot(Slot &slot) {
+  slot.id = next_id_++;
+  slot.propagators.resize(p_model_->num_sectors());
+  slot.computed.resize(p_model_->num_sectors());
+  std::fill(slot.computed.begin(), slot.computed.end(), 0);
+}
+
+template<typename MODEL>
+void TraceTree<MODEL>::activate_slot(Node &node, const std::vector<psi> &ops) {
+  if (node.current().id != 0 && node.current().ops == ops) {
+    return;
+  }
+  node.active = 1 - node.active;
+  if (node.current().id != 0 && node.current().ops == ops) {
+    return;
+  }
+  reset_slot(node.current());
+  node.current().ops = ops;
+}
+
+template<typename MODEL>
+void TraceTree<MODEL>::activate_slot(Node &node, unsigned long id_left, unsigned long id_right) {
+  for (int trial = 0; trial < 2; ++trial) {
+    if (node.current().id != 0 && node.current().child_id[0] == id_left && node.current().child_id[1] == id_right) {
+      return;
+    }
+    node.active = 1 - node.active;
+  }
+  reset_slot(node.current());
+  node.current().child_id[0] = id_left;
+  node.current().child_id[1] = id_right;
+}
+
+template<typename MODEL>
+void TraceTree<MODEL>::update(const operator_container_t &operators) {
+  const int num_ops = operators.size();
+
+  //Keep O(ops_per_leaf) operators in each leaf. Rebuild the tree only if the size is off by more than a factor of 2.
+  int num_leaves_opt = 1;
+  while (num_leaves_opt * ops_per_leaf_ < num_ops) {
+    num_leaves_opt *= 2;
+  }
+  if (num_leaves_opt > 2 * num_leaves_ || 2 * num_leaves_opt < num_leaves_) {
+    resize_tree(num_leaves_opt);
+  }
+
+  for (int leaf = 0; leaf < num_leaves_; ++leaf) {
+    ops_leaf_[leaf].resize(0);
+  }
+  for (operator_container_t::const_iterator it = operators.begin(); it != operators.end(); ++it) {
+    const int leaf = std::min(static_cast<int>(num_leaves_ * (it->time().time() / BETA)), num_leaves_ - 1);
+    ops_leaf_[std::max(leaf, 0)].push_back(*it);
+  }
+
+  for (int leaf = 0; leaf < num_leaves_; ++leaf) {
+    activate_slot(nodes_[num_leaves_ + leaf], ops_leaf_[leaf]);
+  }
+  for (int node = num_leaves_ - 1; node > 0; --node) {
+    activate_slot(nodes_[node], nodes_[2 * node].current().id, nodes_[2 * node + 1].current().id);
+  }
+}
+
+template<typename MODEL>
+void TraceTree<MODEL>::compute_leaf_propagator(int leaf, int sector, BRAKET_TYPE &prop) const {
+  typedef Eigen::Matrix<HAM_SCALAR_TYPE, Eigen::Dynamic, Eigen::Dynamic> matrix_t;
+
+  const int dim = p_model_->dim_sector(sector);
+  prop = BRAKET_TYPE(sector, matrix_t::Identity(dim, dim));
+
+  const std::vector<psi> &ops = nodes_[num_leaves_ + leaf].current().ops;
+  double tau_old = tau_leaf(leaf);
+  for (std::vector<psi>::const_iterator it = ops.begin(); it != ops.end(); ++it) {
+    p_model_->sector_propagate_ket(prop, it->time() - tau_old);
+    p_model_->apply_op_hyb_ket(it->type(), it->flavor(), prop);
+    if (prop.invalid()) {
+      return;
+    }
+    tau_old = it->time().time();
+  }
+  p_model_->sector_propagate_ket(prop, tau_leaf(leaf + 1) - tau_old);
+  prop.normalize();
+}
+
+template<typename MODEL>
+const typename TraceTree<MODEL>::BRAKET_TYPE &
+TraceTree<MODEL>::propagator(int node, int sector) {
+  assert(sector >= 0 && sector < p_model_->num_sectors());
+  Slot &slot = nodes_[node].current();
+  if (slot.computed[sector]) {
+    return slot.propagators[sector];
+  }
+
+  BRAKET_TYPE &prop = slot.propagators[sector];
+  if (is_leaf(node)) {
+    compute_leaf_propagator(node - num_leaves_, sector, prop);
+  } else {
+    //U(node) = U(right child) U(left child)
+    const BRAKET_TYPE &prop_small_tau = propagator(2 * node, sector);
+    if (prop_small_tau.invalid()) {
+      prop.set_invalid();
+    } else {
+      const BRAKET_TYPE &prop_large_tau = propagator(2 * node + 1, prop_small_tau.sector());
+      if (prop_large_tau.invalid()) {
+        prop.set_invalid();
+      } else {
+        prop = BRAKET_TYPE(prop_large_tau.sector(), prop_large_tau.obj() * prop_small_tau.obj());
+        prop.set_coeff(prop_large_tau.coeff() * prop_small_tau.coeff());
+        prop.normalize();
+      }
+    }
+  }
+  slot.computed[sector] = 1;
+  return prop;
+}
+
+template<typename MODEL>
+typename TraceTree<MODEL>::EXTENDED_SCALAR
+TraceTree<MODEL>::compute_trace_braket(const BRAKET_TYPE &bra, const BRAKET_TYPE &ket) {
+  if (bra.invalid() || ket.invalid()) {
+    return 0.0;
+  }
+  const BRAKET_TYPE &prop = propagator(1, ket.sector());
+  if (prop.invalid() || prop.sector() != bra.sector()) {
+    return 0.0;
+  }
+  BRAKET_TYPE ket_evolved(prop.sector(), prop.obj() * ket.obj());
+  ket_evolved.set_coeff(prop.coeff() * ket.coeff());
+  return p_model_->product(bra, ket_evolved);
+}
@@ -0,0 +1,91 @@
+#include "solver.hpp"
+
+#include <fstream>
+#include <cmath>
+#include <boost/format.hpp>
+
+namespace alps {
+namespace cthyb {
+
+namespace {
+
+//Max absolute value of the imaginary parts in an input text file.
+//Each line consists of num_index_cols integer columns followed by the real and imaginary parts.
+//If num_lines < 0, the number of lines is read from the first line of the file (U tensor).
+double max_imag_in_file(const std::string &fname, int num_index_cols, int num_lines) {
+  std::ifstream infile(fname.c_str());
+  if (!infile.is_open()) {
+    throw std::runtime_error("We cannot open " + fname + "!");
+  }
+  if (num_lines < 0) {
+    infile >> num_lines;
+  }
+  double max_imag = 0.0;
+  for (int line = 0; line < num_lines; ++line) {
+    int index;
+    double re, im;
+    for (int col = 0; col < num_index_cols; ++col) {
+      infile >> index;
+    }
+    infile >> re >> im;
+    if (!infile) {
+      throw std::runtime_error(boost::str(boost::format("Wrong format of %1% at line %2%.") % fname % (line + 1)));
+    }
+    max_imag = std::max(max_imag, std::abs(im));
+  }
+  return max_imag;
+}
+
+double max_abs(const std::vector<double> &values) {
+  double r = 0.0;
+  for (int i = 0; i < values.size(); ++i) {
+    r = std::max(r, std::abs(values[i]));
+  }
+  return r;
+}
+
+}
+
+bool Solver::is_real_problem(const alps::params &parameters, std::string &reason, double tolerance) {
+  const int flavors = parameters["model.sites"].as<int>() * parameters["model.spins"].as<int>();
+  const int Np1 = parameters["model.n_tau_hyb"].as<int>() + 1;
+
+  std::vector<std::pair<std::string, double> > max_imag;//(input, max |Im|)
+  if (parameters["model.command_line_mode"].as<bool>()) {
+    max_imag.push_back(std::make_pair("U tensor", max_abs(parameters["model.coulomb_tensor_Im"].as<std::vector<double> >())));
+    max_imag.push_back(std::make_pair("hopping matrix", max_abs(parameters["model.hopping_matrix_Im"].as<std::vector<double> >())));
+    max_imag.push_back(std::make_pair("Delta(tau)", max_abs(parameters["model.delta_Im"].as<std::vector<double> >())));
+  } else {
+    if (parameters.defined("model.coulomb_tensor_input_file")) {
+      max_imag.push_back(std::make_pair("U tensor",
+                                        max_imag_in_file(parameters["model.coulomb_tensor_input_file"].as<std::string>(), 5, -1)));
+    }
+    if (parameters.defined("model.hopping_matrix_input_file")) {
+      max_imag.push_back(std::make_pair("hopping matrix",
+                                        max_imag_in_file(parameters["model.hopping_matrix_input_file"].as<std::string>(), 2,
+                                                         flavors * flavors)));
+    }
+    if (parameters["model.delta_input_file"].as<std::string>() != "") {
+      max_imag.push_back(std::make_pair("Delta(tau)",
+                                        max_imag_in_file(parameters["model.delta_input_file"].as<std::string>(), 3,
+                                                         Np1 * flavors * flavors)));
+    }
+  }
+  if (parameters.defined("model.basis_input_file") && parameters["model.basis_input_file"].as<std::string>() != "") {
+    max_imag.push_back(std::make_pair("rotation matrix (basis_input_file)",
+                                      max_imag_in_file(parameters["model.basis_input_file"].as<std::string>(), 2,
+                                                       flavors * flavors)));
+  }
+
+  for (int i = 0; i < max_imag.size(); ++i) {
+    if (max_imag[i].second > tolerance) {
+      reason = boost::str(boost::format("%1% has imaginary parts (max |Im| = %2%)") % max_imag[i].first % max_imag[i].second);
+      return false;
+    }
+  }
+  reason = boost::str(boost::format("imaginary parts of all inputs are below %1%") % tolerance);
+  return true;
+}
+
+}
+}
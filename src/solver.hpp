@@ -41,6 +41,13 @@ class Solver {
 
   virtual int solve(const std::string& dump_file = "") = 0;
 
+  /**
+   * Check if the model can be solved in real arithmetic (MatrixSolver<double>):
+   * the U tensor, the hopping matrix, Delta(tau) and the rotation matrix must have no imaginary parts larger than tolerance.
+   * The parameters of the solver must be defined. reason is set to a message explaining the result.
+   */
+  static bool is_real_problem(const alps::params &parameters, std::string &reason, double tolerance = 1E-12);
+
   /** Get a reference to a collection of results */
   virtual const std::map<std::string,boost::any>& get_results() const = 0;
 
@@ -204,6 +204,27 @@ double spectral_norm_diag(const M &mat) {
   }
 }
 
+//Cheap upper bound on the spectral norm
+template<typename SCALAR, typename M>
+double frobenius_norm(const M &mat) {
+  if (size1(mat) == 0 || size2(mat) == 0) {
+    return 0.0;
+  }
+  return mat.norm();
+}
+
+//Cheap upper bound on the spectral norm: ||A||_2 <= sqrt(||A||_1 ||A||_inf) (Hoelder), capped by the Frobenius norm.
+//It is exact for diagonal and permutation-like matrices, which are common for bras/kets in small sectors.
+template<typename SCALAR, typename M>
+double holder_norm_bound(const M &mat) {
+  if (size1(mat) == 0 || size2(mat) == 0) {
+    return 0.0;
+  }
+  const double norm_1 = mat.cwiseAbs().colwise().sum().maxCoeff();
+  const double norm_inf = mat.cwiseAbs().rowwise().sum().maxCoeff();
+  return std::min(std::sqrt(norm_1 * norm_inf), frobenius_norm<SCALAR>(mat));
+}
+
 //Extract real parts of boost::muliti_array
 template<class SCALAR, int DIMENSION>
 boost::multi_array<double, DIMENSION>
@@ -1,13 +1,15 @@
 //
 // Define USE_QUAD_FLAOT to activate the support of quad floats
 //  Some of operations will be performed using quad floats.
+// Define USE_SCALED_DOUBLE to use (double mantissa, 64-bit exponent) scalars instead.
+//  This avoids overflow/underflow like quad floats at near-double speed (takes precedence over USE_QUAD_PRECISION).
 //
 
 #pragma once
 
 #include <complex>
 
-#ifndef USE_QUAD_PRECISION
+#if !defined(USE_QUAD_PRECISION) && !defined(USE_SCALED_DOUBLE)
 
 typedef double EXTENDED_REAL;
 typedef std::complex<double> EXTENDED_COMPLEX;
@@ -43,8 +45,13 @@ inline std::complex<double> convert_to_complex(const std::complex<double>& x) {
 
 #else
 
+#ifdef USE_SCALED_DOUBLE
+#include "scaled_double.hpp"
+typedef scaled_double EXTENDED_REAL;
+#else
 #include <boost/multiprecision/cpp_bin_float.hpp>
 typedef boost::multiprecision::cpp_bin_float_quad EXTENDED_REAL;
+#endif
 
 template<typename T>
 class wcomplex;
@@ -273,6 +280,21 @@ inline EXTENDED_REAL get_imag(const EXTENDED_REAL &x) {
 //return x.real();
 //}
 
+#ifdef USE_SCALED_DOUBLE
+inline EXTENDED_REAL myabs(const EXTENDED_REAL &x) {
+  return abs(x);
+}
+
+inline EXTENDED_REAL
+myabs(const wcomplex<EXTENDED_REAL> &x) {
+  return hypot(x.real(), x.imag());
+}
+
+inline
+bool my_isnan(const EXTENDED_REAL &x) {
+  return isnan(x);
+}
+#else
 inline EXTENDED_REAL myabs(EXTENDED_REAL x) {
   return boost::multiprecision::abs(x);
 }
@@ -286,16 +308,24 @@ inline
 bool my_isnan(EXTENDED_REAL x) {
   return boost::math::isnan(x);
 }
+#endif
 
 inline
 bool my_isnan(wcomplex<EXTENDED_REAL> x) {
   return my_isnan(x.real()) || my_isnan(x.imag());
 }
 
+#ifdef USE_SCALED_DOUBLE
+template<typename T>
+EXTENDED_REAL mypow(const EXTENDED_REAL &x, T N) {
+  return pow(x, N);
+}
+#else
 template<typename T>
 EXTENDED_REAL mypow(EXTENDED_REAL x, T N) {
   return boost::multiprecision::pow(x, N);
 }
+#endif
 
 /*
  * Cast operator
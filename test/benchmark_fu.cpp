@@ -0,0 +1,68 @@
+//Timings of the fast-update formulas. This is not a unit test and is not run by ctest.
+//Usage: benchmark_fu [N] [number of repetitions]
+#include <cstdlib>
+#include <ctime>
+#include <iostream>
+
+#include <boost/random.hpp>
+
+#include <alps/fastupdate/fastupdate_formula.hpp>
+
+template<class M>
+void randomize_matrix(M& mat, int seed) {
+  boost::random::mt19937 gen;
+  boost::random::uniform_01<double> dist;
+  gen.seed(seed);
+
+  for (int j=0; j<mat.cols(); ++j) {
+    for (int i=0; i<mat.rows(); ++i) {
+      mat(i,j) = dist(gen);
+    }
+  }
+}
+
+//Insertion and removal of a single row and col: general block-matrix formula vs. Sherman-Morrison formula
+int main(int argc, char** argv) {
+  using namespace alps::fastupdate;
+
+  typedef double Scalar;
+  typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> eigen_matrix_t;
+
+  const int N = argc > 1 ? std::atoi(argv[1]) : 100;
+  const int n_rep = argc > 2 ? std::atoi(argv[2]) : 500;
+
+  eigen_matrix_t A(N,N), B(N,1), C(1,N), D(1,1);
+  randomize_matrix(A, 100);
+  randomize_matrix(B, 200);
+  randomize_matrix(C, 300);
+  randomize_matrix(D, 400);
+
+  ResizableMatrix<Scalar> invA(N,N), invA_rank1(N,N);
+  invA = A.inverse();
+  invA_rank1 = A.inverse();
+
+  FastUpdateWorkspace<Scalar> ws, ws_rank1;
+
+  std::clock_t start = std::clock();
+  for (int rep=0; rep<n_rep; ++rep) {
+    compute_det_ratio_up<Scalar>(B, C, D, invA, ws);
+    compute_inverse_matrix_up(B, C, D, invA, ws);
+    compute_inverse_matrix_down(1, invA, ws);
+  }
+  const double time_general = static_cast<double>(std::clock() - start)/CLOCKS_PER_SEC;
+
+  start = std::clock();
+  for (int rep=0; rep<n_rep; ++rep) {
+    compute_det_ratio_up_rank1<Scalar>(B, C, D(0,0), invA_rank1, ws_rank1);
+    compute_inverse_matrix_up_rank1(B, C, D(0,0), invA_rank1, ws_rank1);
+    compute_inverse_matrix_down_rank1(invA_rank1);
+  }
+  const double time_rank1 = static_cast<double>(std::clock() - start)/CLOCKS_PER_SEC;
+
+  std::cout << "Insertion and removal of a row and col, N = " << N << ", " << n_rep << " times: "
+            << "general formula " << time_general << " sec, rank-1 formula " << time_rank1 << " sec" << std::endl;
+  std::cout << "Difference of the inverse matrices: "
+            << (invA.block()-invA_rank1.block()).squaredNorm() << std::endl;
+
+  return 0;
+}
@@ -53,6 +53,125 @@ TEST(FastUpdate, BlockMatrixAdd)
   }
 }
 
+//The same work space is reused for matrices of various sizes
+TEST(FastUpdate, WorkSpace)
+{
+  using namespace alps::fastupdate;
+
+  typedef double Scalar;
+  typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> eigen_matrix_t;
+
+  std::vector<int> N_list, M_list;
+  N_list.push_back(0);
+  N_list.push_back(20);
+  N_list.push_back(3);
+
+  M_list.push_back(1);
+  M_list.push_back(2);
+  M_list.push_back(8);
+
+  FastUpdateWorkspace<Scalar> ws;
+  for (int n=0; n<N_list.size(); ++n) {
+    for (int m=0; m<M_list.size(); ++m) {
+      const int N = N_list[n];
+      const int M = M_list[m];
+
+      eigen_matrix_t A(N,N), B(N,M), C(M,N), D(M,M), new_row(1,N+M), new_col(N+M,1);
+      randomize_matrix(A, 100);
+      randomize_matrix(B, 200);
+      randomize_matrix(C, 300);
+      randomize_matrix(D, 400);
+      randomize_matrix(new_row, 500);
+      randomize_matrix(new_col, 600);
+
+      ResizableMatrix<Scalar> invA(N,N), invA_ws(N,N);
+      if (N>0) {
+        invA = A.inverse();
+        invA_ws = A.inverse();
+      }
+
+      //adding rows and cols
+      const Scalar det_rat = compute_det_ratio_up<Scalar>(B, C, D, invA);
+      ASSERT_NEAR(det_rat, compute_det_ratio_up<Scalar>(B, C, D, invA_ws, ws), 1E-8*std::abs(det_rat));
+      compute_inverse_matrix_up(B, C, D, invA);
+      compute_inverse_matrix_up(B, C, D, invA_ws, ws);
+      ASSERT_TRUE(norm_square(invA-invA_ws)<1E-8) << "N=" << N << " M=" << M;
+
+      //replacing the last row and col
+      const Scalar det_rat_row = compute_det_ratio_relace_last_row(invA, new_row);
+      compute_inverse_matrix_replace_last_row(invA, new_row, det_rat_row);
+      compute_inverse_matrix_replace_last_row(invA_ws, new_row, det_rat_row, ws);
+      ASSERT_TRUE(norm_square(invA-invA_ws)<1E-8) << "N=" << N << " M=" << M;
+
+      const Scalar det_rat_col = compute_det_ratio_relace_last_col(invA, new_col);
+      compute_inverse_matrix_replace_last_col(invA, new_col, det_rat_col);
+      compute_inverse_matrix_replace_last_col(invA_ws, new_col, det_rat_col, ws);
+      ASSERT_TRUE(norm_square(invA-invA_ws)<1E-8) << "N=" << N << " M=" << M;
+
+      //removing the last rows and cols
+      compute_inverse_matrix_down(M, invA);
+      compute_inverse_matrix_down(M, invA_ws, ws);
+      ASSERT_TRUE(norm_square(invA-invA_ws)<1E-8) << "N=" << N << " M=" << M;
+    }
+  }
+}
+
+//Sherman-Morrison formula for a single row and col vs. the general block-matrix formula.
+//Only the correctness is checked here. See benchmark_fu.cpp for the timings.
+TEST(FastUpdate, RankOneUpdate)
+{
+  using namespace alps::fastupdate;
+
+  typedef double Scalar;
+  typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> eigen_matrix_t;
+
+  const int N = 100;
+
+  eigen_matrix_t A(N,N), B(N,1), C(1,N), D(1,1);
+  randomize_matrix(A, 100);
+  randomize_matrix(B, 200);
+  randomize_matrix(C, 300);
+  randomize_matrix(D, 400);
+
+  ResizableMatrix<Scalar> invA(N,N), invA_rank1(N,N), BigMatrix(N+1, N+1, 0);
+  invA = A.inverse();
+  invA_rank1 = A.inverse();
+  copy_block(A,0,0,BigMatrix,0,0,N,N);
+  copy_block(B,0,0,BigMatrix,0,N,N,1);
+  copy_block(C,0,0,BigMatrix,N,0,1,N);
+  copy_block(D,0,0,BigMatrix,N,N,1,1);
+
+  FastUpdateWorkspace<Scalar> ws, ws_rank1;
+
+  //correctness
+  const Scalar det_rat = compute_det_ratio_up<Scalar>(B, C, D, invA, ws);
+  const Scalar det_rat_rank1 = compute_det_ratio_up_rank1<Scalar>(B, C, D(0,0), invA_rank1, ws_rank1);
+  ASSERT_NEAR(det_rat, det_rat_rank1, 1E-8*std::abs(det_rat));
+  ASSERT_NEAR(det_rat, determinant(BigMatrix)/A.determinant(), 1E-8*std::abs(det_rat));
+
+  compute_inverse_matrix_up(B, C, D, invA, ws);
+  compute_inverse_matrix_up_rank1(B, C, D(0,0), invA_rank1, ws_rank1);
+  ASSERT_TRUE(norm_square(inverse(BigMatrix)-invA_rank1)<1E-8);
+  ASSERT_TRUE(norm_square(invA-invA_rank1)<1E-8);
+
+  compute_inverse_matrix_down(1, invA, ws);
+  compute_inverse_matrix_down_rank1(invA_rank1);
+  ASSERT_TRUE(norm_square(invA-invA_rank1)<1E-8);
+  ASSERT_TRUE((A.inverse()-invA_rank1.block()).squaredNorm()<1E-8);
+
+  //repeated insertion and removal
+  for (int rep=0; rep<10; ++rep) {
+    compute_det_ratio_up<Scalar>(B, C, D, invA, ws);
+    compute_inverse_matrix_up(B, C, D, invA, ws);
+    compute_inverse_matrix_down(1, invA, ws);
+
+    compute_det_ratio_up_rank1<Scalar>(B, C, D(0,0), invA_rank1, ws_rank1);
+    compute_inverse_matrix_up_rank1(B, C, D(0,0), invA_rank1, ws_rank1);
+    compute_inverse_matrix_down_rank1(invA_rank1);
+  }
+  ASSERT_TRUE(norm_square(invA-invA_rank1)<1E-8);
+}
+
 
 void select_rows_removed(unsigned int seed, int N, int M, std::vector<int>& rows_removed, std::vector<int>& rows_remain) {
   boost::mt19937 gen(seed);
@@ -654,3 +773,172 @@ TYPED_TEST(DeterminantMatrixTypedTest, ReplaceRowCol) {
   }
 
 }
+
+TYPED_TEST(DeterminantMatrixTypedTest, DelayedUpdates) {
+  using namespace alps::fastupdate;
+  typedef std::complex<double> Scalar;
+  typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> eigen_matrix_t;
+
+  const int n_flavors = 2;
+  const double beta = 1.0;
+  const int max_delayed_rank = 6;
+  typedef TypeParam determinant_matrix_t;
+  const int seed = 124;
+  boost::mt19937 gen(seed);
+  boost::uniform_01<> unidist;
+  rs_shuffle rs(gen);
+
+  std::vector<double> E(n_flavors);
+  boost::multi_array<Scalar,2> phase(boost::extents[n_flavors][n_flavors]);
+
+  for (int i=0; i<n_flavors; ++i) {
+    E[i] = 0.001;
+  }
+  for (int i=0; i<n_flavors; ++i) {
+    for (int j=i; j<n_flavors; ++j) {
+      phase[i][j] = std::exp(std::complex<double>(0.0, 1.*i*(2*j+1.0)));
+      phase[j][i] = std::conj(phase[i][j]);
+    }
+  }
+
+  boost::shared_ptr<OffDiagonalG0<Scalar> > p_gf(new OffDiagonalG0<Scalar>(beta, n_flavors, E, phase));
+  determinant_matrix_t det_mat(p_gf), det_mat_delayed(p_gf);
+  det_mat_delayed.set_max_delayed_rank(max_delayed_rank);
+
+  /*
+   * The same updates are applied to both matrices: det_mat is updated immediately, while updates are delayed in det_mat_delayed.
+   */
+  for (int itest=0; itest<1000; ++itest) {
+    const int pert_order = det_mat.size();
+
+    std::vector<creator> cdagg_rem, cdagg_add;
+    std::vector<annihilator> c_rem, c_add;
+    int num_rem_cdagg = 0, num_rem_c = 0, num_add_cdagg = 0, num_add_c = 0;
+    const double r = unidist(gen);
+    if (r < 0.4 || pert_order == 0) {
+      num_add_cdagg = num_add_c = 1 + static_cast<int>(unidist(gen) * 3);
+    } else if (r < 0.7) {
+      num_rem_cdagg = num_rem_c = 1 + static_cast<int>(unidist(gen) * std::min(pert_order, 3));
+    } else if (r < 0.8) {
+      num_rem_cdagg = num_add_cdagg = 1;
+    } else if (r < 0.9) {
+      num_rem_c = num_add_c = 1;
+    } else {
+      num_rem_cdagg = num_rem_c = 1;
+      num_add_cdagg = num_add_c = 2;
+    }
+
+    //Operators are removed in pairs of the same flavor
+    std::vector<creator> cdagg_ops = det_mat.get_cdagg_ops();
+    std::vector<annihilator> c_ops = det_mat.get_c_ops();
+    std::random_shuffle(cdagg_ops.begin(), cdagg_ops.end(), rs);
+    std::random_shuffle(c_ops.begin(), c_ops.end(), rs);
+    for (int i = 0; i < std::max(num_rem_cdagg, num_rem_c); ++i) {
+      const int flavor = cdagg_ops[i].flavor();
+      for (int j = 0; j < static_cast<int>(c_ops.size()); ++j) {
+        if (c_ops[j].flavor() == flavor) {
+          if (i < num_rem_cdagg) {
+            cdagg_rem.push_back(cdagg_ops[i]);
+          }
+          if (i < num_rem_c) {
+            c_rem.push_back(c_ops[j]);
+          }
+          c_ops.erase(c_ops.begin() + j);
+          break;
+        }
+      }
+    }
+
+    //Replaced operators keep their flavors
+    if (num_add_c == 0) {
+      cdagg_add.push_back(creator(cdagg_rem[0].flavor(), unidist(gen) * beta));
+    } else if (num_add_cdagg == 0) {
+      c_add.push_back(annihilator(c_rem[0].flavor(), unidist(gen) * beta));
+    } else {
+      for (int i = 0; i < num_add_cdagg; ++i) {
+        const int flavor = n_flavors * unidist(gen);
+        cdagg_add.push_back(creator(flavor, unidist(gen) * beta));
+        c_add.push_back(annihilator(flavor, unidist(gen) * beta));
+      }
+    }
+
+    const Scalar det_rat = det_mat.try_update(
+      cdagg_rem.begin(), cdagg_rem.end(),
+      c_rem.begin(),     c_rem.end(),
+      cdagg_add.begin(), cdagg_add.end(),
+      c_add.begin(),     c_add.end()
+    );
+    const Scalar det_rat_delayed = det_mat_delayed.try_update(
+      cdagg_rem.begin(), cdagg_rem.end(),
+      c_rem.begin(),     c_rem.end(),
+      cdagg_add.begin(), cdagg_add.end(),
+      c_add.begin(),     c_add.end()
+    );
+    ASSERT_TRUE(std::abs(det_rat_delayed-det_rat) < 1E-8 * std::max(std::abs(det_rat), 1.0));
+
+    const bool singular =  std::abs(det_rat) < 1E-5 || std::abs(det_rat) > 1E+5;
+
+    const int pert_order0 = 20;
+    const int new_pert_order = pert_order + num_add_cdagg - num_rem_cdagg;
+    const double p = std::exp(
+      -(new_pert_order+pert_order-2*pert_order0)*(new_pert_order-pert_order)/5.0
+    );
+    if (std::abs(det_rat)*p > unidist(gen) && !singular) {
+      det_mat.perform_update();
+      det_mat_delayed.perform_update();
+    } else {
+      det_mat.reject_update();
+      det_mat_delayed.reject_update();
+    }
+
+    //check inverse matrix
+    ASSERT_EQ(det_mat.size(), det_mat_delayed.size());
+    if (det_mat.size() > 0) {
+      const eigen_matrix_t inv_mat = det_mat.compute_inverse_matrix();
+      const eigen_matrix_t inv_mat_delayed = det_mat_delayed.compute_inverse_matrix();
+      ASSERT_TRUE((inv_mat-inv_mat_delayed).squaredNorm()/inv_mat.squaredNorm() < 1E-8);
+      ASSERT_TRUE(std::abs(det_mat_delayed.compute_determinant()/det_mat.compute_determinant()-1.0) < 1E-8);
+    }
+
+    //Remove accumulated rounding errors, which differ between the two matrices
+    if (itest % 10 == 9) {
+      det_mat.rebuild_inverse_matrix();
+      det_mat_delayed.rebuild_inverse_matrix();
+    }
+  }
+
+  det_mat_delayed.flush_delayed_updates();
+  const eigen_matrix_t inv_mat = det_mat_delayed.compute_inverse_matrix();
+  det_mat_delayed.rebuild_inverse_matrix();
+  const eigen_matrix_t inv_mat_rebuilt = det_mat_delayed.compute_inverse_matrix();
+  if (det_mat_delayed.size() > 0) {
+    ASSERT_TRUE((inv_mat-inv_mat_rebuilt).squaredNorm()/inv_mat_rebuilt.squaredNorm() < 1E-8);
+  }
+}
+
+TEST(FastUpdate, FlatPositionMap)
+{
+  alps::fastupdate::detail::FlatPositionMap<double> map;
+
+  ASSERT_TRUE(map.insert(0.5, 0));
+  ASSERT_TRUE(map.insert(0.1, 1));
+  ASSERT_TRUE(map.insert(0.9, 2));
+  ASSERT_FALSE(map.insert(0.5, 3));
+  ASSERT_EQ(3, map.size());
+
+  ASSERT_EQ(0.1, map.begin()->first);
+  ASSERT_EQ(0, map.at(0.5));
+  ASSERT_EQ(3, map.count_not_less(0.0));
+  ASSERT_EQ(2, map.count_not_less(0.5));
+  ASSERT_EQ(1, map.count_not_less(0.6));
+  ASSERT_EQ(0, map.count_not_less(1.0));
+
+  map.set(0.5, 4);
+  ASSERT_EQ(4, map.at(0.5));
+
+  map.erase(0.5);
+  ASSERT_FALSE(map.contains(0.5));
+  ASSERT_TRUE(map.contains(0.9));
+  ASSERT_THROW(map.at(0.5), std::out_of_range);
+  ASSERT_EQ(2, map.size());
+}
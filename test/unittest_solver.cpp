@@ -102,6 +102,788 @@ TEST(ModelLibrary, AutoPartioning) {
   ImpurityModelEigenBasis<SCALAR> model(par, t_list, Uval_list);
 }
 
+//Two-orbital Hubbard-Kanamori model with non-degenerate orbitals
+template<typename MODEL>
+boost::shared_ptr<MODEL> create_two_orbital_model(double beta, alps::params &par) {
+  const int sites = 2;
+  par["model.sites"] = sites;
+  par["model.spins"] = 2;
+  par["model.n_tau_hyb"] = 1000;
+  par["model.beta"] = beta;
+  typedef double SCALAR;
+  const double onsite_U = 2.0;
+  const double JH = 0.2;
+
+  std::vector<boost::tuple<int, int, int, int, SCALAR> > Uval_list;
+  for (int isp = 0; isp < 2; ++isp) {
+    for (int isp2 = 0; isp2 < 2; ++isp2) {
+      for (int alpha = 0; alpha < sites; ++alpha) {
+        Uval_list.push_back(get_tuple<SCALAR>(alpha, alpha, alpha, alpha, isp, isp2, onsite_U, sites));
+      }
+      for (int alpha = 0; alpha < sites; ++alpha) {
+        for (int alpha2 = 0; alpha2 < sites; ++alpha2) {
+          if (alpha == alpha2) continue;
+          Uval_list.push_back(get_tuple<SCALAR>(alpha, alpha2, alpha, alpha2, isp, isp2, onsite_U - 2 * JH, sites));
+          Uval_list.push_back(get_tuple<SCALAR>(alpha, alpha2, alpha2, alpha, isp, isp2, JH, sites));
+        }
+      }
+    }
+  }
+
+  std::vector<boost::tuple<int, int, SCALAR> > t_list;
+  for (int isp = 0; isp < 2; ++isp) {
+    for (int alpha = 0; alpha < sites; ++alpha) {
+      t_list.push_back(boost::make_tuple(alpha + isp * sites, alpha + isp * sites, -0.5 * onsite_U + 0.1 * alpha));
+    }
+  }
+
+  MODEL::define_parameters(par);
+  return boost::shared_ptr<MODEL>(new MODEL(par, t_list, Uval_list));
+}
+
+boost::shared_ptr<REAL_EIGEN_BASIS_MODEL> create_two_orbital_model(double beta, bool outer_state_sampling = false) {
+  alps::params par;
+  par["model.outer_state_sampling"] = outer_state_sampling ? 1 : 0;
+  return create_two_orbital_model<REAL_EIGEN_BASIS_MODEL>(beta, par);
+}
+
+//Alternating creation and annihilation operators for each flavor give a non-zero trace
+void generate_operator_pairs(int num_flavors, int num_pairs_per_flavor, double beta, boost::random::mt19937 &gen,
+                             std::vector<std::pair<psi, psi> > &pairs) {
+  boost::uniform_real<> uni_dist(0, 1);
+  pairs.resize(0);
+  for (int flavor = 0; flavor < num_flavors; ++flavor) {
+    std::vector<double> times;
+    for (int i = 0; i < 2 * num_pairs_per_flavor; ++i) {
+      times.push_back(beta * uni_dist(gen));
+    }
+    std::sort(times.begin(), times.end());
+    for (int i = 0; i < times.size(); i += 2) {
+      pairs.push_back(std::make_pair(psi(OperatorTime(times[i]), CREATION_OP, flavor),
+                                     psi(OperatorTime(times[i + 1]), ANNIHILATION_OP, flavor)));
+    }
+  }
+}
+
+TEST(SlidingWindow, TraceTreeVsStack) {
+  const double beta = 10.0;
+  boost::shared_ptr<REAL_EIGEN_BASIS_MODEL> p_model = create_two_orbital_model(beta);
+
+  boost::random::mt19937 gen(100);
+  std::vector<std::pair<psi, psi> > pairs;
+  generate_operator_pairs(p_model->num_flavors(), 5, beta, gen, pairs);
+  operator_container_t operators;
+  for (int i = 0; i < pairs.size(); ++i) {
+    operators.insert(pairs[i].first);
+    operators.insert(pairs[i].second);
+  }
+
+  SlidingWindowManager<REAL_EIGEN_BASIS_MODEL> sw_stack(p_model.get(), beta), sw_tree(p_model.get(), beta);
+  sw_stack.init_stacks(1, operators);
+  sw_tree.set_trace_engine(TREE_ENGINE);
+  sw_tree.init_stacks(1, operators);
+
+  //Remove pairs one by one and go back to the initial configuration
+  for (int step = 0; step < 2 * pairs.size(); ++step) {
+    const EXTENDED_REAL trace_stack = get_real(sw_stack.compute_trace(operators));
+    const EXTENDED_REAL trace_tree = get_real(sw_tree.compute_trace(operators));
+    ASSERT_TRUE(trace_stack != 0.0);
+    ASSERT_TRUE(myabs(trace_stack - trace_tree) <= 1E-8 * myabs(trace_stack));
+    if (step < pairs.size()) {
+      safe_erase(operators, pairs[step].first);
+      safe_erase(operators, pairs[step].second);
+    } else {
+      operators.insert(pairs[2 * pairs.size() - 1 - step].first);
+      operators.insert(pairs[2 * pairs.size() - 1 - step].second);
+    }
+  }
+}
+
+TEST(SlidingWindow, OuterStateSampling) {
+  const double beta = 10.0;
+  boost::shared_ptr<REAL_EIGEN_BASIS_MODEL> p_model = create_two_orbital_model(beta);
+  boost::shared_ptr<REAL_EIGEN_BASIS_MODEL> p_model_sampling = create_two_orbital_model(beta, true);
+  ASSERT_EQ(p_model_sampling->num_brakets(), 1);
+  ASSERT_EQ(p_model_sampling->num_outer_states(), 16);
+
+  boost::random::mt19937 gen(100);
+  std::vector<std::pair<psi, psi> > pairs;
+  generate_operator_pairs(p_model->num_flavors(), 5, beta, gen, pairs);
+  operator_container_t operators;
+  for (int i = 0; i < pairs.size(); ++i) {
+    operators.insert(pairs[i].first);
+    operators.insert(pairs[i].second);
+  }
+
+  SlidingWindowManager<REAL_EIGEN_BASIS_MODEL> sw(p_model.get(), beta);
+  sw.init_stacks(4, operators);
+  const EXTENDED_REAL trace = get_real(sw.compute_trace(operators));
+
+  //The trace is the sum of the contributions of the outer states
+  SlidingWindowManager<REAL_EIGEN_BASIS_MODEL> sw_sampling(p_model_sampling.get(), beta);
+  EXTENDED_REAL trace_sum = 0.0;
+  for (int outer_state = 0; outer_state < p_model_sampling->num_outer_states(); ++outer_state) {
+    p_model_sampling->set_outer_state(outer_state);
+    sw_sampling.init_stacks(4, operators);
+    ASSERT_TRUE(sw_sampling.get_ket(0).invalid() || sw_sampling.get_ket(0).obj().cols() == 1);
+    trace_sum += get_real(sw_sampling.compute_trace(operators));
+  }
+  ASSERT_TRUE(myabs(trace_sum - trace) < 1E-8 * myabs(trace));
+}
+
+TEST(SlidingWindow, StackCache) {
+  const double beta = 10.0;
+  boost::shared_ptr<REAL_EIGEN_BASIS_MODEL> p_model = create_two_orbital_model(beta);
+
+  boost::random::mt19937 gen(100);
+  std::vector<std::pair<psi, psi> > pairs;
+  generate_operator_pairs(p_model->num_flavors(), 5, beta, gen, pairs);
+  operator_container_t operators;
+  for (int i = 0; i < pairs.size(); ++i) {
+    operators.insert(pairs[i].first);
+    operators.insert(pairs[i].second);
+  }
+
+  SlidingWindowManager<REAL_EIGEN_BASIS_MODEL> sw(p_model.get(), beta);
+  sw.init_stacks(4, operators);
+
+  const int n_windows[] = {4, 2, 8, 4, 1, 2, 4};
+  for (int step = 0; step < sizeof(n_windows) / sizeof(int); ++step) {
+    const int n_window = n_windows[step];
+    const int pos_right_edge = step % 2 == 0 ? 0 : 2 * n_window - 2;
+    sw.set_window_size(n_window, operators, pos_right_edge, step % 2 == 0 ? ITIME_LEFT : ITIME_RIGHT);
+
+    SlidingWindowManager<REAL_EIGEN_BASIS_MODEL> sw_ref(p_model.get(), beta);
+    sw_ref.init_stacks(1, operators);
+    sw_ref.set_window_size(n_window, operators, pos_right_edge, step % 2 == 0 ? ITIME_LEFT : ITIME_RIGHT);
+
+    const EXTENDED_REAL trace = get_real(sw.compute_trace(operators));
+    const EXTENDED_REAL trace_ref = get_real(sw_ref.compute_trace(operators));
+    ASSERT_TRUE(trace_ref != 0.0);
+    ASSERT_TRUE(myabs(trace - trace_ref) <= 1E-8 * myabs(trace_ref));
+
+    //modify the configuration in the middle of the window
+    if (step == 2) {
+      safe_erase(operators, pairs[0].first);
+      safe_erase(operators, pairs[0].second);
+    }
+  }
+  ASSERT_TRUE(sw.get_stack_cache_stats().first > 0);
+}
+
+//The stacks built for the proposed configuration of a global update must not be reused for the current one
+TEST(SlidingWindow, StackCacheAfterGlobalUpdate) {
+  typedef double SCALAR;
+  const double beta = 10.0;
+  boost::shared_ptr<REAL_EIGEN_BASIS_MODEL> p_model = create_two_orbital_model(beta);
+  const int n_flavors = p_model->num_flavors();
+
+  boost::random::mt19937 gen(100);
+  std::vector<std::pair<psi, psi> > pairs;
+  generate_operator_pairs(n_flavors, 5, beta, gen, pairs);
+
+  const int n_tau = 1000;
+  boost::multi_array<SCALAR, 3> F(boost::extents[n_flavors][n_flavors][n_tau + 1]);
+  std::fill(F.origin(), F.origin() + F.num_elements(), 0.0);
+  for (int flavor = 0; flavor < n_flavors; ++flavor) {
+    for (int itau = 0; itau < n_tau + 1; ++itau) {
+      F[flavor][flavor][itau] = -0.5;
+    }
+  }
+  boost::shared_ptr<HybridizationFunction<SCALAR> > p_F(new HybridizationFunction<SCALAR>(beta, n_tau, n_flavors, F));
+
+  MonteCarloConfiguration<SCALAR> mc_config(p_F);
+  MonteCarloConfiguration<SCALAR>::DeterminantMatrixType M(p_F, pairs.begin(), pairs.end());
+  std::swap(mc_config.M, M);
+  for (int i = 0; i < pairs.size(); ++i) {
+    mc_config.operators.insert(pairs[i].first);
+    mc_config.operators.insert(pairs[i].second);
+  }
+  mc_config.perm_sign = compute_permutation_sign(mc_config);
+
+  const int n_window = 4;
+  SlidingWindowManager<REAL_EIGEN_BASIS_MODEL> sw(p_model.get(), beta);
+  sw.init_stacks(n_window, mc_config.operators);
+  mc_config.trace = sw.compute_trace(mc_config.operators);
+  ASSERT_TRUE(mc_config.trace != 0.0);
+
+  alps::random01 rng(100);
+  const double shifts[] = {0.37 * beta, 0.81 * beta};
+  for (int i_shift = 0; i_shift < sizeof(shifts) / sizeof(double); ++i_shift) {
+    //same sequence of window sizes as in HybridizationSimulation::global_updates()
+    sw.set_window_size(1, mc_config.operators);
+    std::vector<SCALAR> det_vec = mc_config.M.compute_determinant_as_product();
+    global_update<SCALAR, EXTENDED_REAL>(rng, beta, mc_config, det_vec, sw, n_flavors,
+                                         OperatorShift(beta, shifts[i_shift]), WormShift(beta, shifts[i_shift]), 10);
+    sw.set_window_size(n_window, mc_config.operators, 0, ITIME_LEFT);
+
+    SlidingWindowManager<REAL_EIGEN_BASIS_MODEL> sw_ref(p_model.get(), beta);
+    sw_ref.init_stacks(n_window, mc_config.operators);
+
+    const EXTENDED_REAL trace = get_real(sw.compute_trace(mc_config.operators));
+    const EXTENDED_REAL trace_ref = get_real(sw_ref.compute_trace(mc_config.operators));
+    ASSERT_TRUE(trace_ref != 0.0);
+    ASSERT_TRUE(myabs(trace - trace_ref) <= 1E-8 * myabs(trace_ref));
+  }
+}
+
+TEST(MatrixPool, ReuseStorage) {
+  typedef Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic> matrix_t;
+  MatrixPool<matrix_t> pool;
+  matrix_t mat;
+  pool.acquire(3, 4, mat);
+  const double *p_data = mat.data();
+  pool.release(mat);
+  ASSERT_EQ(mat.size(), 0);
+
+  //The same number of elements
+  pool.acquire(4, 3, mat);
+  ASSERT_TRUE(mat.data() == p_data);
+  ASSERT_EQ(mat.rows(), 4);
+  ASSERT_EQ(mat.cols(), 3);
+  ASSERT_EQ(pool.stats().first, 1);
+  ASSERT_EQ(pool.stats().second, 1);
+}
+
+TEST(ExpVectorCache, SameAsScalarExp) {
+  std::vector<double> energies;
+  for (int i = 0; i < 37; ++i) {
+    energies.push_back(0.3 * i - 2.0);
+  }
+  ExpVectorCache cache(2);
+  const double taus[] = {0.1, 5.0, 100.0, 0.1, 5.0};
+  for (int itau = 0; itau < 5; ++itau) {
+    std::vector<double> exp_ref;
+    const double coeff_ref = compute_exp_vector_safe(taus[itau], energies, exp_ref);
+    double coeff;
+    const ExpVectorCache::vector_t &exp_v = cache.get(0, taus[itau], energies, coeff);
+    ASSERT_NEAR(coeff, coeff_ref, 1E-12 * coeff_ref);
+    for (int i = 0; i < energies.size(); ++i) {
+      ASSERT_NEAR(exp_v[i], exp_ref[i], 1E-13 * exp_ref[i]);
+    }
+  }
+  //Only the last two values of tau are kept
+  ASSERT_EQ(cache.stats().first, 0);
+  ASSERT_EQ(cache.stats().second, 5);
+  double coeff;
+  cache.get(0, 0.1, energies, coeff);
+  cache.get(0, 5.0, energies, coeff);
+  ASSERT_EQ(cache.stats().first, 2);
+}
+
+TEST(OperatorMatrix, AllFormats) {
+  typedef Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic> matrix_t;
+  boost::random::mt19937 gen(100);
+  boost::random::uniform_real_distribution<> dist(-1.0, 1.0);
+
+  //Two blocks with permuted rows/columns: rows {0, 2, 4} x cols {1, 3}, rows {1, 3} x cols {0, 2, 4, 5}
+  const int N = 5, M = 6;
+  matrix_t mat(N, M);
+  mat.setZero();
+  for (int i = 0; i < N; ++i) {
+    for (int j = 0; j < M; ++j) {
+      if ((i % 2 == 0) == (j == 1 || j == 3)) {
+        mat(i, j) = dist(gen);
+      }
+    }
+  }
+  const matrix_t ket = matrix_t::Random(M, 3), bra = matrix_t::Random(2, N);
+
+  const OPERATOR_MATRIX_FORMAT formats[] = {DENSE_FORMAT, CSR_FORMAT, BLOCK_FORMAT};
+  for (int f = 0; f < 3; ++f) {
+    OperatorMatrix<double> op;
+    op.set(mat, false, formats[f]);
+    ASSERT_EQ(op.format(), formats[f]);
+    ASSERT_EQ(op.rows(), N);
+    ASSERT_EQ(op.cols(), M);
+
+    matrix_t y_ket(N, 3), y_bra(2, M);
+    op.apply_ket(ket, y_ket);
+    op.apply_bra(bra, y_bra);
+    ASSERT_TRUE((y_ket - mat * ket).cwiseAbs().maxCoeff() < 1E-12);
+    ASSERT_TRUE((y_bra - bra * mat).cwiseAbs().maxCoeff() < 1E-12);
+
+    //work space taken from a pool is recycled in the second round
+    MatrixPool<matrix_t> pool;
+    for (int round = 0; round < 2; ++round) {
+      op.apply_ket(ket, y_ket, &pool);
+      op.apply_bra(bra, y_bra, &pool);
+      ASSERT_TRUE((y_ket - mat * ket).cwiseAbs().maxCoeff() < 1E-12);
+      ASSERT_TRUE((y_bra - bra * mat).cwiseAbs().maxCoeff() < 1E-12);
+    }
+    if (formats[f] == BLOCK_FORMAT) {
+      ASSERT_EQ(pool.stats().first, pool.stats().second);
+    }
+  }
+
+  //A diagonal matrix is stored in the CSR format
+  OperatorMatrix<double> op;
+  op.set(matrix_t::Identity(50, 50));
+  ASSERT_EQ(op.format(), CSR_FORMAT);
+  ASSERT_TRUE(op.memory_bytes() < 50 * 50 * sizeof(double));
+}
+
+TEST(SmallSectorKernels, SameAsDynamic) {
+  typedef Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic> matrix_t;
+  typedef SmallSectorKernels<double> kernels;
+  ASSERT_EQ(kernels::dim_index(5), -1);
+  for (int row_index = 0; row_index < kernels::num_dims; ++row_index) {
+    for (int col_index = 0; col_index < kernels::num_dims; ++col_index) {
+      const int rows = kernels::dim(row_index), cols = kernels::dim(col_index);
+      ASSERT_EQ(kernels::dim_index(rows), row_index);
+      const matrix_t op = matrix_t::Random(rows, cols);
+      const matrix_t ket = matrix_t::Random(cols, 3), bra = matrix_t::Random(2, rows);
+      matrix_t y_ket(rows, 3), y_bra(2, cols);
+      kernels::apply_ket(row_index, col_index)(op, ket, y_ket);
+      kernels::apply_bra(row_index, col_index)(op, bra, y_bra);
+      ASSERT_TRUE((y_ket - op * ket).cwiseAbs().maxCoeff() < 1E-12);
+      ASSERT_TRUE((y_bra - bra * op).cwiseAbs().maxCoeff() < 1E-12);
+    }
+
+    const int dim = kernels::dim(row_index);
+    const kernels::exp_vector_t exp_v = kernels::exp_vector_t::Random(dim);
+    matrix_t ket = matrix_t::Random(dim, 3), bra = matrix_t::Random(2, dim);
+    const matrix_t ket_ref = exp_v.matrix().asDiagonal() * ket, bra_ref = bra * exp_v.matrix().asDiagonal();
+    kernels::propagate_ket(row_index)(exp_v, ket);
+    kernels::propagate_bra(row_index)(exp_v, bra);
+    ASSERT_TRUE((ket - ket_ref).cwiseAbs().maxCoeff() < 1E-12);
+    ASSERT_TRUE((bra - bra_ref).cwiseAbs().maxCoeff() < 1E-12);
+  }
+}
+
+TEST(ModelLibrary, ParallelSetupIsDeterministic) {
+  const double beta = 10.0;
+  alps::params par_serial, par_parallel;
+  par_serial["model.n_threads"] = 1;
+  par_parallel["model.n_threads"] = 4;
+  boost::shared_ptr<REAL_EIGEN_BASIS_MODEL> p_model = create_two_orbital_model<REAL_EIGEN_BASIS_MODEL>(beta, par_serial);
+  boost::shared_ptr<REAL_EIGEN_BASIS_MODEL> p_model_parallel =
+      create_two_orbital_model<REAL_EIGEN_BASIS_MODEL>(beta, par_parallel);
+
+  boost::random::mt19937 gen(100);
+  std::vector<std::pair<psi, psi> > pairs;
+  generate_operator_pairs(p_model->num_flavors(), 3, beta, gen, pairs);
+  operator_container_t operators;
+  for (int i = 0; i < pairs.size(); ++i) {
+    operators.insert(pairs[i].first);
+    operators.insert(pairs[i].second);
+  }
+
+  SlidingWindowManager<REAL_EIGEN_BASIS_MODEL> sw(p_model.get(), beta), sw_parallel(p_model_parallel.get(), beta);
+  sw.init_stacks(1, operators);
+  sw_parallel.init_stacks(1, operators);
+  ASSERT_TRUE(get_real(sw.compute_trace(operators)) == get_real(sw_parallel.compute_trace(operators)));
+}
+
+//Rotation of the U tensor by successive contractions vs. the naive O(nnz(U) F^4) loop
+TEST(ModelLibrary, URotationByContractions) {
+  typedef std::complex<double> SCALAR;
+  typedef Eigen::Matrix<SCALAR, Eigen::Dynamic, Eigen::Dynamic> matrix_t;
+  const int sites = 2, flavors = 2 * sites;
+  const double onsite_U = 2.0, JH = 0.2;
+
+  //two-orbital Hubbard-Kanamori model
+  std::vector<boost::tuple<int, int, int, int, SCALAR> > Uval_list;
+  for (int isp = 0; isp < 2; ++isp) {
+    for (int isp2 = 0; isp2 < 2; ++isp2) {
+      for (int alpha = 0; alpha < sites; ++alpha) {
+        Uval_list.push_back(get_tuple<SCALAR>(alpha, alpha, alpha, alpha, isp, isp2, onsite_U, sites));
+      }
+      for (int alpha = 0; alpha < sites; ++alpha) {
+        for (int alpha2 = 0; alpha2 < sites; ++alpha2) {
+          if (alpha == alpha2) continue;
+          Uval_list.push_back(get_tuple<SCALAR>(alpha, alpha2, alpha, alpha2, isp, isp2, onsite_U - 2 * JH, sites));
+          Uval_list.push_back(get_tuple<SCALAR>(alpha, alpha2, alpha2, alpha, isp, isp2, JH, sites));
+        }
+      }
+    }
+  }
+
+  //random unitary matrix
+  boost::random::mt19937 gen(100);
+  boost::uniform_real<> uni_dist(-1, 1);
+  matrix_t rand_mat(flavors, flavors);
+  for (int j = 0; j < flavors; ++j) {
+    for (int i = 0; i < flavors; ++i) {
+      rand_mat(i, j) = SCALAR(uni_dist(gen), uni_dist(gen));
+    }
+  }
+  const matrix_t rotmat = Eigen::HouseholderQR<matrix_t>(rand_mat).householderQ();
+  ASSERT_TRUE((rotmat.adjoint() * rotmat - matrix_t::Identity(flavors, flavors)).norm() < 1E-12);
+
+  boost::multi_array<SCALAR, 4> U_rot;
+  rotate_U_tensor(flavors, Uval_list, rotmat, U_rot);
+
+  boost::multi_array<SCALAR, 4> U_rot_naive(boost::extents[flavors][flavors][flavors][flavors]);
+  std::fill(U_rot_naive.origin(), U_rot_naive.origin() + U_rot_naive.num_elements(), 0.0);
+  for (int elem = 0; elem < Uval_list.size(); ++elem) {
+    const int a = boost::get<0>(Uval_list[elem]);
+    const int b = boost::get<1>(Uval_list[elem]);
+    const int ap = boost::get<2>(Uval_list[elem]);
+    const int bp = boost::get<3>(Uval_list[elem]);
+    const SCALAR uval = boost::get<4>(Uval_list[elem]);
+    for (int flavor0 = 0; flavor0 < flavors; ++flavor0) {
+      for (int flavor1 = 0; flavor1 < flavors; ++flavor1) {
+        for (int flavor2 = 0; flavor2 < flavors; ++flavor2) {
+          for (int flavor3 = 0; flavor3 < flavors; ++flavor3) {
+            U_rot_naive[flavor0][flavor1][flavor2][flavor3] +=
+                uval * std::conj(rotmat(a, flavor0)) * std::conj(rotmat(b, flavor1)) *
+                    rotmat(ap, flavor2) * rotmat(bp, flavor3);
+          }
+        }
+      }
+    }
+  }
+
+  double max_diff = 0.0;
+  for (int i = 0; i < U_rot.num_elements(); ++i) {
+    max_diff = std::max(max_diff, std::abs(U_rot.origin()[i] - U_rot_naive.origin()[i]));
+  }
+  ASSERT_TRUE(max_diff < 1E-12);
+}
+
+TEST(ModelLibrary, DirectHamiltonianAssembly) {
+  const double beta = 10.0;
+  alps::params par_direct, par_product;
+  par_direct["model.hamiltonian_assembly"] = std::string("direct");
+  par_product["model.hamiltonian_assembly"] = std::string("operator_product");
+  boost::shared_ptr<REAL_EIGEN_BASIS_MODEL> p_model = create_two_orbital_model<REAL_EIGEN_BASIS_MODEL>(beta, par_direct);
+  boost::shared_ptr<REAL_EIGEN_BASIS_MODEL> p_model_product =
+      create_two_orbital_model<REAL_EIGEN_BASIS_MODEL>(beta, par_product);
+  ASSERT_EQ(p_model->num_sectors(), p_model_product->num_sectors());
+
+  boost::random::mt19937 gen(100);
+  std::vector<std::pair<psi, psi> > pairs;
+  generate_operator_pairs(p_model->num_flavors(), 3, beta, gen, pairs);
+  operator_container_t operators;
+  for (int i = 0; i < pairs.size(); ++i) {
+    operators.insert(pairs[i].first);
+    operators.insert(pairs[i].second);
+  }
+
+  SlidingWindowManager<REAL_EIGEN_BASIS_MODEL> sw(p_model.get(), beta), sw_product(p_model_product.get(), beta);
+  sw.init_stacks(1, operators);
+  sw_product.init_stacks(1, operators);
+  const EXTENDED_REAL trace = get_real(sw.compute_trace(operators));
+  const EXTENDED_REAL trace_product = get_real(sw_product.compute_trace(operators));
+  ASSERT_TRUE(myabs(trace - trace_product) < 1E-10 * myabs(trace));
+}
+
+TEST(ModelLibrary, QuantumNumberSectorEnumeration) {
+  const double beta = 10.0;
+  alps::params par_clustering, par_qn;
+  par_clustering["model.sector_enumeration"] = std::string("clustering");
+  par_qn["model.sector_enumeration"] = std::string("quantum_numbers");
+  boost::shared_ptr<REAL_EIGEN_BASIS_MODEL> p_model =
+      create_two_orbital_model<REAL_EIGEN_BASIS_MODEL>(beta, par_clustering);
+  boost::shared_ptr<REAL_EIGEN_BASIS_MODEL> p_model_qn = create_two_orbital_model<REAL_EIGEN_BASIS_MODEL>(beta, par_qn);
+  ASSERT_EQ(p_model->num_sectors(), p_model_qn->num_sectors());
+
+  boost::random::mt19937 gen(100);
+  std::vector<std::pair<psi, psi> > pairs;
+  generate_operator_pairs(p_model->num_flavors(), 3, beta, gen, pairs);
+  operator_container_t operators;
+  for (int i = 0; i < pairs.size(); ++i) {
+    operators.insert(pairs[i].first);
+    operators.insert(pairs[i].second);
+  }
+
+  SlidingWindowManager<REAL_EIGEN_BASIS_MODEL> sw(p_model.get(), beta), sw_qn(p_model_qn.get(), beta);
+  sw.init_stacks(1, operators);
+  sw_qn.init_stacks(1, operators);
+  const EXTENDED_REAL trace = get_real(sw.compute_trace(operators));
+  const EXTENDED_REAL trace_qn = get_real(sw_qn.compute_trace(operators));
+  ASSERT_TRUE(myabs(trace - trace_qn) < 1E-10 * myabs(trace));
+}
+
+TEST(ModelLibrary, ModelCache) {
+  const double beta = 10.0;
+  const std::string cache_file("model_cache_unittest.h5");
+  std::remove(cache_file.c_str());
+  alps::params par, par_saved, par_loaded, par_rebuilt;
+  par_saved["model.cache_file"] = cache_file;
+  par_loaded["model.cache_file"] = cache_file;
+  par_rebuilt["model.cache_file"] = cache_file;
+  boost::shared_ptr<REAL_EIGEN_BASIS_MODEL> p_model = create_two_orbital_model<REAL_EIGEN_BASIS_MODEL>(beta, par);
+  boost::shared_ptr<REAL_EIGEN_BASIS_MODEL> p_model_saved =
+      create_two_orbital_model<REAL_EIGEN_BASIS_MODEL>(beta, par_saved);
+  boost::shared_ptr<REAL_EIGEN_BASIS_MODEL> p_model_loaded =
+      create_two_orbital_model<REAL_EIGEN_BASIS_MODEL>(beta, par_loaded);
+  ASSERT_FALSE(p_model_saved->loaded_from_cache());
+  ASSERT_TRUE(p_model_loaded->loaded_from_cache());
+  ASSERT_EQ(p_model->num_brakets(), p_model_loaded->num_brakets());
+
+  boost::random::mt19937 gen(100);
+  std::vector<std::pair<psi, psi> > pairs;
+  generate_operator_pairs(p_model->num_flavors(), 3, beta, gen, pairs);
+  operator_container_t operators;
+  for (int i = 0; i < pairs.size(); ++i) {
+    operators.insert(pairs[i].first);
+    operators.insert(pairs[i].second);
+  }
+
+  SlidingWindowManager<REAL_EIGEN_BASIS_MODEL> sw(p_model.get(), beta), sw_loaded(p_model_loaded.get(), beta);
+  sw.init_stacks(1, operators);
+  sw_loaded.init_stacks(1, operators);
+  ASSERT_TRUE(get_real(sw.compute_trace(operators)) == get_real(sw_loaded.compute_trace(operators)));
+
+  //A different cutoff energy invalidates the cache
+  par_rebuilt["model.outer_cutoff_energy"] = 1.0;
+  boost::shared_ptr<REAL_EIGEN_BASIS_MODEL> p_model_rebuilt =
+      create_two_orbital_model<REAL_EIGEN_BASIS_MODEL>(beta, par_rebuilt);
+  ASSERT_FALSE(p_model_rebuilt->loaded_from_cache());
+  std::remove(cache_file.c_str());
+}
+
+TEST(ModelLibrary, AdaptiveTruncation) {
+  const double beta = 10.0;
+  boost::shared_ptr<REAL_EIGEN_BASIS_MODEL> p_model = create_two_orbital_model(beta);
+  const int num_sectors = p_model->num_sectors();
+  const int num_brakets = p_model->num_brakets();
+
+  boost::random::mt19937 gen(100);
+  std::vector<std::pair<psi, psi> > pairs;
+  generate_operator_pairs(p_model->num_flavors(), 3, beta, gen, pairs);
+  operator_container_t operators, no_operators;
+  for (int i = 0; i < pairs.size(); ++i) {
+    operators.insert(pairs[i].first);
+    operators.insert(pairs[i].second);
+  }
+  SlidingWindowManager<REAL_EIGEN_BASIS_MODEL> sw(p_model.get(), beta);
+  sw.init_stacks(1, operators);
+  const double trace_org = get_real(sw.compute_trace(operators));
+
+  //Only the lowest eigenstate of the sector with the lowest energy has a non-zero weight
+  int ground_sector = -1, ground_braket = -1;
+  for (int braket = 0; braket < num_brakets; ++braket) {
+    const int sector = p_model->get_outer_ket(braket).sector();
+    if (ground_sector < 0 || p_model->min_energy(sector) < p_model->min_energy(ground_sector)) {
+      ground_sector = sector;
+      ground_braket = braket;
+    }
+  }
+  std::vector<std::vector<double> > inner_weights(num_sectors), outer_weights(num_brakets);
+  int dim_org = 0;
+  for (int sector = 0; sector < num_sectors; ++sector) {
+    inner_weights[sector].resize(p_model->dim_sector(sector), 0.0);
+    dim_org += p_model->dim_sector(sector);
+  }
+  for (int braket = 0; braket < num_brakets; ++braket) {
+    outer_weights[braket].resize(size2(p_model->get_outer_ket(braket).obj()), 0.0);
+  }
+  inner_weights[ground_sector][0] = outer_weights[ground_braket][0] = 1.0;
+
+  //Nothing is thrown away if the weights of all states exceed the tolerance
+  std::vector<std::vector<double> > uniform_weights(inner_weights);
+  for (int sector = 0; sector < num_sectors; ++sector) {
+    std::fill(uniform_weights[sector].begin(), uniform_weights[sector].end(), 1.0 / dim_org);
+  }
+  ASSERT_FALSE(p_model->truncate_states(uniform_weights, std::vector<std::vector<double> >(), 0.5 / dim_org));
+
+  //Reverting the truncation restores the trace
+  ASSERT_TRUE(p_model->truncate_states(inner_weights, outer_weights, 0.5));
+  ASSERT_EQ(1, p_model->dim_sector(ground_sector));
+  p_model->revert_truncation();
+  ASSERT_EQ(num_brakets, p_model->num_brakets());
+  SlidingWindowManager<REAL_EIGEN_BASIS_MODEL> sw_reverted(p_model.get(), beta);
+  sw_reverted.init_stacks(1, operators);
+  ASSERT_TRUE(get_real(sw_reverted.compute_trace(operators)) == trace_org);
+
+  //Only the ground state is left: the trace without operators is exp(-beta E0)
+  ASSERT_TRUE(p_model->truncate_states(inner_weights, outer_weights, 0.5));
+  p_model->commit_truncation();
+  int dim_truncated = 0;
+  for (int sector = 0; sector < num_sectors; ++sector) {
+    dim_truncated += p_model->dim_sector(sector);
+  }
+  ASSERT_EQ(1, dim_truncated);
+  ASSERT_EQ(num_brakets, p_model->num_brakets());
+  SlidingWindowManager<REAL_EIGEN_BASIS_MODEL> sw_truncated(p_model.get(), beta);
+  sw_truncated.init_stacks(1, no_operators);
+  const double trace_ground = get_real(sw_truncated.compute_trace(no_operators));
+  ASSERT_NEAR(trace_ground / std::exp(-beta * p_model->min_energy(ground_sector)), 1.0, 1E-10);
+}
+
+//Single-site model given via parameters (command line mode)
+void set_single_site_model(alps::params &par, double hopping_Im) {
+  const int flavors = 2, Np1 = 3;
+  par["model.sites"] = 1;
+  par["model.spins"] = 2;
+  par["model.n_tau_hyb"] = Np1 - 1;
+  par["model.command_line_mode"] = true;
+  par["model.coulomb_tensor_Re"] = std::vector<double>(flavors * flavors * flavors * flavors, 1.0);
+  par["model.coulomb_tensor_Im"] = std::vector<double>(flavors * flavors * flavors * flavors, 0.0);
+  par["model.hopping_matrix_Re"] = std::vector<double>(flavors * flavors, 0.5);
+  std::vector<double> t_Im(flavors * flavors, 0.0);
+  t_Im[1] = hopping_Im;
+  t_Im[2] = -hopping_Im;
+  par["model.hopping_matrix_Im"] = t_Im;
+  par["model.delta_Re"] = std::vector<double>(Np1 * flavors * flavors, -0.5);
+  par["model.delta_Im"] = std::vector<double>(Np1 * flavors * flavors, 0.0);
+  ImpurityModelEigenBasis<double>::define_parameters(par);
+}
+
+TEST(Solver, RealProblemDetection) {
+  alps::params par_real, par_complex;
+  set_single_site_model(par_real, 0.0);
+  set_single_site_model(par_complex, 0.1);
+  std::string reason;
+  ASSERT_TRUE(alps::cthyb::Solver::is_real_problem(par_real, reason));
+  ASSERT_FALSE(alps::cthyb::Solver::is_real_problem(par_complex, reason));
+  ASSERT_TRUE(reason.find("hopping matrix") != std::string::npos);
+}
+
+TEST(SlidingWindow, KrylovModel) {
+  const double beta = 10.0;
+  boost::shared_ptr<REAL_EIGEN_BASIS_MODEL> p_model = create_two_orbital_model(beta);
+  //All eigenstates are outer states. Small Krylov subspaces for testing restarts and time stepping.
+  alps::params par;
+  par["model.krylov.dim"] = 3;
+  par["model.krylov.tolerance"] = 1E-12;
+  par["model.krylov.num_outer_states"] = 16;
+  boost::shared_ptr<REAL_KRYLOV_MODEL> p_krylov = create_two_orbital_model<REAL_KRYLOV_MODEL>(beta, par);
+  ASSERT_EQ(p_krylov->num_sectors(), p_model->num_sectors());
+  ASSERT_TRUE(p_krylov->translationally_invariant());
+
+  boost::random::mt19937 gen(100);
+  std::vector<std::pair<psi, psi> > pairs;
+  generate_operator_pairs(p_model->num_flavors(), 2, beta, gen, pairs);
+  operator_container_t operators;
+  for (int i = 0; i < pairs.size(); ++i) {
+    operators.insert(pairs[i].first);
+    operators.insert(pairs[i].second);
+  }
+
+  SlidingWindowManager<REAL_EIGEN_BASIS_MODEL> sw(p_model.get(), beta);
+  SlidingWindowManager<REAL_KRYLOV_MODEL> sw_krylov(p_krylov.get(), beta);
+  sw.init_stacks(1, operators);
+  sw_krylov.init_stacks(1, operators);
+  const EXTENDED_REAL trace = get_real(sw.compute_trace(operators));
+  const EXTENDED_REAL trace_krylov = get_real(sw_krylov.compute_trace(operators));
+  ASSERT_TRUE(myabs(trace_krylov - trace) < 1E-8 * myabs(trace));
+}
+
+TEST(SlidingWindow, BraketPool) {
+  const double beta = 10.0;
+  boost::shared_ptr<REAL_EIGEN_BASIS_MODEL> p_model = create_two_orbital_model(beta);
+
+  boost::random::mt19937 gen(100);
+  std::vector<std::pair<psi, psi> > pairs;
+  generate_operator_pairs(p_model->num_flavors(), 5, beta, gen, pairs);
+  operator_container_t operators;
+  for (int i = 0; i < pairs.size(); ++i) {
+    operators.insert(pairs[i].first);
+    operators.insert(pairs[i].second);
+  }
+
+  SlidingWindowManager<REAL_EIGEN_BASIS_MODEL> sw(p_model.get(), beta);
+  sw.init_stacks(4, operators);
+  const EXTENDED_REAL trace_ref = get_real(sw.compute_trace(operators));
+  ASSERT_TRUE(trace_ref != 0.0);
+
+  //Sweep the window forth and back. Storage of popped bras/kets is recycled.
+  sw.reset_braket_pool_stats();
+  for (int move = 0; move < 4 * sw.get_n_window(); ++move) {
+    sw.move_window_to_next_position(operators);
+    const EXTENDED_REAL trace = get_real(sw.compute_trace(operators));
+    ASSERT_TRUE(myabs(trace - trace_ref) <= 1E-8 * myabs(trace_ref));
+  }
+  ASSERT_TRUE(sw.get_braket_pool_stats().second > 0);
+}
+
+TEST(SlidingWindow, NormBound) {
+  const double beta = 10.0;
+  boost::shared_ptr<REAL_EIGEN_BASIS_MODEL> p_model = create_two_orbital_model(beta);
+
+  boost::random::mt19937 gen(100);
+  std::vector<std::pair<psi, psi> > pairs;
+  generate_operator_pairs(p_model->num_flavors(), 5, beta, gen, pairs);
+  operator_container_t operators;
+  for (int i = 0; i < pairs.size(); ++i) {
+    operators.insert(pairs[i].first);
+    operators.insert(pairs[i].second);
+  }
+
+  const NORM_BOUND_TYPE types[] = {SPECTRAL_NORM_BOUND, HOLDER_NORM_BOUND, FROBENIUS_NORM_BOUND};
+  std::vector<EXTENDED_REAL> bound_sum(3);
+  for (int t = 0; t < 3; ++t) {
+    SlidingWindowManager<REAL_EIGEN_BASIS_MODEL> sw(p_model.get(), beta);
+    sw.set_norm_bound_type(types[t]);
+    sw.init_stacks(4, operators);
+    for (int move = 0; move < 4 * sw.get_n_window(); ++move) {
+      sw.move_window_to_next_position(operators);
+    }
+    std::vector<EXTENDED_REAL> bound(sw.get_num_brakets());
+    bound_sum[t] = sw.compute_trace_bound(operators, bound);
+    ASSERT_TRUE(bound_sum[t] >= myabs(sw.compute_trace(operators)));
+  }
+  ASSERT_TRUE(bound_sum[1] >= bound_sum[0]);
+  ASSERT_TRUE(bound_sum[1] <= bound_sum[2]);
+  ASSERT_TRUE(bound_sum[2] >= bound_sum[0]);
+}
+
+TEST(SlidingWindow, BraketParallelIsDeterministic) {
+  const double beta = 10.0;
+  boost::shared_ptr<REAL_EIGEN_BASIS_MODEL> p_model = create_two_orbital_model(beta);
+
+  boost::random::mt19937 gen(100);
+  std::vector<std::pair<psi, psi> > pairs;
+  generate_operator_pairs(p_model->num_flavors(), 5, beta, gen, pairs);
+  operator_container_t operators;
+  for (int i = 0; i < pairs.size(); ++i) {
+    operators.insert(pairs[i].first);
+    operators.insert(pairs[i].second);
+  }
+
+  SlidingWindowManager<REAL_EIGEN_BASIS_MODEL> sw_serial(p_model.get(), beta), sw_parallel(p_model.get(), beta);
+  sw_parallel.set_num_threads(4);
+  sw_serial.init_stacks(4, operators);
+  sw_parallel.init_stacks(4, operators);
+  for (int move = 0; move < 6; ++move) {
+    ASSERT_TRUE(sw_serial.compute_trace(operators) == sw_parallel.compute_trace(operators));
+    sw_serial.move_window_to_next_position(operators);
+    sw_parallel.move_window_to_next_position(operators);
+  }
+}
+
+TEST(SlidingWindow, LazyTraceParallelIsDeterministic) {
+  typedef SlidingWindowManager<REAL_EIGEN_BASIS_MODEL>::EXTENDED_SCALAR EXTENDED_SCALAR;
+  const double beta = 10.0;
+  boost::shared_ptr<REAL_EIGEN_BASIS_MODEL> p_model = create_two_orbital_model(beta);
+
+  boost::random::mt19937 gen(100);
+  std::vector<std::pair<psi, psi> > pairs;
+  generate_operator_pairs(p_model->num_flavors(), 5, beta, gen, pairs);
+  operator_container_t operators;
+  for (int i = 0; i < pairs.size(); ++i) {
+    operators.insert(pairs[i].first);
+    operators.insert(pairs[i].second);
+  }
+
+  SlidingWindowManager<REAL_EIGEN_BASIS_MODEL> sw_serial(p_model.get(), beta), sw_parallel(p_model.get(), beta);
+  sw_parallel.set_num_threads(4);
+  sw_serial.init_stacks(4, operators);
+  sw_parallel.init_stacks(4, operators);
+
+  const EXTENDED_SCALAR trace = sw_serial.compute_trace(operators);
+  ASSERT_TRUE(myabs(trace) > 0.0);
+
+  //no cutoff, a cutoff below |trace| and a cutoff which rejects the configuration
+  const double factors[] = {0.0, 0.5, 1E+10};
+  for (int i = 0; i < 3; ++i) {
+    const EXTENDED_REAL cutoff = myabs(trace) * factors[i];
+    std::vector<EXTENDED_REAL> bound_serial(sw_serial.get_num_brakets()), bound_parallel(sw_parallel.get_num_brakets());
+    sw_serial.compute_trace_bound(operators, bound_serial);
+    sw_parallel.compute_trace_bound(operators, bound_parallel);
+    const std::pair<bool, EXTENDED_SCALAR> r_serial = sw_serial.lazy_eval_trace(operators, cutoff, bound_serial);
+    const std::pair<bool, EXTENDED_SCALAR> r_parallel = sw_parallel.lazy_eval_trace(operators, cutoff, bound_parallel);
+    ASSERT_EQ(r_serial.first, r_parallel.first);
+    ASSERT_EQ(r_serial.first, i < 2);
+    ASSERT_TRUE(r_serial.second == r_parallel.second);
+    ASSERT_TRUE(bound_serial == bound_parallel);
+  }
+}
+
 TEST(SpectralNorm, SVDvsDiagonalization) {
   typedef std::complex<double> Scalar;
   Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> mat(2, 6);
@@ -119,6 +901,187 @@ TEST(SpectralNorm, SVDvsDiagonalization) {
   ASSERT_TRUE(std::abs(spectral_norm_SVD<Scalar>(mat) - spectral_norm_diag<Scalar>(mat)) < 1E-8);
 }
 
+TEST(SpectralNorm, CheapUpperBounds) {
+  typedef Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic> matrix_t;
+  boost::random::mt19937 gen(100);
+  boost::uniform_real<> uni_dist(-1, 1);
+
+  //random matrices, a matrix with two (almost) degenerate singular values and a diagonal matrix
+  std::vector<matrix_t> matrices;
+  for (int i_mat = 0; i_mat < 10; ++i_mat) {
+    matrix_t mat(10, 6);
+    for (int j = 0; j < mat.cols(); ++j) {
+      for (int i = 0; i < mat.rows(); ++i) {
+        mat(i, j) = uni_dist(gen);
+      }
+    }
+    matrices.push_back(mat);
+  }
+  {
+    matrix_t mat = matrix_t::Identity(6, 6);
+    mat(1, 1) = 1 - 1E-10;
+    mat(0, 1) = mat(1, 0) = 1E-3;
+    matrices.push_back(mat);
+  }
+  {
+    matrix_t mat = matrix_t::Zero(5, 5);
+    for (int i = 0; i < 5; ++i) {
+      mat(i, i) = -0.1 * (i + 1);
+    }
+    matrices.push_back(mat);
+  }
+
+  for (int i_mat = 0; i_mat < matrices.size(); ++i_mat) {
+    for (int transpose = 0; transpose < 2; ++transpose) {
+      const matrix_t mat = transpose == 0 ? matrix_t(matrices[i_mat]) : matrix_t(matrices[i_mat].transpose());
+      const double norm_exact = mat.jacobiSvd().singularValues()(0);
+      ASSERT_TRUE(frobenius_norm<double>(mat) >= norm_exact * (1 - 1E-12));
+      ASSERT_TRUE(holder_norm_bound<double>(mat) >= norm_exact * (1 - 1E-12));
+      ASSERT_TRUE(holder_norm_bound<double>(mat) <= frobenius_norm<double>(mat));
+    }
+  }
+  ASSERT_NEAR(holder_norm_bound<double>(matrices.back()), 0.5, 1E-12);
+}
+
+TEST(ScaledDouble, NoOverflowUnderflow) {
+  //product of 2000 small numbers: far below the smallest double
+  scaled_double prod = 1.0;
+  for (int i = 0; i < 2000; ++i) {
+    prod *= 1E-3;
+  }
+  ASSERT_TRUE(prod > 0.0);
+  ASSERT_TRUE(prod * 1E3 > prod);
+  ASSERT_TRUE(-prod < prod * 0.5);
+  ASSERT_NEAR(((prod * 3.0 + prod) / prod).convert_to<double>(), 4.0, 1E-14);
+  ASSERT_NEAR((sqrt(prod * prod) / prod).convert_to<double>(), 1.0, 1E-14);
+  ASSERT_NEAR((hypot(prod * 3.0, prod * 4.0) / prod).convert_to<double>(), 5.0, 1E-14);
+  ASSERT_NEAR((pow(prod, 2) / (prod * prod)).convert_to<double>(), 1.0, 1E-10);
+  ASSERT_TRUE(prod.convert_to<double>() == 0.0);
+
+  const scaled_double x(-2.5), y(0.75);
+  ASSERT_TRUE(x < y && y > x && x <= x && !(y < x) && x != y);
+  ASSERT_EQ((x + y).convert_to<double>(), -1.75);
+  ASSERT_EQ((x - y).convert_to<double>(), -3.25);
+  ASSERT_EQ((x * y).convert_to<double>(), -1.875);
+  ASSERT_EQ(abs(x).convert_to<double>(), 2.5);
+  ASSERT_TRUE(x + y * 1E-15 != x);
+  ASSERT_TRUE(x + y * 1E-300 == x);
+}
+
+TEST(HybridizationFunction, InterpolationAndBatchedEvaluation) {
+  typedef double SCALAR;
+  const double beta = 10.0;
+  const int n_flavors = 2;
+
+  boost::random::mt19937 gen(100);
+  boost::uniform_real<> uni_dist(0, 1);
+
+  //F(tau) = -a (exp(-b tau) + exp(-c (beta-tau)))
+  const int n_tau_list[] = {100, 1000};
+  std::vector<double> max_diff_linear, max_diff_cubic;
+  for (int i_n_tau = 0; i_n_tau < 2; ++i_n_tau) {
+    const int n_tau = n_tau_list[i_n_tau];
+    boost::multi_array<SCALAR, 3> F(boost::extents[n_flavors][n_flavors][n_tau + 1]);
+    for (int flavor = 0; flavor < n_flavors; ++flavor) {
+      for (int flavor2 = 0; flavor2 < n_flavors; ++flavor2) {
+        for (int itau = 0; itau < n_tau + 1; ++itau) {
+          const double tau = beta * itau / n_tau;
+          F[flavor][flavor2][itau] = -(0.5 + flavor + 0.1 * flavor2) *
+              (std::exp(-(1.0 + flavor) * tau) + std::exp(-(1.0 + flavor2) * (beta - tau)));
+        }
+      }
+    }
+
+    HybridizationFunction<SCALAR> hyb(beta, n_tau, n_flavors, F);
+    for (int mode = 0; mode < 2; ++mode) {
+      if (mode == 1) {
+        hyb.set_interpolation(CUBIC_SPLINE_INTERPOLATION);
+      }
+
+      const int n_ops = 50;
+      std::vector<psi> c_ops, cdagg_ops;
+      for (int i = 0; i < n_ops; ++i) {
+        c_ops.push_back(psi(OperatorTime(beta * uni_dist(gen)), ANNIHILATION_OP, i % n_flavors));
+        cdagg_ops.push_back(psi(OperatorTime(beta * uni_dist(gen)), CREATION_OP, (i / n_flavors) % n_flavors));
+      }
+
+      double max_diff = 0.0;
+      Eigen::Matrix<SCALAR, Eigen::Dynamic, Eigen::Dynamic> G_col(n_ops, n_ops), G_row(n_ops, n_ops);
+      for (int i = 0; i < n_ops; ++i) {
+        evaluate_gf_col(hyb, &c_ops[0], cdagg_ops[i], G_col.col(i));
+        evaluate_gf_row(hyb, c_ops[i], &cdagg_ops[0], G_row.row(i));
+      }
+      for (int i = 0; i < n_ops; ++i) {
+        for (int j = 0; j < n_ops; ++j) {
+          ASSERT_EQ(G_col(i, j), hyb(c_ops[i], cdagg_ops[j]));
+          ASSERT_EQ(G_row(i, j), hyb(c_ops[i], cdagg_ops[j]));
+
+          double tau = c_ops[i].time() - cdagg_ops[j].time();
+          double sign = 1.0;
+          if (tau < 0) {
+            tau += beta;
+            sign = -1.0;
+          }
+          const int flavor = c_ops[i].flavor(), flavor2 = cdagg_ops[j].flavor();
+          const double exact = -sign * (0.5 + flavor + 0.1 * flavor2) *
+              (std::exp(-(1.0 + flavor) * tau) + std::exp(-(1.0 + flavor2) * (beta - tau)));
+          max_diff = std::max(max_diff, std::abs(hyb(c_ops[i], cdagg_ops[j]) - exact));
+        }
+      }
+      (mode == 0 ? max_diff_linear : max_diff_cubic).push_back(max_diff);
+    }
+  }
+
+  //A cubic spline on a 10 times coarser mesh is more accurate than the linear interpolation
+  ASSERT_TRUE(max_diff_cubic[0] < max_diff_linear[1]);
+  ASSERT_TRUE(max_diff_cubic[1] < 1E-6);
+}
+
+//The error of the cubic spline is O(dtau^4) including the first and last intervals of the mesh,
+//and the first derivative is continuous at tau = dtau and tau = beta - dtau
+TEST(HybridizationFunction, CubicSplineConvergence) {
+  typedef double SCALAR;
+  const double beta = 10.0;
+
+  const int n_tau_list[] = {50, 100, 200};
+  std::vector<double> max_diff;
+  for (int i_n_tau = 0; i_n_tau < 3; ++i_n_tau) {
+    const int n_tau = n_tau_list[i_n_tau];
+    const double dtau = beta / n_tau;
+    boost::multi_array<SCALAR, 3> F(boost::extents[1][1][n_tau + 1]);
+    for (int itau = 0; itau < n_tau + 1; ++itau) {
+      const double tau = dtau * itau;
+      F[0][0][itau] = -0.5 * (std::exp(-2.0 * tau) + std::exp(-1.5 * (beta - tau)));
+    }
+    HybridizationFunction<SCALAR> hyb(beta, n_tau, 1, F);
+    hyb.set_interpolation(CUBIC_SPLINE_INTERPOLATION);
+
+    const psi cdagg_op(OperatorTime(0.0), CREATION_OP, 0);
+    double diff = 0.0;
+    const int n_points = 10000;
+    for (int i = 1; i < n_points; ++i) {
+      const double tau = (beta * i) / n_points;
+      const double exact = -0.5 * (std::exp(-2.0 * tau) + std::exp(-1.5 * (beta - tau)));
+      diff = std::max(diff, std::abs(hyb(psi(OperatorTime(tau), ANNIHILATION_OP, 0), cdagg_op) - exact));
+    }
+    max_diff.push_back(diff);
+
+    const double knots[] = {dtau, beta - dtau};
+    const double eps = 1E-5 * dtau;
+    for (int k = 0; k < 2; ++k) {
+      const double f_left = hyb(psi(OperatorTime(knots[k] - eps), ANNIHILATION_OP, 0), cdagg_op);
+      const double f_center = hyb(psi(OperatorTime(knots[k]), ANNIHILATION_OP, 0), cdagg_op);
+      const double f_right = hyb(psi(OperatorTime(knots[k] + eps), ANNIHILATION_OP, 0), cdagg_op);
+      const double slope_left = (f_center - f_left) / eps, slope_right = (f_right - f_center) / eps;
+      ASSERT_TRUE(std::abs(slope_right - slope_left) < 1E-4 * std::abs(slope_left));
+    }
+  }
+
+  //Halving the mesh reduces the error by a factor of about 16
+  ASSERT_TRUE(max_diff[0] / max_diff[1] > 12.0);
+  ASSERT_TRUE(max_diff[1] / max_diff[2] > 12.0);
+}
+
 TEST(FastUpdate, CombSort) {
   const int N = 1000;
   std::vector<double> data(N);
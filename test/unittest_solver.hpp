@@ -1,4 +1,5 @@
 #include <alps/params.hpp>
+#include <alps/mc/random01.hpp>
 
 #include <boost/random.hpp>
 
@@ -12,7 +13,12 @@
 
 #include <alps/fastupdate/detail/util.hpp>
 #include "../src/model/model.hpp"
+#include "../src/sliding_window/sliding_window.hpp"
 #include "../src/util.hpp"
+#include "../src/scaled_double.hpp"
+#include "../src/solver.hpp"
+#include "../src/mc_config.hpp"
+#include "../src/moves/moves.hpp"
 
 template<typename T>
 boost::tuple<int,int,int,int,T>
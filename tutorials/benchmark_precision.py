@@ -0,0 +1,67 @@
+#
+# Compare the speed of the solver built with three types of extended-precision scalars
+# used for traces/bounds (USE_QUAD_PRECISION, USE_SCALED_DOUBLE, plain double).
+#
+# Generate the input files of the tutorials first (see README.md), then run e.g.
+#   $python benchmark_precision.py --timelimit 60 tutorial0 tutorial1
+# The solver is built three times under ./build_benchmark_*.
+#
+from __future__ import print_function
+import argparse
+import os
+import re
+import subprocess
+
+modes = [
+    ('quad', ['-DUSE_QUAD_PRECISION=ON', '-DUSE_SCALED_DOUBLE=OFF']),
+    ('scaled', ['-DUSE_QUAD_PRECISION=OFF', '-DUSE_SCALED_DOUBLE=ON']),
+    ('double', ['-DUSE_QUAD_PRECISION=OFF', '-DUSE_SCALED_DOUBLE=OFF']),
+]
+
+parser = argparse.ArgumentParser()
+parser.add_argument('tutorials', nargs='+', help='Directories containing input.ini')
+parser.add_argument('--timelimit', type=int, default=60, help='Simulation time in sec for each run')
+parser.add_argument('--source', default=os.path.join(os.path.dirname(os.path.abspath(__file__)), '..'))
+parser.add_argument('--cmake_args', default='', help='Additional arguments to cmake (e.g. -DALPSCore_DIR=...)')
+args = parser.parse_args()
+
+# Timings per window sweep printed by the solver built with MEASURE_TIMING
+timing_lines = {
+    'local': re.compile(r'Local updates.*: *([-+0-9.eE]+)'),
+    'global': re.compile(r'Global updates.*: *([-+0-9.eE]+)'),
+    'meas': re.compile(r'Non worm measurement: *([-+0-9.eE]+)'),
+}
+
+results = {}
+for name, flags in modes:
+    build_dir = os.path.abspath('build_benchmark_' + name)
+    if not os.path.exists(build_dir):
+        os.mkdir(build_dir)
+    subprocess.check_call(['cmake', args.source, '-DCMAKE_BUILD_TYPE=Release', '-DMEASURE_TIMING=ON', '-DTesting=OFF']
+                          + flags + args.cmake_args.split(), cwd=build_dir)
+    subprocess.check_call(['cmake', '--build', '.', '--target', 'hybmat'], cwd=build_dir)
+
+    for tutorial in args.tutorials:
+        # Run with the same input except for the time limit and the output file
+        with open(os.path.join(tutorial, 'input.ini')) as f:
+            lines = [l for l in f.readlines() if not re.match(r'\s*(timelimit|outputfile)\s*=', l)]
+        input_file = 'input_benchmark_' + name + '.ini'
+        with open(os.path.join(tutorial, input_file), 'w') as f:
+            f.write('timelimit=%d\n' % args.timelimit)
+            f.write('outputfile="input_benchmark_%s.out.h5"\n' % name)
+            f.writelines(lines)
+
+        output = subprocess.check_output([os.path.join(build_dir, 'hybmat'), input_file], cwd=tutorial)
+        output = output.decode('utf-8') if not isinstance(output, str) else output
+        timings = {}
+        for key, pattern in timing_lines.items():
+            m = pattern.search(output)
+            timings[key] = float(m.group(1)) if m else float('nan')
+        results[(tutorial, name)] = timings
+
+print()
+print('Timings per window sweep in sec (local updates / global updates / non-worm measurement)')
+for tutorial in args.tutorials:
+    for name, flags in modes:
+        t = results[(tutorial, name)]
+        print('%-20s %-8s %12.4e %12.4e %12.4e' % (tutorial, name, t['local'], t['global'], t['meas']))
@@ -0,0 +1,57 @@
+#
+# Compare the setup time and the peak memory usage of the two ways of building the local Hamiltonian
+# (model.hamiltonian_assembly = direct / operator_product).
+#
+# Generate the input files of the tutorials first (see README.md), then run e.g.
+#   $python benchmark_setup.py --hybmat /path/to/hybmat tutorial1
+# Each run is stopped shortly after the setup (timelimit=1).
+#
+from __future__ import print_function
+import argparse
+import os
+import re
+import subprocess
+import sys
+
+modes = ['direct', 'operator_product']
+
+parser = argparse.ArgumentParser()
+parser.add_argument('tutorials', nargs='+', help='Directories containing input.ini')
+parser.add_argument('--hybmat', required=True, help='Path to the executable of the solver')
+args = parser.parse_args()
+
+# Run the solver in a child Python process to measure the peak RSS of that run alone
+wrapper = ('import resource, subprocess, sys\n'
+           'out = subprocess.check_output(sys.argv[1:])\n'
+           'sys.stdout.write(out.decode("utf-8") if not isinstance(out, str) else out)\n'
+           'print("PEAK_RSS_KB %d" % resource.getrusage(resource.RUSAGE_CHILDREN).ru_maxrss)\n')
+
+assembly_line = re.compile(r'Hamiltonian assembly \((\w+)\): *([-+0-9.eE]+) sec')
+rss_line = re.compile(r'PEAK_RSS_KB (\d+)')
+
+results = {}
+for tutorial in args.tutorials:
+    with open(os.path.join(tutorial, 'input.ini')) as f:
+        lines = [l for l in f.readlines()
+                 if not re.match(r'\s*(timelimit|outputfile|model\.hamiltonian_assembly)\s*=', l)]
+    for mode in modes:
+        input_file = 'input_benchmark_setup_' + mode + '.ini'
+        with open(os.path.join(tutorial, input_file), 'w') as f:
+            f.write('timelimit=1\n')
+            f.write('outputfile="input_benchmark_setup_%s.out.h5"\n' % mode)
+            f.write('model.hamiltonian_assembly="%s"\n' % mode)
+            f.writelines(lines)
+        output = subprocess.check_output([sys.executable, '-c', wrapper, os.path.abspath(args.hybmat), input_file],
+                                         cwd=tutorial)
+        output = output.decode('utf-8') if not isinstance(output, str) else output
+        m = assembly_line.search(output)
+        m_rss = rss_line.search(output)
+        results[(tutorial, mode)] = (float(m.group(2)) if m else float('nan'),
+                                     int(m_rss.group(1)) / 1024.0 if m_rss else float('nan'))
+
+print()
+print('Time for building the Hamiltonian in sec / peak RSS of the whole run in MB')
+for tutorial in args.tutorials:
+    for mode in modes:
+        t, rss = results[(tutorial, mode)]
+        print('%-20s %-18s %12.4e %10.1f' % (tutorial, mode, t, rss))